@@ -136,6 +136,51 @@ void celtnormalise_bands(const CELTMode *m, const celt_sig * restrict freq, celt
    } while (++c<C);
 }
 
+/* Same as celtcompute_band_energies() followed by celtnormalise_bands(), but
+   each band is normalised right after its energy is computed, while it is
+   still in cache */
+void celtcompute_and_normalise_bands(const CELTMode *m, const celt_sig * restrict freq, celt_norm * restrict X, celt_ener *bank, int end, int _C, int M)
+{
+   int i, c, N;
+   const celt_int16 *eBands = m->eBands;
+   const int C = CHANNELS(_C);
+   N = M*m->shortMdctSize;
+   c=0; do {
+      const celt_sig * restrict f = freq+c*N;
+      celt_norm * restrict x = X+c*N;
+      for (i=0;i<end;i++)
+      {
+         int j, shift;
+         const int band_start = M*eBands[i];
+         const int band_end = M*eBands[i+1];
+         celt_word32 maxval=0;
+         celt_word32 sum = 0;
+         celt_ener E;
+         celt_word16 g, E16;
+
+         for (j=band_start;j<band_end;j++)
+            maxval = MAX32(maxval, ABS32(f[j]));
+         if (maxval > 0)
+         {
+            shift = celt_ilog2(maxval)-10;
+            for (j=band_start;j<band_end;j++)
+               sum = MAC16_16(sum, EXTRACT16(VSHR32(f[j],shift)),
+                                   EXTRACT16(VSHR32(f[j],shift)));
+            E = EPSILON+VSHR32(EXTEND32(celt_sqrt(sum)),-shift);
+         } else {
+            E = EPSILON;
+         }
+         bank[i+c*m->nbEBands] = E;
+
+         shift = celt_zlog2(E)-13;
+         E16 = VSHR32(E, shift);
+         g = EXTRACT16(celt_rcp(SHL32(E16,3)));
+         for (j=band_start;j<band_end;j++)
+            x[j] = MULT16_16_Q15(VSHR32(f[j],shift-1),g);
+      }
+   } while (++c<C);
+}
+
 #else /* FIXED_POINT */
 /* Compute the amplitude (sqrt energy) in each of the bands */
 void celtcompute_band_energies(const CELTMode *m, const celt_sig *X, celt_ener *bank, int end, int _C, int M)
@@ -169,41 +214,64 @@ void celtnormalise_bands(const CELTMode *m, const celt_sig * restrict freq, celt
       for (i=0;i<end;i++)
       {
          int j;
-         celt_word16 g = 1.f/(1e-27f+bank[i+c*m->nbEBands]);
+         celt_word16 g = celt_rcp(1e-27f+bank[i+c*m->nbEBands]);
          for (j=M*eBands[i];j<M*eBands[i+1];j++)
             X[j+c*N] = freq[j+c*N]*g;
       }
    } while (++c<C);
 }
 
-#endif /* FIXED_POINT */
-
-/* De-normalise the energy to produce the synthesis from the unit-energy bands */
-void celtdenormalise_bands(const CELTMode *m, const celt_norm * restrict X, celt_sig * restrict freq, const celt_ener *bank, int end, int _C, int M)
+/* Same as celtcompute_band_energies() followed by celtnormalise_bands(), but
+   each band is normalised right after its energy is computed, while it is
+   still in cache */
+void celtcompute_and_normalise_bands(const CELTMode *m, const celt_sig * restrict freq, celt_norm * restrict X, celt_ener *bank, int end, int _C, int M)
 {
    int i, c, N;
    const celt_int16 *eBands = m->eBands;
    const int C = CHANNELS(_C);
    N = M*m->shortMdctSize;
-   celt_assert2(C<=2, "celtdenormalise_bands() not implemented for >2 channels");
    c=0; do {
-      celt_sig * restrict f;
-      const celt_norm * restrict x;
-      f = freq+c*N;
-      x = X+c*N;
+      const celt_sig * restrict f = freq+c*N;
+      celt_norm * restrict x = X+c*N;
       for (i=0;i<end;i++)
       {
-         int j, band_end;
-         celt_word32 g = SHR32(bank[i+c*m->nbEBands],1);
-         j=M*eBands[i];
-         band_end = M*eBands[i+1];
-         do {
-            *f++ = SHL32(MULT16_32_Q15(*x, g),2);
-            x++;
-         } while (++j<band_end);
+         int j;
+         const int band_start = M*eBands[i];
+         const int band_end = M*eBands[i+1];
+         celt_word32 sum = 1e-27f;
+         celt_word16 g;
+         for (j=band_start;j<band_end;j++)
+            sum += f[j]*f[j];
+         bank[i+c*m->nbEBands] = celt_sqrt(sum);
+         g = celt_rcp(1e-27f+bank[i+c*m->nbEBands]);
+         for (j=band_start;j<band_end;j++)
+            x[j] = f[j]*g;
       }
-      for (i=M*eBands[end];i<N;i++)
-         *f++ = 0;
+   } while (++c<C);
+}
+
+#endif /* FIXED_POINT */
+
+/* De-normalise the energy to produce the synthesis from the unit-energy bands */
+void celtdenormalise_bands(const CELTMode *m, const celt_norm * restrict X, celt_sig * restrict freq, const celt_ener *bank, int end, int _C, int M)
+{
+   int i, c, N, LM, bound;
+   const unsigned char *binBand = m->binBand;
+   const int C = CHANNELS(_C);
+   N = M*m->shortMdctSize;
+   celt_assert2(C<=2, "celtdenormalise_bands() not implemented for >2 channels");
+   for (LM=0;(1<<LM)<M;LM++);
+   bound = M*m->eBands[end];
+   /* One pass over the whole spectrum, looking up each bin's band gain,
+      rather than a short loop per band */
+   c=0; do {
+      celt_sig * restrict f = freq+c*N;
+      const celt_norm * restrict x = X+c*N;
+      const celt_ener *g = bank+c*m->nbEBands;
+      for (i=0;i<bound;i++)
+         f[i] = SHL32(MULT16_32_Q15(x[i], SHR32(g[binBand[i>>LM]],1)),2);
+      for (;i<N;i++)
+         f[i] = 0;
    } while (++c<C);
 }
 
@@ -537,69 +605,60 @@ static const int ordery_table[] = {
       15,  0,  8,  7, 12,  3, 11,  4, 14,  1,  9,  6, 13,  2, 10,  5,
 };
 
-static void deinterleave_hadamard(celt_norm *X, int N0, int stride, int hadamard)
+/* Gathers the stride interleaved blocks of X (in ordery order for the
+   Hadamard case) into consecutive runs of N0 samples. tmp must hold
+   N0*stride samples. */
+static void deinterleave_hadamard(celt_norm *X, int N0, int stride, int hadamard, celt_norm *tmp)
 {
    int i,j;
-   VARDECL(celt_norm, tmp);
-   int N;
-   SAVE_STACK;
-   N = N0*stride;
-   ALLOC(tmp, N, celt_norm);
-   if (hadamard)
+   int N = N0*stride;
+   const int *ordery = ordery_table+stride-2;
+   for (i=0;i<stride;i++)
    {
-      const int *ordery = ordery_table+stride-2;
-      for (i=0;i<stride;i++)
-      {
-         for (j=0;j<N0;j++)
-            tmp[ordery[i]*N0+j] = X[j*stride+i];
-      }
-   } else {
-      for (i=0;i<stride;i++)
-         for (j=0;j<N0;j++)
-            tmp[i*N0+j] = X[j*stride+i];
+      celt_norm * restrict y = tmp + (hadamard ? ordery[i] : i)*N0;
+      const celt_norm * restrict x = X+i;
+      for (j=0;j<N0;j++)
+         y[j] = x[j*stride];
    }
    for (j=0;j<N;j++)
       X[j] = tmp[j];
-   RESTORE_STACK;
 }
 
-static void interleave_hadamard(celt_norm *X, int N0, int stride, int hadamard)
+/* Inverse of deinterleave_hadamard() */
+static void interleave_hadamard(celt_norm *X, int N0, int stride, int hadamard, celt_norm *tmp)
 {
    int i,j;
-   VARDECL(celt_norm, tmp);
-   int N;
-   SAVE_STACK;
-   N = N0*stride;
-   ALLOC(tmp, N, celt_norm);
-   if (hadamard)
+   int N = N0*stride;
+   const int *ordery = ordery_table+stride-2;
+   for (i=0;i<stride;i++)
    {
-      const int *ordery = ordery_table+stride-2;
-      for (i=0;i<stride;i++)
-         for (j=0;j<N0;j++)
-            tmp[j*stride+i] = X[ordery[i]*N0+j];
-   } else {
-      for (i=0;i<stride;i++)
-         for (j=0;j<N0;j++)
-            tmp[j*stride+i] = X[i*N0+j];
+      const celt_norm * restrict x = X + (hadamard ? ordery[i] : i)*N0;
+      celt_norm * restrict y = tmp+i;
+      for (j=0;j<N0;j++)
+         y[j*stride] = x[j];
    }
    for (j=0;j<N;j++)
       X[j] = tmp[j];
-   RESTORE_STACK;
 }
 
 void celthaar1(celt_norm *X, int N0, int stride)
 {
    int i, j;
    N0 >>= 1;
-   for (i=0;i<stride;i++)
-      for (j=0;j<N0;j++)
+   /* The stride-long runs are contiguous, so go through them in the inner loop */
+   for (j=0;j<N0;j++)
+   {
+      celt_norm * restrict x0 = X+stride*2*j;
+      celt_norm * restrict x1 = x0+stride;
+      for (i=0;i<stride;i++)
       {
          celt_norm tmp1, tmp2;
-         tmp1 = MULT16_16_Q15(QCONST16(.70710678f,15), X[stride*2*j+i]);
-         tmp2 = MULT16_16_Q15(QCONST16(.70710678f,15), X[stride*(2*j+1)+i]);
-         X[stride*2*j+i] = tmp1 + tmp2;
-         X[stride*(2*j+1)+i] = tmp1 - tmp2;
+         tmp1 = MULT16_16_Q15(QCONST16(.70710678f,15), x0[i]);
+         tmp2 = MULT16_16_Q15(QCONST16(.70710678f,15), x1[i]);
+         x0[i] = tmp1 + tmp2;
+         x1[i] = tmp1 - tmp2;
       }
+   }
 }
 
 static int compute_qn(int N, int b, int offset, int pulse_cap, int stereo)
@@ -627,356 +686,312 @@ static int compute_qn(int N, int b, int offset, int pulse_cap, int stereo)
    return qn;
 }
 
-/* This function is responsible for encoding and decoding a band for both
-   the mono and stereo case. Even in the mono case, it can split the band
-   in two and transmit the energy difference with the two half-bands. It
-   can be called recursively so bands can end up being split in 8 parts. */
-static unsigned quant_band(int encode, const CELTMode *m, int i, celt_norm *X, celt_norm *Y,
-      int N, int b, int spread, int B, int intensity, int tf_change, celt_norm *lowband, int resynth, ec_ctx *ec,
-      celt_int32 *remaining_bits, int LM, celt_norm *lowband_out, const celt_ener *bandE, int level,
-      celt_uint32 *seed, celt_word16 gain, celt_norm *lowband_scratch, int fill)
+/* Codes the split parameter theta between X and Y (mid and side for a stereo
+   split) and returns it, scaled to 0..16384. The bits it used are returned
+   in qalloc. For stereo bands with qn==1, inv tells whether Y was inverted. */
+static int quant_theta(int encode, const CELTMode *m, int i, celt_norm *X, celt_norm *Y,
+      int N, int b, int B0, int LM, int stereo, int intensity, const celt_ener *bandE,
+      ec_ctx *ec, celt_int32 remaining_bits, int *qalloc, int *inv)
 {
-   const unsigned char *cache;
-   int q;
-   int curr_bits;
-   int stereo, split;
-   int imid=0, iside=0;
-   int N0=N;
-   int N_B=N;
-   int N_B0;
-   int B0=B;
-   int time_divide=0;
-   int recombine=0;
-   int inv = 0;
-   celt_word16 mid=0, side=0;
-   int longBlocks;
-   unsigned cm=0;
+   int qn;
+   int itheta=0;
+   int pulse_cap;
+   int offset;
+   celt_int32 tell;
+
+   *inv = 0;
+   /* Decide on the resolution to give to the split parameter theta */
+   pulse_cap = m->logN[i]+(LM<<BITRES);
+   offset = (pulse_cap>>1) - (stereo&&N==2 ? QTHETA_OFFSET_TWOPHASE : QTHETA_OFFSET);
+   qn = compute_qn(N, b, offset, pulse_cap, stereo);
+   if (stereo && i>=intensity)
+      qn = 1;
+   if (encode)
+   {
+      /* theta is the atan() of the ratio between the (normalized)
+         side and mid. With just that parameter, we can re-scale both
+         mid and side because we know that 1) they have unit norm and
+         2) they are orthogonal. */
+      itheta = stereo_itheta(X, Y, stereo, N);
+   }
+   tell = ec_tell_frac(ec);
+   if (qn!=1)
+   {
+      if (encode)
+         itheta = (itheta*qn+8192)>>14;
 
-   longBlocks = B0==1;
+      /* Entropy coding of the angle. We use a uniform pdf for the
+         time split, a step for stereo, and a triangular one for the rest. */
+      if (stereo && N>2)
+      {
+         int p0 = 3;
+         int x = itheta;
+         int x0 = qn/2;
+         int ft = p0*(x0+1) + x0;
+         /* Use a probability of p0 up to itheta=8192 and then use 1 after */
+         if (encode)
+         {
+            ec_encode(ec,x<=x0?p0*x:(x-1-x0)+(x0+1)*p0,x<=x0?p0*(x+1):(x-x0)+(x0+1)*p0,ft);
+         } else {
+            int fs;
+            fs=ec_decode(ec,ft);
+            if (fs<(x0+1)*p0)
+               x=fs/p0;
+            else
+               x=x0+1+(fs-(x0+1)*p0);
+            ec_dec_update(ec,x<=x0?p0*x:(x-1-x0)+(x0+1)*p0,x<=x0?p0*(x+1):(x-x0)+(x0+1)*p0,ft);
+            itheta = x;
+         }
+      } else if (B0>1 || stereo) {
+         /* Uniform pdf */
+         if (encode)
+            ec_enc_uint(ec, itheta, qn+1);
+         else
+            itheta = ec_dec_uint(ec, qn+1);
+      } else {
+         int fs=1, ft;
+         ft = ((qn>>1)+1)*((qn>>1)+1);
+         if (encode)
+         {
+            int fl;
 
-   N_B /= B;
-   N_B0 = N_B;
+            fs = itheta <= (qn>>1) ? itheta + 1 : qn + 1 - itheta;
+            fl = itheta <= (qn>>1) ? itheta*(itheta + 1)>>1 :
+             ft - ((qn + 1 - itheta)*(qn + 2 - itheta)>>1);
 
-   split = stereo = Y != NULL;
+            ec_encode(ec, fl, fl+fs, ft);
+         } else {
+            /* Triangular pdf */
+            int fl=0;
+            int fm;
+            fm = ec_decode(ec, ft);
 
-   /* Special case for one sample */
-   if (N==1)
-   {
-      int c;
-      celt_norm *x = X;
-      c=0; do {
-         int sign=0;
-         if (*remaining_bits>=1<<BITRES)
-         {
-            if (encode)
+            if (fm < ((qn>>1)*((qn>>1) + 1)>>1))
             {
-               sign = x[0]<0;
-               ec_enc_bits(ec, sign, 1);
-            } else {
-               sign = ec_dec_bits(ec, 1);
+               itheta = (celtisqrt32(8*(celt_uint32)fm + 1) - 1)>>1;
+               fs = itheta + 1;
+               fl = itheta*(itheta + 1)>>1;
+            }
+            else
+            {
+               itheta = (2*(qn + 1)
+                - celtisqrt32(8*(celt_uint32)(ft - fm - 1) + 1))>>1;
+               fs = qn + 1 - itheta;
+               fl = ft - ((qn + 1 - itheta)*(qn + 2 - itheta)>>1);
             }
-            *remaining_bits -= 1<<BITRES;
-            b-=1<<BITRES;
-         }
-         if (resynth)
-            x[0] = sign ? -NORM_SCALING : NORM_SCALING;
-         x = Y;
-      } while (++c<1+stereo);
-      if (lowband_out)
-         lowband_out[0] = SHR16(X[0],4);
-      return 1;
-   }
-
-   if (!stereo && level == 0)
-   {
-      int k;
-      if (tf_change>0)
-         recombine = tf_change;
-      /* Band recombining to increase frequency resolution */
 
-      if (lowband && (recombine || ((N_B&1) == 0 && tf_change<0) || B0>1))
-      {
-         int j;
-         for (j=0;j<N;j++)
-            lowband_scratch[j] = lowband[j];
-         lowband = lowband_scratch;
+            ec_dec_update(ec, fl, fl+fs, ft);
+         }
       }
-
-      for (k=0;k<recombine;k++)
+      itheta = (celt_int32)itheta*16384/qn;
+      if (encode && stereo)
       {
-         static const unsigned char bit_interleave_table[16]={
-           0,1,1,1,2,3,3,3,2,3,3,3,2,3,3,3
-         };
-         if (encode)
-            celthaar1(X, N>>k, 1<<k);
-         if (lowband)
-            celthaar1(lowband, N>>k, 1<<k);
-         fill = bit_interleave_table[fill&0xF]|bit_interleave_table[fill>>4]<<2;
+         if (itheta==0)
+            intensity_stereo(m, X, Y, bandE, i, N);
+         else
+            stereo_split(X, Y, N);
       }
-      B>>=recombine;
-      N_B<<=recombine;
-
-      /* Increasing the time resolution */
-      while ((N_B&1) == 0 && tf_change<0)
+      /* TODO: Renormalising X and Y *may* help fixed-point a bit at very high rate.
+               Let's do that at higher complexity */
+   } else if (stereo) {
+      if (encode)
       {
-         if (encode)
-            celthaar1(X, N_B, B);
-         if (lowband)
-            celthaar1(lowband, N_B, B);
-         fill |= fill<<B;
-         B <<= 1;
-         N_B >>= 1;
-         time_divide++;
-         tf_change++;
+         *inv = itheta > 8192;
+         if (*inv)
+         {
+            int j;
+            for (j=0;j<N;j++)
+               Y[j] = -Y[j];
+         }
+         intensity_stereo(m, X, Y, bandE, i, N);
       }
-      B0=B;
-      N_B0 = N_B;
-
-      /* Reorganize the samples in time order instead of frequency order */
-      if (B0>1)
+      if (b>2<<BITRES && remaining_bits > 2<<BITRES)
       {
          if (encode)
-            deinterleave_hadamard(X, N_B>>recombine, B0<<recombine, longBlocks);
-         if (lowband)
-            deinterleave_hadamard(lowband, N_B>>recombine, B0<<recombine, longBlocks);
-      }
+            ec_enc_bit_logp(ec, *inv, 2);
+         else
+            *inv = ec_dec_bit_logp(ec, 2);
+      } else
+         *inv = 0;
+      itheta = 0;
    }
+   *qalloc = ec_tell_frac(ec) - tell;
+   return itheta;
+}
 
-   /* If we need 1.5 more bit than we can produce, split the band in two. */
-   cache = m->cache.bits + m->cache.index[(LM+1)*m->nbEBands+i];
-   if (!stereo && LM != -1 && b > cache[cache[0]]+12 && N>2)
+/* Computes the mid and side gains for theta and the mid vs side allocation
+   that minimizes the squared error in the band. Also clears the fill bits of
+   a half that gets no energy. */
+static int theta_gains(int itheta, int N, int B, int *fill, celt_word16 *mid, celt_word16 *side)
+{
+   int imid, iside;
+   int delta;
+   if (itheta == 0)
    {
-      if (LM>0 || (N&1)==0)
-      {
-         N >>= 1;
-         Y = X+N;
-         split = 1;
-         LM -= 1;
-         if (B==1)
-            fill = fill&1|fill<<1;
-         B = (B+1)>>1;
-      }
+      imid = 32767;
+      iside = 0;
+      *fill &= (1<<B)-1;
+      delta = -16384;
+   } else if (itheta == 16384)
+   {
+      imid = 0;
+      iside = 32767;
+      *fill &= (1<<B)-1<<B;
+      delta = 16384;
+   } else {
+      imid = bitexact_cos(itheta);
+      iside = bitexact_cos(16384-itheta);
+      delta = FRAC_MUL16(N-1<<7,bitexact_log2tan(iside,imid));
+   }
+#ifdef FIXED_POINT
+   *mid = imid;
+   *side = iside;
+#else
+   *mid = (1.f/32768)*imid;
+   *side = (1.f/32768)*iside;
+#endif
+   return delta;
+}
+
+/* Codes the pulses of a band (or part of a band) that isn't split any
+   further, or fills it when it gets none */
+static unsigned quant_pulses(int encode, const CELTMode *m, int i, celt_norm *X, int N, int b,
+      int spread, int B, celt_norm *lowband, int resynth, ec_ctx *ec, celt_int32 *remaining_bits,
+      int LM, celt_uint32 *seed, celt_word16 gain, int fill)
+{
+   int q;
+   int curr_bits;
+   unsigned cm=0;
+
+   q = bits2pulses(m, i, LM, b);
+   curr_bits = pulses2bits(m, i, LM, q);
+   *remaining_bits -= curr_bits;
+
+   /* Ensures we can never bust the budget */
+   while (*remaining_bits < 0 && q > 0)
+   {
+      *remaining_bits += curr_bits;
+      q--;
+      curr_bits = pulses2bits(m, i, LM, q);
+      *remaining_bits -= curr_bits;
    }
 
-   if (split)
+   if (q!=0)
    {
-      int qn;
-      int itheta=0;
-      int mbits, sbits, delta;
-      int qalloc;
-      int pulse_cap;
-      int offset;
-      int orig_fill;
-      celt_int32 tell;
+      int K = get_pulses(q);
 
-      /* Decide on the resolution to give to the split parameter theta */
-      pulse_cap = m->logN[i]+(LM<<BITRES);
-      offset = (pulse_cap>>1) - (stereo&&N==2 ? QTHETA_OFFSET_TWOPHASE : QTHETA_OFFSET);
-      qn = compute_qn(N, b, offset, pulse_cap, stereo);
-      if (stereo && i>=intensity)
-         qn = 1;
+      /* Finally do the actual quantization */
       if (encode)
+         cm = alg_quant(X, N, K, spread, B, resynth, ec, gain);
+      else
+         cm = alg_unquant(X, N, K, spread, B, ec, gain);
+   } else {
+      /* If there's no pulse, fill the band anyway */
+      int j;
+      if (resynth)
       {
-         /* theta is the atan() of the ratio between the (normalized)
-            side and mid. With just that parameter, we can re-scale both
-            mid and side because we know that 1) they have unit norm and
-            2) they are orthogonal. */
-         itheta = stereo_itheta(X, Y, stereo, N);
-      }
-      tell = ec_tell_frac(ec);
-      if (qn!=1)
-      {
-         if (encode)
-            itheta = (itheta*qn+8192)>>14;
-
-         /* Entropy coding of the angle. We use a uniform pdf for the
-            time split, a step for stereo, and a triangular one for the rest. */
-         if (stereo && N>2)
+         unsigned cm_mask;
+         /*B can be as large as 16, so this shift might overflow an int on a
+            16-bit platform; use a long to get defined behavior.*/
+         cm_mask = (unsigned)(1UL<<B)-1;
+         fill &= cm_mask;
+         if (!fill)
          {
-            int p0 = 3;
-            int x = itheta;
-            int x0 = qn/2;
-            int ft = p0*(x0+1) + x0;
-            /* Use a probability of p0 up to itheta=8192 and then use 1 after */
-            if (encode)
-            {
-               ec_encode(ec,x<=x0?p0*x:(x-1-x0)+(x0+1)*p0,x<=x0?p0*(x+1):(x-x0)+(x0+1)*p0,ft);
-            } else {
-               int fs;
-               fs=ec_decode(ec,ft);
-               if (fs<(x0+1)*p0)
-                  x=fs/p0;
-               else
-                  x=x0+1+(fs-(x0+1)*p0);
-               ec_dec_update(ec,x<=x0?p0*x:(x-1-x0)+(x0+1)*p0,x<=x0?p0*(x+1):(x-x0)+(x0+1)*p0,ft);
-               itheta = x;
-            }
-         } else if (B0>1 || stereo) {
-            /* Uniform pdf */
-            if (encode)
-               ec_enc_uint(ec, itheta, qn+1);
-            else
-               itheta = ec_dec_uint(ec, qn+1);
+            for (j=0;j<N;j++)
+               X[j] = 0;
          } else {
-            int fs=1, ft;
-            ft = ((qn>>1)+1)*((qn>>1)+1);
-            if (encode)
+            if (lowband == NULL)
             {
-               int fl;
-
-               fs = itheta <= (qn>>1) ? itheta + 1 : qn + 1 - itheta;
-               fl = itheta <= (qn>>1) ? itheta*(itheta + 1)>>1 :
-                ft - ((qn + 1 - itheta)*(qn + 2 - itheta)>>1);
-
-               ec_encode(ec, fl, fl+fs, ft);
-            } else {
-               /* Triangular pdf */
-               int fl=0;
-               int fm;
-               fm = ec_decode(ec, ft);
-
-               if (fm < ((qn>>1)*((qn>>1) + 1)>>1))
+               /* Noise */
+               for (j=0;j<N;j++)
                {
-                  itheta = (celtisqrt32(8*(celt_uint32)fm + 1) - 1)>>1;
-                  fs = itheta + 1;
-                  fl = itheta*(itheta + 1)>>1;
+                  *seed = lcg_rand(*seed);
+                  X[j] = (celt_int32)(*seed)>>20;
                }
-               else
+               cm = cm_mask;
+            } else {
+               /* Folded spectrum */
+               for (j=0;j<N;j++)
                {
-                  itheta = (2*(qn + 1)
-                   - celtisqrt32(8*(celt_uint32)(ft - fm - 1) + 1))>>1;
-                  fs = qn + 1 - itheta;
-                  fl = ft - ((qn + 1 - itheta)*(qn + 2 - itheta)>>1);
+                  celt_word16 tmp;
+                  *seed = lcg_rand(*seed);
+                  /* About 48 dB below the "normal" folding level */
+                  tmp = QCONST16(1.0f/256, 10);
+                  tmp = (*seed)&0x8000 ? tmp : -tmp;
+                  X[j] = lowband[j]+tmp;
                }
-
-               ec_dec_update(ec, fl, fl+fs, ft);
+               cm = fill;
             }
+            renormalise_vector(X, N, gain);
          }
-         itheta = (celt_int32)itheta*16384/qn;
-         if (encode && stereo)
-         {
-            if (itheta==0)
-               intensity_stereo(m, X, Y, bandE, i, N);
-            else
-               stereo_split(X, Y, N);
-         }
-         /* TODO: Renormalising X and Y *may* help fixed-point a bit at very high rate.
-                  Let's do that at higher complexity */
-      } else if (stereo) {
-         if (encode)
-         {
-            inv = itheta > 8192;
-            if (inv)
-            {
-               int j;
-               for (j=0;j<N;j++)
-                  Y[j] = -Y[j];
-            }
-            intensity_stereo(m, X, Y, bandE, i, N);
-         }
-         if (b>2<<BITRES && *remaining_bits > 2<<BITRES)
-         {
-            if (encode)
-               ec_enc_bit_logp(ec, inv, 2);
-            else
-               inv = ec_dec_bit_logp(ec, 2);
-         } else
-            inv = 0;
-         itheta = 0;
       }
-      qalloc = ec_tell_frac(ec) - tell;
-      b -= qalloc;
+   }
+   return cm;
+}
 
-      orig_fill = fill;
-      if (itheta == 0)
-      {
-         imid = 32767;
-         iside = 0;
-         fill &= (1<<B)-1;
-         delta = -16384;
-      } else if (itheta == 16384)
+/* Each split takes one off LM, which starts at most at 3 and stops at -1 */
+#define MAX_SPLIT_DEPTH 4
+
+/* What's left to do for a split once its first half has been coded */
+typedef struct {
+   celt_norm *X;             /* Second half */
+   int N, B, LM;             /* Shared by both halves */
+   celt_norm *lowband;       /* Folding source of the second half */
+   celt_word16 gain;
+   int fill;
+   int b;                    /* Bits of the second half before rebalancing */
+   int first_bits;           /* Bits given to the first half */
+   celt_int32 remaining_bits;/* Budget before coding the first half */
+   int rebalance;            /* Whether the second half gets what the first didn't use */
+   int first_shift;          /* Shifts of each half's collapse mask */
+   int second_shift;
+   unsigned cm;              /* Collapse mask of the first half */
+   int second;               /* Set once we're coding the second half */
+} SplitState;
+
+/* Codes a mono band, splitting it in two halves as long as it needs 1.5 more
+   bit than we can produce, with the energy ratio of the halves coded as theta.
+   The halves are coded depth-first in the same order as a recursion would,
+   but with an explicit stack so that each level only costs a SplitState. */
+static unsigned quant_partition(int encode, const CELTMode *m, int i, celt_norm *X,
+      int N, int b, int spread, int B, celt_norm *lowband, int resynth, ec_ctx *ec,
+      celt_int32 *remaining_bits, int LM, celt_uint32 *seed, celt_word16 gain, int fill)
+{
+   SplitState stack[MAX_SPLIT_DEPTH];
+   int depth=0;
+   unsigned cm;
+   const unsigned char *cache;
+
+   celt_assert(LM < MAX_SPLIT_DEPTH);
+   for (;;)
+   {
+      /* Go down the first halves, as far as they need to be split */
+      cache = m->cache.bits + m->cache.index[(LM+1)*m->nbEBands+i];
+      while (LM != -1 && b > cache[cache[0]]+12 && N>2 && (LM>0 || (N&1)==0))
       {
-         imid = 0;
-         iside = 32767;
-         fill &= (1<<B)-1<<B;
-         delta = 16384;
-      } else {
-         imid = bitexact_cos(itheta);
-         iside = bitexact_cos(16384-itheta);
-         /* This is the mid vs side allocation that minimizes squared error
-            in that band. */
-         delta = FRAC_MUL16(N-1<<7,bitexact_log2tan(iside,imid));
-      }
+         SplitState *s = &stack[depth++];
+         celt_norm *Y;
+         int B0=B;
+         int itheta, inv;
+         int qalloc;
+         int delta;
+         int mbits, sbits;
+         celt_word16 mid, side;
 
-#ifdef FIXED_POINT
-      mid = imid;
-      side = iside;
-#else
-      mid = (1.f/32768)*imid;
-      side = (1.f/32768)*iside;
-#endif
+         N >>= 1;
+         Y = X+N;
+         LM -= 1;
+         if (B==1)
+            fill = fill&1|fill<<1;
+         B = (B+1)>>1;
 
-      /* This is a special case for N=2 that only works for stereo and takes
-         advantage of the fact that mid and side are orthogonal to encode
-         the side with just one bit. */
-      if (N==2 && stereo)
-      {
-         int c;
-         int sign=0;
-         celt_norm *x2, *y2;
-         mbits = b;
-         sbits = 0;
-         /* Only need one bit for the side */
-         if (itheta != 0 && itheta != 16384)
-            sbits = 1<<BITRES;
-         mbits -= sbits;
-         c = itheta > 8192;
-         *remaining_bits -= qalloc+sbits;
-
-         x2 = c ? Y : X;
-         y2 = c ? X : Y;
-         if (sbits)
-         {
-            if (encode)
-            {
-               /* Here we only need to encode a sign for the side */
-               sign = x2[0]*y2[1] - x2[1]*y2[0] < 0;
-               ec_enc_bits(ec, sign, 1);
-            } else {
-               sign = ec_dec_bits(ec, 1);
-            }
-         }
-         sign = 1-2*sign;
-         /* We use orig_fill here because we want to fold the side, but if
-             itheta==16384, we'll have cleared the low bits of fill. */
-         cm = quant_band(encode, m, i, x2, NULL, N, mbits, spread, B, intensity, tf_change, lowband, resynth, ec, remaining_bits, LM, lowband_out, NULL, level, seed, gain, lowband_scratch, orig_fill);
-         /* We don't split N=2 bands, so cm is either 1 or 0 (for a fold-collapse),
-             and there's no need to worry about mixing with the other channel. */
-         y2[0] = -sign*x2[1];
-         y2[1] = sign*x2[0];
-         if (resynth)
-         {
-            celt_norm tmp;
-            X[0] = MULT16_16_Q15(mid, X[0]);
-            X[1] = MULT16_16_Q15(mid, X[1]);
-            Y[0] = MULT16_16_Q15(side, Y[0]);
-            Y[1] = MULT16_16_Q15(side, Y[1]);
-            tmp = X[0];
-            X[0] = SUB16(tmp,Y[0]);
-            Y[0] = ADD16(tmp,Y[0]);
-            tmp = X[1];
-            X[1] = SUB16(tmp,Y[1]);
-            Y[1] = ADD16(tmp,Y[1]);
-         }
-      } else {
-         /* "Normal" split code */
-         celt_norm *next_lowband2=NULL;
-         celt_norm *next_lowband_out1=NULL;
-         int next_level=0;
-         celt_int32 rebalance;
+         itheta = quant_theta(encode, m, i, X, Y, N, b, B0, LM, 0, 0, NULL,
+               ec, *remaining_bits, &qalloc, &inv);
+         b -= qalloc;
+         delta = theta_gains(itheta, N, B, &fill, &mid, &side);
 
          /* Give more bits to low-energy MDCTs than they would otherwise deserve */
-         if (B0>1 && !stereo && (itheta&0x3fff))
+         if (B0>1 && (itheta&0x3fff))
          {
             if (itheta > 8192)
                /* Rough approximation for pre-echo masking */
@@ -989,170 +1004,360 @@ static unsigned quant_band(int encode, const CELTMode *m, int i, celt_norm *X, c
          sbits = b-mbits;
          *remaining_bits -= qalloc;
 
-         if (lowband && !stereo)
-            next_lowband2 = lowband+N; /* >32-bit split case */
-
-         /* Only stereo needs to pass on lowband_out. Otherwise, it's
-            handled at the end */
-         if (stereo)
-            next_lowband_out1 = lowband_out;
-         else
-            next_level = level+1;
-
-         rebalance = *remaining_bits;
+         s->N = N;
+         s->B = B;
+         s->LM = LM;
+         s->remaining_bits = *remaining_bits;
+         s->second = 0;
          if (mbits >= sbits)
          {
-            /* In stereo mode, we do not apply a scaling to the mid because we need the normalized
-               mid for folding later */
-            cm = quant_band(encode, m, i, X, NULL, N, mbits, spread, B, intensity, tf_change,
-                  lowband, resynth, ec, remaining_bits, LM, next_lowband_out1,
-                  NULL, next_level, seed, stereo ? Q15ONE : MULT16_16_P15(gain,mid), lowband_scratch, fill);
-            rebalance = mbits - (rebalance-*remaining_bits);
-            if (rebalance > 3<<BITRES && itheta!=0)
-               sbits += rebalance - (3<<BITRES);
-
-            /* For a stereo split, the high bits of fill are always zero, so no
-               folding will be done to the side. */
-            cm |= quant_band(encode, m, i, Y, NULL, N, sbits, spread, B, intensity, tf_change,
-                  next_lowband2, resynth, ec, remaining_bits, LM, NULL,
-                  NULL, next_level, seed, MULT16_16_P15(gain,side), NULL, fill>>B)<<(B0>>1&stereo-1);
+            s->X = Y;
+            s->lowband = lowband ? lowband+N : NULL; /* >32-bit split case */
+            s->gain = MULT16_16_P15(gain,side);
+            s->fill = fill>>B;
+            s->b = sbits;
+            s->first_bits = mbits;
+            s->rebalance = itheta!=0;
+            s->first_shift = 0;
+            s->second_shift = B0>>1;
+            b = mbits;
+            gain = MULT16_16_P15(gain,mid);
          } else {
-            /* For a stereo split, the high bits of fill are always zero, so no
-               folding will be done to the side. */
-            cm = quant_band(encode, m, i, Y, NULL, N, sbits, spread, B, intensity, tf_change,
-                  next_lowband2, resynth, ec, remaining_bits, LM, NULL,
-                  NULL, next_level, seed, MULT16_16_P15(gain,side), NULL, fill>>B)<<(B0>>1&stereo-1);
-            rebalance = sbits - (rebalance-*remaining_bits);
-            if (rebalance > 3<<BITRES && itheta!=16384)
-               mbits += rebalance - (3<<BITRES);
-            /* In stereo mode, we do not apply a scaling to the mid because we need the normalized
-               mid for folding later */
-            cm |= quant_band(encode, m, i, X, NULL, N, mbits, spread, B, intensity, tf_change,
-                  lowband, resynth, ec, remaining_bits, LM, next_lowband_out1,
-                  NULL, next_level, seed, stereo ? Q15ONE : MULT16_16_P15(gain,mid), lowband_scratch, fill);
+            s->X = X;
+            s->lowband = lowband;
+            s->gain = MULT16_16_P15(gain,mid);
+            s->fill = fill;
+            s->b = mbits;
+            s->first_bits = sbits;
+            s->rebalance = itheta!=16384;
+            s->first_shift = B0>>1;
+            s->second_shift = 0;
+            X = Y;
+            if (lowband)
+               lowband += N;
+            b = sbits;
+            gain = MULT16_16_P15(gain,side);
+            fill >>= B;
          }
+         cache = m->cache.bits + m->cache.index[(LM+1)*m->nbEBands+i];
       }
 
-   } else {
-      /* This is the basic no-split case */
-      q = bits2pulses(m, i, LM, b);
-      curr_bits = pulses2bits(m, i, LM, q);
-      *remaining_bits -= curr_bits;
+      cm = quant_pulses(encode, m, i, X, N, b, spread, B, lowband, resynth, ec,
+            remaining_bits, LM, seed, gain, fill);
 
-      /* Ensures we can never bust the budget */
-      while (*remaining_bits < 0 && q > 0)
+      /* Go back up until we find a second half that remains to be coded */
+      while (depth>0)
       {
-         *remaining_bits += curr_bits;
-         q--;
-         curr_bits = pulses2bits(m, i, LM, q);
-         *remaining_bits -= curr_bits;
+         SplitState *s = &stack[depth-1];
+         if (!s->second)
+         {
+            celt_int32 rebalance;
+            s->cm = cm<<s->first_shift;
+            s->second = 1;
+            rebalance = s->first_bits - (s->remaining_bits-*remaining_bits);
+            b = s->b;
+            if (rebalance > 3<<BITRES && s->rebalance)
+               b += rebalance - (3<<BITRES);
+            X = s->X;
+            N = s->N;
+            B = s->B;
+            LM = s->LM;
+            lowband = s->lowband;
+            gain = s->gain;
+            fill = s->fill;
+            break;
+         }
+         cm = s->cm | cm<<s->second_shift;
+         depth--;
       }
+      if (depth==0)
+         return cm;
+   }
+}
 
-      if (q!=0)
+/* Special case for one sample, where only the signs are coded */
+static unsigned quant_band_n1(int encode, celt_norm *X, celt_norm *Y, int resynth,
+      ec_ctx *ec, celt_int32 *remaining_bits, celt_norm *lowband_out)
+{
+   int c;
+   int stereo = Y != NULL;
+   celt_norm *x = X;
+   c=0; do {
+      int sign=0;
+      if (*remaining_bits>=1<<BITRES)
       {
-         int K = get_pulses(q);
-
-         /* Finally do the actual quantization */
          if (encode)
-            cm = alg_quant(X, N, K, spread, B, resynth, ec, gain);
-         else
-            cm = alg_unquant(X, N, K, spread, B, ec, gain);
-      } else {
-         /* If there's no pulse, fill the band anyway */
-         int j;
-         if (resynth)
          {
-            unsigned cm_mask;
-            /*B can be as large as 16, so this shift might overflow an int on a
-               16-bit platform; use a long to get defined behavior.*/
-            cm_mask = (unsigned)(1UL<<B)-1;
-            fill &= cm_mask;
-            if (!fill)
-            {
-               for (j=0;j<N;j++)
-                  X[j] = 0;
-            } else {
-               if (lowband == NULL)
-               {
-                  /* Noise */
-                  for (j=0;j<N;j++)
-                  {
-                     *seed = lcg_rand(*seed);
-                     X[j] = (celt_int32)(*seed)>>20;
-                  }
-                  cm = cm_mask;
-               } else {
-                  /* Folded spectrum */
-                  for (j=0;j<N;j++)
-                  {
-                     celt_word16 tmp;
-                     *seed = lcg_rand(*seed);
-                     /* About 48 dB below the "normal" folding level */
-                     tmp = QCONST16(1.0f/256, 10);
-                     tmp = (*seed)&0x8000 ? tmp : -tmp;
-                     X[j] = lowband[j]+tmp;
-                  }
-                  cm = fill;
-               }
-               renormalise_vector(X, N, gain);
-            }
+            sign = x[0]<0;
+            ec_enc_bits(ec, sign, 1);
+         } else {
+            sign = ec_dec_bits(ec, 1);
          }
+         *remaining_bits -= 1<<BITRES;
       }
+      if (resynth)
+         x[0] = sign ? -NORM_SCALING : NORM_SCALING;
+      x = Y;
+   } while (++c<1+stereo);
+   if (lowband_out)
+      lowband_out[0] = SHR16(X[0],4);
+   return 1;
+}
+
+/* This function is responsible for encoding and decoding a mono band (or one
+   of the channels of a stereo split). It changes the time-frequency
+   resolution as requested by tf_change and reorders the samples so that
+   quant_partition() can split the band in up to 16 parts. lowband_scratch
+   must have room for 2*N samples. */
+static unsigned quant_band(int encode, const CELTMode *m, int i, celt_norm *X,
+      int N, int b, int spread, int B, int tf_change, celt_norm *lowband, int resynth, ec_ctx *ec,
+      celt_int32 *remaining_bits, int LM, celt_norm *lowband_out,
+      celt_uint32 *seed, celt_word16 gain, celt_norm *lowband_scratch, int fill)
+{
+   int N0=N;
+   int N_B=N;
+   int N_B0;
+   int B0=B;
+   int time_divide=0;
+   int recombine=0;
+   int longBlocks;
+   unsigned cm=0;
+   int k;
+
+   longBlocks = B0==1;
+
+   N_B /= B;
+
+   if (N==1)
+      return quant_band_n1(encode, X, NULL, resynth, ec, remaining_bits, lowband_out);
+
+   if (tf_change>0)
+      recombine = tf_change;
+   /* Band recombining to increase frequency resolution */
+
+   if (lowband && (recombine || ((N_B&1) == 0 && tf_change<0) || B0>1))
+   {
+      int j;
+      for (j=0;j<N;j++)
+         lowband_scratch[j] = lowband[j];
+      lowband = lowband_scratch;
    }
 
+   for (k=0;k<recombine;k++)
+   {
+      static const unsigned char bit_interleave_table[16]={
+        0,1,1,1,2,3,3,3,2,3,3,3,2,3,3,3
+      };
+      if (encode)
+         celthaar1(X, N>>k, 1<<k);
+      if (lowband)
+         celthaar1(lowband, N>>k, 1<<k);
+      fill = bit_interleave_table[fill&0xF]|bit_interleave_table[fill>>4]<<2;
+   }
+   B>>=recombine;
+   N_B<<=recombine;
+
+   /* Increasing the time resolution */
+   while ((N_B&1) == 0 && tf_change<0)
+   {
+      if (encode)
+         celthaar1(X, N_B, B);
+      if (lowband)
+         celthaar1(lowband, N_B, B);
+      fill |= fill<<B;
+      B <<= 1;
+      N_B >>= 1;
+      time_divide++;
+      tf_change++;
+   }
+   B0=B;
+   N_B0 = N_B;
+
+   /* Reorganize the samples in time order instead of frequency order */
+   if (B0>1)
+   {
+      if (encode)
+         deinterleave_hadamard(X, N_B>>recombine, B0<<recombine, longBlocks, lowband_scratch+N0);
+      if (lowband)
+         deinterleave_hadamard(lowband, N_B>>recombine, B0<<recombine, longBlocks, lowband_scratch+N0);
+   }
+
+   cm = quant_partition(encode, m, i, X, N, b, spread, B, lowband, resynth, ec,
+         remaining_bits, LM, seed, gain, fill);
+
    /* This code is used by the decoder and by the resynthesis-enabled encoder */
    if (resynth)
    {
-      if (stereo)
+      /* Undo the sample reorganization going from time order to frequency order */
+      if (B0>1)
+         interleave_hadamard(X, N_B>>recombine, B0<<recombine, longBlocks, lowband_scratch+N0);
+
+      /* Undo time-freq changes that we did earlier */
+      N_B = N_B0;
+      B = B0;
+      for (k=0;k<time_divide;k++)
       {
-         if (N!=2)
-            stereo_merge(X, Y, mid, N);
-         if (inv)
-         {
-            int j;
-            for (j=0;j<N;j++)
-               Y[j] = -Y[j];
-         }
-      } else if (level == 0)
+         B >>= 1;
+         N_B <<= 1;
+         cm |= cm>>B;
+         celthaar1(X, N_B, B);
+      }
+
+      for (k=0;k<recombine;k++)
       {
-         int k;
+         static const unsigned char bit_deinterleave_table[16]={
+           0x00,0x03,0x0C,0x0F,0x30,0x33,0x3C,0x3F,
+           0xC0,0xC3,0xCC,0xCF,0xF0,0xF3,0xFC,0xFF
+         };
+         cm = bit_deinterleave_table[cm];
+         celthaar1(X, N0>>k, 1<<k);
+      }
+      B<<=recombine;
 
-         /* Undo the sample reorganization going from time order to frequency order */
-         if (B0>1)
-            interleave_hadamard(X, N_B>>recombine, B0<<recombine, longBlocks);
+      /* Scale output for later folding */
+      if (lowband_out)
+      {
+         int j;
+         celt_word16 n;
+         n = celt_sqrt(SHL32(EXTEND32(N0),22));
+         for (j=0;j<N0;j++)
+            lowband_out[j] = MULT16_16_Q15(n,X[j]);
+      }
+      cm &= (1<<B)-1;
+   }
+   return cm;
+}
 
-         /* Undo time-freq changes that we did earlier */
-         N_B = N_B0;
-         B = B0;
-         for (k=0;k<time_divide;k++)
-         {
-            B >>= 1;
-            N_B <<= 1;
-            cm |= cm>>B;
-            celthaar1(X, N_B, B);
-         }
+/* Codes a stereo band as a mid and a side, with theta giving the ratio
+   between them. The mid and the side are then coded as mono bands. */
+static unsigned quant_band_stereo(int encode, const CELTMode *m, int i, celt_norm *X, celt_norm *Y,
+      int N, int b, int spread, int B, int intensity, int tf_change, celt_norm *lowband, int resynth, ec_ctx *ec,
+      celt_int32 *remaining_bits, int LM, celt_norm *lowband_out, const celt_ener *bandE,
+      celt_uint32 *seed, celt_word16 gain, celt_norm *lowband_scratch, int fill)
+{
+   int itheta;
+   int inv;
+   int qalloc;
+   int delta;
+   int mbits, sbits;
+   int orig_fill;
+   celt_word16 mid, side;
+   unsigned cm=0;
 
-         for (k=0;k<recombine;k++)
-         {
-            static const unsigned char bit_deinterleave_table[16]={
-              0x00,0x03,0x0C,0x0F,0x30,0x33,0x3C,0x3F,
-              0xC0,0xC3,0xCC,0xCF,0xF0,0xF3,0xFC,0xFF
-            };
-            cm = bit_deinterleave_table[cm];
-            celthaar1(X, N0>>k, 1<<k);
-         }
-         B<<=recombine;
+   if (N==1)
+      return quant_band_n1(encode, X, Y, resynth, ec, remaining_bits, lowband_out);
+
+   itheta = quant_theta(encode, m, i, X, Y, N, b, B, LM, 1, intensity, bandE,
+         ec, *remaining_bits, &qalloc, &inv);
+   b -= qalloc;
 
-         /* Scale output for later folding */
-         if (lowband_out)
+   orig_fill = fill;
+   delta = theta_gains(itheta, N, B, &fill, &mid, &side);
+
+   /* This is a special case for N=2 that only works for stereo and takes
+      advantage of the fact that mid and side are orthogonal to encode
+      the side with just one bit. */
+   if (N==2)
+   {
+      int c;
+      int sign=0;
+      celt_norm *x2, *y2;
+      mbits = b;
+      sbits = 0;
+      /* Only need one bit for the side */
+      if (itheta != 0 && itheta != 16384)
+         sbits = 1<<BITRES;
+      mbits -= sbits;
+      c = itheta > 8192;
+      *remaining_bits -= qalloc+sbits;
+
+      x2 = c ? Y : X;
+      y2 = c ? X : Y;
+      if (sbits)
+      {
+         if (encode)
          {
-            int j;
-            celt_word16 n;
-            n = celt_sqrt(SHL32(EXTEND32(N0),22));
-            for (j=0;j<N0;j++)
-               lowband_out[j] = MULT16_16_Q15(n,X[j]);
+            /* Here we only need to encode a sign for the side */
+            sign = x2[0]*y2[1] - x2[1]*y2[0] < 0;
+            ec_enc_bits(ec, sign, 1);
+         } else {
+            sign = ec_dec_bits(ec, 1);
          }
-         cm &= (1<<B)-1;
+      }
+      sign = 1-2*sign;
+      /* We use orig_fill here because we want to fold the side, but if
+          itheta==16384, we'll have cleared the low bits of fill. */
+      cm = quant_band(encode, m, i, x2, N, mbits, spread, B, tf_change, lowband, resynth, ec, remaining_bits, LM, lowband_out, seed, gain, lowband_scratch, orig_fill);
+      /* We don't split N=2 bands, so cm is either 1 or 0 (for a fold-collapse),
+          and there's no need to worry about mixing with the other channel. */
+      y2[0] = -sign*x2[1];
+      y2[1] = sign*x2[0];
+      if (resynth)
+      {
+         celt_norm tmp;
+         X[0] = MULT16_16_Q15(mid, X[0]);
+         X[1] = MULT16_16_Q15(mid, X[1]);
+         Y[0] = MULT16_16_Q15(side, Y[0]);
+         Y[1] = MULT16_16_Q15(side, Y[1]);
+         tmp = X[0];
+         X[0] = SUB16(tmp,Y[0]);
+         Y[0] = ADD16(tmp,Y[0]);
+         tmp = X[1];
+         X[1] = SUB16(tmp,Y[1]);
+         Y[1] = ADD16(tmp,Y[1]);
+      }
+   } else {
+      /* "Normal" split code */
+      celt_int32 rebalance;
+
+      mbits = IMAX(0, IMIN(b, (b-delta)/2));
+      sbits = b-mbits;
+      *remaining_bits -= qalloc;
+
+      rebalance = *remaining_bits;
+      if (mbits >= sbits)
+      {
+         /* In stereo mode, we do not apply a scaling to the mid because we need the normalized
+            mid for folding later */
+         cm = quant_band(encode, m, i, X, N, mbits, spread, B, tf_change,
+               lowband, resynth, ec, remaining_bits, LM, lowband_out,
+               seed, Q15ONE, lowband_scratch, fill);
+         rebalance = mbits - (rebalance-*remaining_bits);
+         if (rebalance > 3<<BITRES && itheta!=0)
+            sbits += rebalance - (3<<BITRES);
+
+         /* For a stereo split, the high bits of fill are always zero, so no
+            folding will be done to the side. */
+         cm |= quant_band(encode, m, i, Y, N, sbits, spread, B, tf_change,
+               NULL, resynth, ec, remaining_bits, LM, NULL,
+               seed, MULT16_16_P15(gain,side), lowband_scratch, fill>>B);
+      } else {
+         /* For a stereo split, the high bits of fill are always zero, so no
+            folding will be done to the side. */
+         cm = quant_band(encode, m, i, Y, N, sbits, spread, B, tf_change,
+               NULL, resynth, ec, remaining_bits, LM, NULL,
+               seed, MULT16_16_P15(gain,side), lowband_scratch, fill>>B);
+         rebalance = sbits - (rebalance-*remaining_bits);
+         if (rebalance > 3<<BITRES && itheta!=16384)
+            mbits += rebalance - (3<<BITRES);
+         /* In stereo mode, we do not apply a scaling to the mid because we need the normalized
+            mid for folding later */
+         cm |= quant_band(encode, m, i, X, N, mbits, spread, B, tf_change,
+               lowband, resynth, ec, remaining_bits, LM, lowband_out,
+               seed, Q15ONE, lowband_scratch, fill);
+      }
+   }
+
+   /* This code is used by the decoder and by the resynthesis-enabled encoder */
+   if (resynth)
+   {
+      if (N!=2)
+         stereo_merge(X, Y, mid, N);
+      if (inv)
+      {
+         int j;
+         for (j=0;j<N;j++)
+            Y[j] = -Y[j];
       }
    }
    return cm;
@@ -1179,7 +1384,8 @@ void celtquant_all_bands(int encode, const CELTMode *m, int start, int end,
    M = 1<<LM;
    B = shortBlocks ? M : 1;
    ALLOC(_norm, C*M*eBands[m->nbEBands], celt_norm);
-   ALLOC(lowband_scratch, M*(eBands[m->nbEBands]-eBands[m->nbEBands-1]), celt_norm);
+   /* Room for a copy of the folding source and for reordering the band */
+   ALLOC(lowband_scratch, 2*M*(eBands[m->nbEBands]-eBands[m->nbEBands-1]), celt_norm);
    norm = _norm;
    norm2 = norm + M*eBands[m->nbEBands];
 
@@ -1262,16 +1468,21 @@ void celtquant_all_bands(int encode, const CELTMode *m, int start, int end,
       }
       if (dual_stereo)
       {
-         x_cm = quant_band(encode, m, i, X, NULL, N, b/2, spread, B, intensity, tf_change,
+         x_cm = quant_band(encode, m, i, X, N, b/2, spread, B, tf_change,
                effective_lowband != -1 ? norm+effective_lowband : NULL, resynth, ec, &remaining_bits, LM,
-               norm+M*eBands[i], bandE, 0, seed, Q15ONE, lowband_scratch, x_cm);
-         y_cm = quant_band(encode, m, i, Y, NULL, N, b/2, spread, B, intensity, tf_change,
+               norm+M*eBands[i], seed, Q15ONE, lowband_scratch, x_cm);
+         y_cm = quant_band(encode, m, i, Y, N, b/2, spread, B, tf_change,
                effective_lowband != -1 ? norm2+effective_lowband : NULL, resynth, ec, &remaining_bits, LM,
-               norm2+M*eBands[i], bandE, 0, seed, Q15ONE, lowband_scratch, y_cm);
+               norm2+M*eBands[i], seed, Q15ONE, lowband_scratch, y_cm);
       } else {
-         x_cm = quant_band(encode, m, i, X, Y, N, b, spread, B, intensity, tf_change,
-               effective_lowband != -1 ? norm+effective_lowband : NULL, resynth, ec, &remaining_bits, LM,
-               norm+M*eBands[i], bandE, 0, seed, Q15ONE, lowband_scratch, x_cm|y_cm);
+         if (Y!=NULL)
+            x_cm = quant_band_stereo(encode, m, i, X, Y, N, b, spread, B, intensity, tf_change,
+                  effective_lowband != -1 ? norm+effective_lowband : NULL, resynth, ec, &remaining_bits, LM,
+                  norm+M*eBands[i], bandE, seed, Q15ONE, lowband_scratch, x_cm|y_cm);
+         else
+            x_cm = quant_band(encode, m, i, X, N, b, spread, B, tf_change,
+                  effective_lowband != -1 ? norm+effective_lowband : NULL, resynth, ec, &remaining_bits, LM,
+                  norm+M*eBands[i], seed, Q15ONE, lowband_scratch, x_cm|y_cm);
          y_cm = x_cm;
       }
       collapse_masks[i*C+0] = (unsigned char)x_cm;
@@ -53,6 +53,15 @@ void celtcompute_band_energies(const CELTMode *m, const celt_sig *X, celt_ener *
  */
 void celtnormalise_bands(const CELTMode *m, const celt_sig * restrict freq, celt_norm * restrict X, const celt_ener *bands, int end, int _C, int M);
 
+/** Computes the band energies and normalises the bands in a single pass
+    (celtcompute_band_energies() followed by celtnormalise_bands())
+ * @param m Mode data
+ * @param freq Spectrum
+ * @param X Normalised spectrum (returned)
+ * @param bands Square root of the energy for each band (returned)
+ */
+void celtcompute_and_normalise_bands(const CELTMode *m, const celt_sig * restrict freq, celt_norm * restrict X, celt_ener *bands, int end, int _C, int M);
+
 /** Denormalise each band of X to restore full amplitude
  * @param m Mode data 
  * @param X Spectrum (returned de-normalised)
@@ -95,9 +95,54 @@ static inline int fromOpus(unsigned char c)
       return fromOpusTable[(c>>3)-16] | (c&0x7);
 }
 
+/* Frame lengths in multi-frame packets, coded on one or two bytes */
+static int encode_size(int size, unsigned char *data)
+{
+   if (size < 252)
+   {
+      data[0] = size;
+      return 1;
+   } else {
+      data[0] = 252+(size&0x3);
+      data[1] = (size-(int)data[0])>>2;
+      return 2;
+   }
+}
+
+static int parse_size(const unsigned char *data, int len, int *size)
+{
+   if (len<1)
+   {
+      *size = -1;
+      return -1;
+   } else if (data[0]<252) {
+      *size = data[0];
+      return 1;
+   } else if (len<2) {
+      *size = -1;
+      return -1;
+   } else {
+      *size = 4*data[1] + data[0];
+      return 2;
+   }
+}
+
+/* Most frames in a packet (see celt_encode_packet()) */
+#define MAX_PACKET_FRAMES 48
+
 #define COMBFILTER_MAXPERIOD 1024
 #define COMBFILTER_MINPERIOD 15
 
+/* Per-channel size of the encoder's prefilter history. Each frame is written
+   right after the last COMBFILTER_MAXPERIOD samples, and the window only
+   wraps back to the start of the buffer once it reaches the end, so the
+   history is moved once every few frames instead of once per frame */
+#ifdef ENABLE_POSTFILTER
+#define PREFILTER_HISTORY(mode) (2*COMBFILTER_MAXPERIOD+((mode)->shortMdctSize<<(mode)->maxLM))
+#else
+#define PREFILTER_HISTORY(mode) 0
+#endif
+
 static int resampling_factor(celt_int32 rate)
 {
    int ret;
@@ -145,6 +190,8 @@ struct CELTEncoder {
    int signalling;
    int constrained_vbr;      /* If zero, VBR can do whatever it likes with the rate */
    int loss_rate;
+   int fec;                  /* Percentage of the packet spent on the FEC copy (0 = off) */
+   AllocCache alloc_cache;   /* Fully keyed, so it's kept on a reset */
 
    /* Everything beyond this point gets cleared on a reset */
 #define ENCODER_RESET_START rng
@@ -160,6 +207,7 @@ struct CELTEncoder {
    int prefilter_period;
    celt_word16 prefilter_gain;
    int prefilter_tapset;
+   int prefilter_pos;        /* Start of the current window in prefilter_mem */
 #ifdef RESYNTH
    int prefilter_period_old;
    celt_word16 prefilter_gain_old;
@@ -173,6 +221,10 @@ struct CELTEncoder {
    celt_int32 vbr_offset;
    celt_int32 vbr_count;
 
+   /* Redundant copy of the last frame, sent in the next packet */
+   int fec_len;
+   unsigned char fec_buf[255];
+
    celt_word32 preemph_memE[2];
    celt_word32 preemph_memD[2];
 
@@ -181,7 +233,7 @@ struct CELTEncoder {
 #endif
 
    celt_sig in_mem[1]; /* Size = channels*mode->overlap */
-   /* celt_sig prefilter_mem[],  Size = channels*COMBFILTER_PERIOD */
+   /* celt_sig prefilter_mem[],  Size = channels*PREFILTER_HISTORY(mode) */
    /* celt_sig overlap_mem[],  Size = channels*mode->overlap */
    /* celt_word16 oldEBands[], Size = 2*channels*mode->nbEBands */
 };
@@ -196,7 +248,7 @@ int celt_encoder_get_size_custom(const CELTMode *mode, int channels)
 {
    int size = sizeof(struct CELTEncoder)
          + (2*channels*mode->overlap-1)*sizeof(celt_sig)
-         + channels*COMBFILTER_MAXPERIOD*sizeof(celt_sig)
+         + channels*PREFILTER_HISTORY(mode)*sizeof(celt_sig)
          + 3*channels*mode->nbEBands*sizeof(celt_word16);
    return size;
 }
@@ -480,42 +532,255 @@ static void compute_inv_mdcts(const CELTMode *mode, int shortBlocks, celt_sig *X
    } while (++c<C);
 }
 
-static void deemphasis(celt_sig *in[], celt_word16 *pcm, int N, int _C, int downsample, const celt_word16 *coef, celt_sig *mem)
+/* Converts a CELTOutput gain from Q8 dB to linear (Q12 in fixed-point) */
+static celt_word16 output_gain(int gain)
+{
+   gain = IMAX(-96*256, IMIN(18*256, gain));
+#ifdef FIXED_POINT
+   /* log2(10)/20 in Q17, which takes the gain from Q8 dB to Q10 log2 */
+   return EXTRACT16(MIN32(32767, SHR32(celt_exp2(MULT16_16_Q15(gain, QCONST16(0.6643856f,15))), 4)));
+#else
+   return celt_exp2(gain*(0.16609640f/256));
+#endif
+}
+
+/* Conversions from the signal domain to each output format */
+static inline celt_int16 sig2int16(celt_sig x)
+{
+#ifdef FIXED_POINT
+   return SIG2WORD16(x);
+#else
+   return FLOAT2INT16(SCALEOUT(x));
+#endif
+}
+
+static inline celt_int32 sig2int24(celt_sig x)
+{
+#ifdef FIXED_POINT
+   return MAX32(-8388608, MIN32(8388607, PSHR32(x, SIG_SHIFT-8)));
+#else
+   return float2int(MAX32(-8388608.f, MIN32(8388607.f, x*256.f)));
+#endif
+}
+
+static inline celt_int32 sig2int32(celt_sig x)
+{
+#ifdef FIXED_POINT
+   return SHL32(MAX32(-134217728, MIN32(134217727, x)), 16-SIG_SHIFT);
+#else
+   return float2int(MAX32(-2147483648.f, MIN32(2147483520.f, x*65536.f)));
+#endif
+}
+
+#if !defined(FIXED_POINT) || !defined(DISABLE_FLOAT_API)
+static inline float sig2float(celt_sig x)
+{
+#ifdef FIXED_POINT
+   return SIG2WORD16(x)*(1.f/32768.f);
+#else
+   return SCALEOUT(SIG2WORD16(x));
+#endif
+}
+#endif
+
+static inline celt_sig apply_gain(celt_word16 gain, celt_sig x)
+{
+#ifdef FIXED_POINT
+   return SHL32(MULT16_32_Q15(gain, x), 3);
+#else
+   return x*gain;
+#endif
+}
+
+#define NO_GAIN(x) (x)
+#define WITH_GAIN(x) apply_gain(gain, x)
+
+/* De-emphasis of channel c, stored as TYPE through CONVERT(). It's
+   instantiated for each format and for with/without gain so that neither
+   is tested for every sample. */
+#define DEEMPHASIS_LOOP(TYPE, CONVERT, GAIN) \
+   do { \
+      TYPE *y = (TYPE*)out->channel[c]; \
+      TYPE *y2 = (TYPE*)out->channel[1]; \
+      for (j=0;j<N;j++) \
+      { \
+         celt_sig tmp = *x + m; \
+         m = MULT16_32_Q15(coef[0], tmp) \
+           - MULT16_32_Q15(coef[1], *x); \
+         tmp = SHL32(MULT16_32_Q15(coef[3], tmp), 2); \
+         x++; \
+         if (++count==downsample) \
+         { \
+            TYPE v = CONVERT(GAIN(tmp)); \
+            y[i] = v; \
+            if (dup) \
+               y2[i] = v; \
+            i += stride; \
+            count=0; \
+         } \
+      } \
+   } while (0)
+
+#define DEEMPHASIS_FORMAT(TYPE, CONVERT) \
+   do { \
+      if (out->gain) \
+         DEEMPHASIS_LOOP(TYPE, CONVERT, WITH_GAIN); \
+      else \
+         DEEMPHASIS_LOOP(TYPE, CONVERT, NO_GAIN); \
+   } while (0)
+
+/* De-emphasises C channels into CC output channels. With C==1 and CC==2
+   the one channel is written to both outputs. */
+static void deemphasis(celt_sig *in[], const CELTOutput *out, int N, int _C, int CC, int downsample, const celt_word16 *coef, celt_sig *mem)
 {
    const int C = CHANNELS(_C);
+   const int stride = out->stride;
+   const int dup = CC>C;
    int c;
    int count=0;
+   celt_word16 gain = 0;
+   if (out->gain)
+      gain = output_gain(out->gain);
    c=0; do {
-      int j;
+      int j, i=0;
       celt_sig * restrict x;
-      celt_word16  * restrict y;
       celt_sig m = mem[c];
       x =in[c];
-      y = pcm+c;
-      for (j=0;j<N;j++)
+      switch (out->format)
       {
-         celt_sig tmp = *x + m;
-         m = MULT16_32_Q15(coef[0], tmp)
-           - MULT16_32_Q15(coef[1], *x);
-         tmp = SHL32(MULT16_32_Q15(coef[3], tmp), 2);
-         x++;
-         /* Technically the store could be moved outside of the if because
-            the stores we don't want will just be overwritten */
-         if (++count==downsample)
-         {
-            *y = SCALEOUT(SIG2WORD16(tmp));
-            y+=C;
-            count=0;
-         }
+         case CELT_FORMAT_INT16:
+            DEEMPHASIS_FORMAT(celt_int16, sig2int16);
+            break;
+         case CELT_FORMAT_INT24:
+            DEEMPHASIS_FORMAT(celt_int32, sig2int24);
+            break;
+         case CELT_FORMAT_INT32:
+            DEEMPHASIS_FORMAT(celt_int32, sig2int32);
+            break;
+#if !defined(FIXED_POINT) || !defined(DISABLE_FLOAT_API)
+         case CELT_FORMAT_FLOAT:
+            DEEMPHASIS_FORMAT(float, sig2float);
+            break;
+#endif
       }
       mem[c] = m;
    } while (++c<C);
+   if (CC>C)
+      mem[1] = mem[0];
+}
+
+#ifdef RESYNTH
+/* Interleaved output in the native type of the core (int16 in fixed-point,
+   float otherwise) */
+static void native_output(CELTOutput *out, void *pcm, int C)
+{
+#ifdef FIXED_POINT
+   out->format = CELT_FORMAT_INT16;
+   out->channel[0] = pcm;
+   out->channel[1] = (celt_int16*)pcm+1;
+#else
+   out->format = CELT_FORMAT_FLOAT;
+   out->channel[0] = pcm;
+   out->channel[1] = (float*)pcm+1;
+#endif
+   out->stride = C;
+   out->gain = 0;
+}
+#endif
+
+/* Scales, clips, upsamples and pre-emphasises one channel of the input.
+   Returns 1 if the output is all zeros. */
+static int preemphasis(const celt_word16 * restrict pcm, celt_sig * restrict out, int N, int CC,
+      int upsample, const celt_word16 *coef, celt_sig *mem, int clip)
+{
+   int i;
+   int nonzero=0;
+   celt_sig m = *mem;
+
+   if (upsample==1)
+   {
+      for (i=0;i<N;i++)
+         out[i] = SCALEIN(pcm[CC*i]);
+   } else {
+      /* Zero-stuffing: each input sample goes at the end of its group */
+      for (i=0;i<N;i++)
+         out[i] = 0;
+      for (i=0;i<N/upsample;i++)
+         out[i*upsample+upsample-1] = SCALEIN(pcm[CC*i]);
+   }
+#ifndef FIXED_POINT
+   if (clip)
+   {
+      for (i=0;i<N;i++)
+         out[i] = MAX32(-65536.f, MIN32(65536.f,out[i]));
+   }
+#endif
+
+   if (coef[1]==0)
+   {
+      /* First-order FIR: no recursion, so each output only depends on the
+         current and previous inputs. Going backwards lets us do it in place. */
+      celt_sig last = MULT16_16(coef[2], out[N-1]);
+      for (i=N-1;i>0;i--)
+         out[i] = MULT16_16(coef[2], out[i])
+                - MULT16_32_Q15(coef[0], MULT16_16(coef[2], out[i-1]));
+      out[0] = MULT16_16(coef[2], out[0]) + m;
+      m = -MULT16_32_Q15(coef[0], last);
+   } else {
+      for (i=0;i<N;i++)
+      {
+         celt_sig tmp = MULT16_16(coef[2], out[i]);
+         out[i] = tmp + m;
+         m = MULT16_32_Q15(coef[1], out[i])
+           - MULT16_32_Q15(coef[0], tmp);
+      }
+   }
+   *mem = m;
+
+   for (i=0;i<N;i++)
+      nonzero |= out[i]!=0;
+   return !nonzero;
 }
 
 #ifdef ENABLE_POSTFILTER
+/* Steady-state part of the comb filter (constant gain and period). Four
+   outputs are computed at a time: since T >= COMBFILTER_MINPERIOD, all the
+   inputs they depend on are already final even when filtering in place. */
+static void comb_filter_const(celt_word32 *y, celt_word32 *x, int T, int N,
+      celt_word16 g10, celt_word16 g11, celt_word16 g12)
+{
+   int i;
+   for (i=0;i<N-3;i+=4)
+   {
+      celt_word32 y0, y1, y2, y3;
+      const celt_word32 *xT = x+i-T;
+      y0 = x[i  ] + MULT16_32_Q15(g10,xT[0]) + MULT16_32_Q15(g11,xT[-1]) + MULT16_32_Q15(g11,xT[1])
+                  + MULT16_32_Q15(g12,xT[-2]) + MULT16_32_Q15(g12,xT[2]);
+      y1 = x[i+1] + MULT16_32_Q15(g10,xT[1]) + MULT16_32_Q15(g11,xT[0]) + MULT16_32_Q15(g11,xT[2])
+                  + MULT16_32_Q15(g12,xT[-1]) + MULT16_32_Q15(g12,xT[3]);
+      y2 = x[i+2] + MULT16_32_Q15(g10,xT[2]) + MULT16_32_Q15(g11,xT[1]) + MULT16_32_Q15(g11,xT[3])
+                  + MULT16_32_Q15(g12,xT[0]) + MULT16_32_Q15(g12,xT[4]);
+      y3 = x[i+3] + MULT16_32_Q15(g10,xT[3]) + MULT16_32_Q15(g11,xT[2]) + MULT16_32_Q15(g11,xT[4])
+                  + MULT16_32_Q15(g12,xT[1]) + MULT16_32_Q15(g12,xT[5]);
+      y[i  ] = y0;
+      y[i+1] = y1;
+      y[i+2] = y2;
+      y[i+3] = y3;
+   }
+   for (;i<N;i++)
+      y[i] = x[i]
+               + MULT16_32_Q15(g10,x[i-T])
+               + MULT16_32_Q15(g11,x[i-T-1])
+               + MULT16_32_Q15(g11,x[i-T+1])
+               + MULT16_32_Q15(g12,x[i-T-2])
+               + MULT16_32_Q15(g12,x[i-T+2]);
+}
+
+/* fade is the squared window (mode->crossfade) used to go from the old
+   filter (T0, g0, tapset0) to the new one over the first overlap samples */
 static void comb_filter(celt_word32 *y, celt_word32 *x, int T0, int T1, int N,
       celt_word16 g0, celt_word16 g1, int tapset0, int tapset1,
-      const celt_word16 *window, int overlap)
+      const celt_word16 *fade, int overlap)
 {
    int i;
    /* printf ("%d %d %f %f\n", T0, T1, g0, g1); */
@@ -524,6 +789,16 @@ static void comb_filter(celt_word32 *y, celt_word32 *x, int T0, int T1, int N,
          {QCONST16(0.3066406250f, 15), QCONST16(0.2170410156f, 15), QCONST16(0.1296386719f, 15)},
          {QCONST16(0.4638671875f, 15), QCONST16(0.2680664062f, 15), QCONST16(0.f, 15)},
          {QCONST16(0.7998046875f, 15), QCONST16(0.1000976562f, 15), QCONST16(0.f, 15)}};
+
+   if (g0==0 && g1==0)
+   {
+      /* Nothing to filter */
+      if (x!=y)
+         CELT_MOVE(y, x, N);
+      return;
+   }
+   overlap = IMIN(overlap, N);
+
    g00 = MULT16_16_Q15(g0, gains[tapset0][0]);
    g01 = MULT16_16_Q15(g0, gains[tapset0][1]);
    g02 = MULT16_16_Q15(g0, gains[tapset0][2]);
@@ -532,14 +807,14 @@ static void comb_filter(celt_word32 *y, celt_word32 *x, int T0, int T1, int N,
    g12 = MULT16_16_Q15(g1, gains[tapset1][2]);
    for (i=0;i<overlap;i++)
    {
-      celt_word16 f;
-      f = MULT16_16_Q15(window[i],window[i]);
+      celt_word16 f = fade[i];
+      celt_word16 f0 = Q15ONE-f;
       y[i] = x[i]
-               + MULT16_32_Q15(MULT16_16_Q15((Q15ONE-f),g00),x[i-T0])
-               + MULT16_32_Q15(MULT16_16_Q15((Q15ONE-f),g01),x[i-T0-1])
-               + MULT16_32_Q15(MULT16_16_Q15((Q15ONE-f),g01),x[i-T0+1])
-               + MULT16_32_Q15(MULT16_16_Q15((Q15ONE-f),g02),x[i-T0-2])
-               + MULT16_32_Q15(MULT16_16_Q15((Q15ONE-f),g02),x[i-T0+2])
+               + MULT16_32_Q15(MULT16_16_Q15(f0,g00),x[i-T0])
+               + MULT16_32_Q15(MULT16_16_Q15(f0,g01),x[i-T0-1])
+               + MULT16_32_Q15(MULT16_16_Q15(f0,g01),x[i-T0+1])
+               + MULT16_32_Q15(MULT16_16_Q15(f0,g02),x[i-T0-2])
+               + MULT16_32_Q15(MULT16_16_Q15(f0,g02),x[i-T0+2])
                + MULT16_32_Q15(MULT16_16_Q15(f,g10),x[i-T1])
                + MULT16_32_Q15(MULT16_16_Q15(f,g11),x[i-T1-1])
                + MULT16_32_Q15(MULT16_16_Q15(f,g11),x[i-T1+1])
@@ -547,13 +822,13 @@ static void comb_filter(celt_word32 *y, celt_word32 *x, int T0, int T1, int N,
                + MULT16_32_Q15(MULT16_16_Q15(f,g12),x[i-T1+2]);
 
    }
-   for (i=overlap;i<N;i++)
-      y[i] = x[i]
-               + MULT16_32_Q15(g10,x[i-T1])
-               + MULT16_32_Q15(g11,x[i-T1-1])
-               + MULT16_32_Q15(g11,x[i-T1+1])
-               + MULT16_32_Q15(g12,x[i-T1-2])
-               + MULT16_32_Q15(g12,x[i-T1+2]);
+   if (g1==0)
+   {
+      if (x!=y)
+         CELT_MOVE(y+overlap, x+overlap, N-overlap);
+      return;
+   }
+   comb_filter_const(y+overlap, x+overlap, T1, N-overlap, g10, g11, g12);
 }
 #endif /* ENABLE_POSTFILTER */
 
@@ -571,6 +846,13 @@ static celt_word32 l1_metric(const celt_norm *tmp, int N, int LM, int width)
    celt_word32 L1;
    celt_word16 bias;
    L1=0;
+   if (LM==0)
+   {
+      /* A single block, which also has no bias */
+      for (j=0;j<N;j++)
+         L1 = MAC16_16(L1, tmp[j], tmp[j]);
+      return MULT16_32_Q15(sqrtM_1[0], celt_sqrt(L1));
+   }
    for (i=0;i<1<<LM;i++)
    {
       celt_word32 L2 = 0;
@@ -604,7 +886,9 @@ static int tf_analysis(const CELTMode *m, celt_word16 *bandLogE, celt_word16 *ol
    int tf_select=0;
    SAVE_STACK;
 
-   if (nbCompressedBytes<15*C)
+   /* With 2.5 ms frames there is only one resolution to choose from, so
+      every metric is zero and the Viterbi search always picks tf_res=0 */
+   if (nbCompressedBytes<15*C || LM==0)
    {
       *tf_sum = 0;
       for (i=0;i<len;i++)
@@ -759,7 +1043,7 @@ static void tf_encode(int start, int end, int isTransient, int *tf_res, int LM,
    /*printf("%d %d ", isTransient, tf_select); for(i=0;i<end;i++)printf("%d ", tf_res[i]);printf("\n");*/
 }
 
-static void tf_decode(int start, int end, int isTransient, int *tf_res, int LM, ec_dec *dec)
+static int tf_decode(int start, int end, int isTransient, int *tf_res, int *tf_raw, int LM, ec_dec *dec)
 {
    int i, curr, tf_select;
    int tf_select_rsv;
@@ -785,6 +1069,9 @@ static void tf_decode(int start, int end, int isTransient, int *tf_res, int LM,
       tf_res[i] = curr;
       logp = isTransient ? 4 : 5;
    }
+   if (tf_raw!=NULL)
+      for (i=start;i<end;i++)
+         tf_raw[i] = tf_res[i];
    tf_select = 0;
    if (tf_select_rsv &&
      tf_select_table[LM][4*isTransient+0+tf_changed] !=
@@ -796,6 +1083,35 @@ static void tf_decode(int start, int end, int isTransient, int *tf_res, int LM,
    {
       tf_res[i] = tf_select_table[LM][4*isTransient+2*tf_select+tf_res[i]];
    }
+   return tf_select;
+}
+
+/* First band coded with intensity stereo for a given number of bytes */
+static int intensity_decision(int effectiveBytes, int LM, int start, int end)
+{
+   int intensity;
+   int effectiveRate;
+
+   /* Account for coarse energy */
+   effectiveRate = (8*effectiveBytes - 80)>>LM;
+
+   /* effectiveRate in kb/s */
+   effectiveRate = 2*effectiveRate/5;
+   if (effectiveRate<35)
+      intensity = 8;
+   else if (effectiveRate<50)
+      intensity = 12;
+   else if (effectiveRate<68)
+      intensity = 16;
+   else if (effectiveRate<84)
+      intensity = 18;
+   else if (effectiveRate<102)
+      intensity = 19;
+   else if (effectiveRate<130)
+      intensity = 20;
+   else
+      intensity = 100;
+   return IMIN(end,IMAX(start, intensity));
 }
 
 static void init_caps(const CELTMode *m,int *cap,int LM,int C)
@@ -896,15 +1212,58 @@ static int stereo_analysis(const CELTMode *m, const celt_norm *X,
          > MULT16_32_Q15(m->eBands[13]<<(LM+1), sumLR);
 }
 
-#ifdef FIXED_POINT
-CELT_STATIC
-int celt_encode_with_ec(CELTEncoder * restrict st, const celt_int16 * pcm, int frame_size, unsigned char *compressed, int nbCompressedBytes, ec_enc *enc)
+/* Copies input that has already been pre-emphasised (see
+   celt_encode_simulcast()). Returns 1 if it is all zeros. */
+static int emph_input(const celt_sig * restrict emph, celt_sig * restrict out, int N)
 {
-#else
-CELT_STATIC
-int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, int frame_size, unsigned char *compressed, int nbCompressedBytes, ec_enc *enc)
+   int i;
+   int nonzero=0;
+   for (i=0;i<N;i++)
+   {
+      out[i] = emph[i];
+      nonzero |= out[i]!=0;
+   }
+   return !nonzero;
+}
+
+/* Analysis of the MDCT input that the layers of celt_encode_simulcast() can
+   share. It is only reused when a layer's MDCT input (and the parameters
+   below) are the same as those it was computed from, so that each layer
+   still gets exactly what it would have computed on its own. */
+typedef struct {
+   celt_sig *in;             /**< MDCT input the results come from */
+   int size;                 /**< Number of samples in in, 0 when empty */
+   int C, effEnd, end, upsample;
+   int transient;            /**< Result of transient_analysis(), or -1 */
+   int have[2];              /**< Whether the long/short block results are there */
+   celt_norm *X[2];
+   celt_ener *bandE[2];
+   celt_word16 *bandLogE[2];
+} SharedAnalysis;
+
+/* Empties the shared analysis unless it was computed from this input */
+static void shared_analysis_key(SharedAnalysis *sh, const celt_sig *in, int size,
+      int C, int effEnd, int end, int upsample)
+{
+   if (sh->size==size && sh->C==C && sh->effEnd==effEnd && sh->end==end
+         && sh->upsample==upsample && memcmp(sh->in, in, size*sizeof(celt_sig))==0)
+      return;
+   CELT_COPY(sh->in, in, size);
+   sh->size = size;
+   sh->C = C;
+   sh->effEnd = effEnd;
+   sh->end = end;
+   sh->upsample = upsample;
+   sh->transient = -1;
+   sh->have[0] = sh->have[1] = 0;
+}
+
+/* Encodes one frame from pcm or, if emph is not NULL, from a mono input that
+   has already been pre-emphasised. The analysis in shared (if not NULL) is
+   used and updated. */
+static int celt_encode_frame(CELTEncoder * restrict st, const celt_word16 * pcm, const celt_sig *emph,
+      int frame_size, unsigned char *compressed, int nbCompressedBytes, ec_enc *enc, SharedAnalysis *shared)
 {
-#endif
    int i, c, N;
    celt_int32 bits;
    ec_enc _enc;
@@ -953,9 +1312,12 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, i
    int anti_collapse_rsv;
    int anti_collapse_on=0;
    int silence=0;
+   int fec_bits=0;
+   int fec_len=0;
+   unsigned char fec_buf[255];
    ALLOC_STACK;
 
-   if (nbCompressedBytes<2 || pcm==NULL)
+   if (nbCompressedBytes<2 || (pcm==NULL && emph==NULL))
      return CELT_BAD_ARG;
 
    frame_size *= st->upsample;
@@ -967,10 +1329,36 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, i
    M=1<<LM;
    N = M*st->mode->shortMdctSize;
 
+   if (st->fec)
+   {
+      /* The FEC copy of this frame is a low-rate, intra-coded frame that the
+         decoder can use in place of this one if the packet gets lost. It is
+         encoded from the state as it is now, which is then restored so that
+         the main encoding is unaffected. */
+      VARDECL(unsigned char, saved);
+      int size = celt_encoder_get_size_custom(st->mode, st->channels);
+      celt_int32 fec_bytes = st->bitrate*frame_size/(8*st->mode->Fs);
+      if (!st->vbr)
+         fec_bytes = IMIN(fec_bytes, nbCompressedBytes);
+      fec_bytes = IMIN(255, fec_bytes*st->fec/100);
+      if (fec_bytes >= 3)
+      {
+         ALLOC(saved, size, unsigned char);
+         CELT_COPY(saved, (unsigned char*)st, size);
+         st->fec = 0;
+         st->force_intra = 1;
+         st->disable_pf = 1;
+         st->vbr = 0;
+         fec_len = celt_encode_frame(st, pcm, emph, frame_size/st->upsample, fec_buf, fec_bytes, NULL, shared);
+         CELT_COPY((unsigned char*)st, saved, size);
+         fec_len = IMAX(0, fec_len);
+      }
+   }
+
    prefilter_mem = st->in_mem+CC*(st->overlap);
-   _overlap_mem = prefilter_mem+CC*COMBFILTER_MAXPERIOD;
+   _overlap_mem = prefilter_mem+CC*PREFILTER_HISTORY(st->mode);
    /*_overlap_mem = st->in_mem+C*(st->overlap);*/
-   oldBandE = (celt_word16*)(st->in_mem+CC*(2*st->overlap+COMBFILTER_MAXPERIOD));
+   oldBandE = (celt_word16*)(st->in_mem+CC*(2*st->overlap+PREFILTER_HISTORY(st->mode)));
    oldLogE = oldBandE + CC*st->mode->nbEBands;
    oldLogE2 = oldLogE + CC*st->mode->nbEBands;
 
@@ -1066,46 +1454,40 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, i
 
    /* Find pitch period and gain */
    {
-      VARDECL(celt_sig, _pre);
+#ifdef ENABLE_POSTFILTER
       celt_sig *pre[2];
+      const int hist = PREFILTER_HISTORY(st->mode);
+#endif
       SAVE_STACK;
-      ALLOC(_pre, CC*(N+COMBFILTER_MAXPERIOD), celt_sig);
 
-      pre[0] = _pre;
-      pre[1] = _pre + (N+COMBFILTER_MAXPERIOD);
+#ifdef ENABLE_POSTFILTER
+      if (st->prefilter_pos+COMBFILTER_MAXPERIOD+N > hist)
+      {
+         /* No room left for this frame: bring the window back to the start */
+         c=0; do {
+            CELT_MOVE(prefilter_mem+c*hist, prefilter_mem+c*hist+st->prefilter_pos, COMBFILTER_MAXPERIOD);
+         } while (++c<CC);
+         st->prefilter_pos = 0;
+      }
+#endif
 
+      /* The input goes straight into the prefilter history, from which the
+         prefilter writes the MDCT input. Without the prefilter it goes
+         straight into the MDCT input. */
       silence = 1;
       c=0; do {
-         int count = 0;
-         const celt_word16 * restrict pcmp = pcm+c;
-         celt_sig * restrict inp = in+c*(N+st->overlap)+st->overlap;
-
-         for (i=0;i<N;i++)
-         {
-            celt_sig x, tmp;
-
-            x = SCALEIN(*pcmp);
-#ifndef FIXED_POINT
-            if (st->clip)
-               x = MAX32(-65536.f, MIN32(65536.f,x));
+         celt_sig *out;
+#ifdef ENABLE_POSTFILTER
+         pre[c] = prefilter_mem+c*hist+st->prefilter_pos;
+         out = pre[c]+COMBFILTER_MAXPERIOD;
+#else
+         out = in+c*(N+st->overlap)+st->overlap;
 #endif
-            if (++count==st->upsample)
-            {
-               count=0;
-               pcmp+=CC;
-            } else {
-               x = 0;
-            }
-            /* Apply pre-emphasis */
-            tmp = MULT16_16(st->mode->preemph[2], x);
-            *inp = tmp + st->preemph_memE[c];
-            st->preemph_memE[c] = MULT16_32_Q15(st->mode->preemph[1], *inp)
-                                   - MULT16_32_Q15(st->mode->preemph[0], tmp);
-            silence = silence && *inp == 0;
-            inp++;
-         }
-         CELT_COPY(pre[c], prefilter_mem+c*COMBFILTER_MAXPERIOD, COMBFILTER_MAXPERIOD);
-         CELT_COPY(pre[c]+COMBFILTER_MAXPERIOD, in+c*(N+st->overlap)+st->overlap, N);
+         if (emph!=NULL)
+            silence &= emph_input(emph, out, N);
+         else
+            silence &= preemphasis(pcm+c, out, N, CC, st->upsample,
+                  st->mode->preemph, &st->preemph_memE[c], st->clip);
       } while (++c<CC);
 
       if (tell==1)
@@ -1127,6 +1509,20 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, i
          tell = nbCompressedBytes*8;
          enc->nbits_total+=tell-ec_tell(enc);
       }
+      if (st->fec && tell==1)
+      {
+         /* The previous frame's FEC copy is stored as raw bits, preceded
+            by its length, so it can be extracted without decoding the
+            rest of the frame */
+         int len = st->fec_len;
+         if (8*(len+1)+128 > total_bits)
+            len = 0;
+         ec_enc_bits(enc, len, 8);
+         for (i=0;i<len;i++)
+            ec_enc_bits(enc, st->fec_buf[i], 8);
+         tell = ec_tell(enc);
+         fec_bits = 8*(len+1);
+      }
 #ifdef ENABLE_POSTFILTER
       if (nbAvailableBytes>12*C && st->start==0 && !silence && !st->disable_pf && st->complexity >= 5)
       {
@@ -1225,38 +1621,41 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, i
 
          comb_filter(in+c*(N+st->overlap)+st->overlap+offset, pre[c]+COMBFILTER_MAXPERIOD+offset,
                st->prefilter_period, pitch_index, N-offset, -st->prefilter_gain, -gain1,
-               st->prefilter_tapset, prefilter_tapset, st->mode->window, st->mode->overlap);
+               st->prefilter_tapset, prefilter_tapset, st->mode->crossfade, st->mode->overlap);
 #endif /* ENABLE_POSTFILTER */
          CELT_COPY(st->in_mem+c*(st->overlap), in+c*(N+st->overlap)+N, st->overlap);
-
-#ifdef ENABLE_POSTFILTER
-         if (N>COMBFILTER_MAXPERIOD)
-         {
-            CELT_MOVE(prefilter_mem+c*COMBFILTER_MAXPERIOD, pre[c]+N, COMBFILTER_MAXPERIOD);
-         } else {
-            CELT_MOVE(prefilter_mem+c*COMBFILTER_MAXPERIOD, prefilter_mem+c*COMBFILTER_MAXPERIOD+N, COMBFILTER_MAXPERIOD-N);
-            CELT_MOVE(prefilter_mem+c*COMBFILTER_MAXPERIOD+COMBFILTER_MAXPERIOD-N, pre[c]+COMBFILTER_MAXPERIOD, N);
-         }
-#endif /* ENABLE_POSTFILTER */
       } while (++c<CC);
+#ifdef ENABLE_POSTFILTER
+      st->prefilter_pos += N;
+#endif
 
       RESTORE_STACK;
    }
 
 #ifdef RESYNTH
-   resynth = 1;
+   resynth = pcm!=NULL;
 #else
    resynth = 0;
 #endif
 
+   if (shared!=NULL)
+      shared_analysis_key(shared, in, CC*(N+st->overlap), C, effEnd, st->end, st->upsample);
+
    isTransient = 0;
    shortBlocks = 0;
    if (LM>0 && ec_tell(enc)+3<=total_bits)
    {
       if (st->complexity > 1)
       {
-         isTransient = transient_analysis(in, N+st->overlap, CC,
-                  st->overlap);
+         if (shared!=NULL && shared->transient>=0)
+         {
+            isTransient = shared->transient;
+         } else {
+            isTransient = transient_analysis(in, N+st->overlap, CC,
+                     st->overlap);
+            if (shared!=NULL)
+               shared->transient = isTransient;
+         }
          if (isTransient)
             shortBlocks = M;
       }
@@ -1266,33 +1665,48 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, i
    ALLOC(freq, CC*N, celt_sig); /**< Interleaved signal MDCTs */
    ALLOC(bandE,st->mode->nbEBands*CC, celt_ener);
    ALLOC(bandLogE,st->mode->nbEBands*CC, celt_word16);
-   /* Compute MDCTs */
-   compute_mdcts(st->mode, shortBlocks, in, freq, CC, LM);
-
-   if (CC==2&&C==1)
-   {
-      for (i=0;i<N;i++)
-         freq[i] = ADD32(HALF32(freq[i]), HALF32(freq[N+i]));
-   }
-   if (st->upsample != 1)
+   ALLOC(X, C*N, celt_norm);         /**< Interleaved normalised MDCTs */
+   if (shared!=NULL && shared->have[shortBlocks!=0])
    {
-      c=0; do
+      const int b = shortBlocks!=0;
+      CELT_COPY(X, shared->X[b], C*N);
+      CELT_COPY(bandE, shared->bandE[b], st->mode->nbEBands*CC);
+      CELT_COPY(bandLogE, shared->bandLogE[b], st->mode->nbEBands*CC);
+   } else {
+      /* Compute MDCTs */
+      compute_mdcts(st->mode, shortBlocks, in, freq, CC, LM);
+
+      if (CC==2&&C==1)
       {
-         int bound = N/st->upsample;
-         for (i=0;i<bound;i++)
-            freq[c*N+i] *= st->upsample;
-         for (;i<N;i++)
-            freq[c*N+i] = 0;
-      } while (++c<C);
-   }
-   ALLOC(X, C*N, celt_norm);         /**< Interleaved normalised MDCTs */
+         for (i=0;i<N;i++)
+            freq[i] = ADD32(HALF32(freq[i]), HALF32(freq[N+i]));
+      }
+      if (st->upsample != 1)
+      {
+         c=0; do
+         {
+            int bound = N/st->upsample;
+            for (i=0;i<bound;i++)
+               freq[c*N+i] *= st->upsample;
+            for (;i<N;i++)
+               freq[c*N+i] = 0;
+         } while (++c<C);
+      }
 
-   celtcompute_band_energies(st->mode, freq, bandE, effEnd, C, M);
+      /* Band energies and normalisation */
+      celtcompute_and_normalise_bands(st->mode, freq, X, bandE, effEnd, C, M);
 
-   celtamp2Log2(st->mode, effEnd, st->end, bandE, bandLogE, C);
+      celtamp2Log2(st->mode, effEnd, st->end, bandE, bandLogE, C);
 
-   /* Band normalisation */
-   celtnormalise_bands(st->mode, freq, X, bandE, effEnd, C, M);
+      if (shared!=NULL)
+      {
+         const int b = shortBlocks!=0;
+         CELT_COPY(shared->X[b], X, C*N);
+         CELT_COPY(shared->bandE[b], bandE, st->mode->nbEBands*CC);
+         CELT_COPY(shared->bandLogE[b], bandLogE, st->mode->nbEBands*CC);
+         shared->have[b] = 1;
+      }
+   }
 
    ALLOC(tf_res, st->mode->nbEBands, int);
    /* Needs to be before coarse energy quantization because otherwise the energy gets modified */
@@ -1420,7 +1834,7 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, i
 
      /* The current offset is removed from the target and the space used
         so far is added*/
-     target=target+tell;
+     target=target+tell-(fec_bits<<BITRES);
 
      /* In VBR mode the frame size must not be reduced so much that it would
          result in the encoder running out of bits.
@@ -1480,32 +1894,11 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, i
    }
    if (C==2)
    {
-      int effectiveRate;
-
       /* Always use MS for 2.5 ms frames until we can do a better analysis */
       if (LM!=0)
          dual_stereo = stereo_analysis(st->mode, X, LM, N);
 
-      /* Account for coarse energy */
-      effectiveRate = (8*effectiveBytes - 80)>>LM;
-
-      /* effectiveRate in kb/s */
-      effectiveRate = 2*effectiveRate/5;
-      if (effectiveRate<35)
-         intensity = 8;
-      else if (effectiveRate<50)
-         intensity = 12;
-      else if (effectiveRate<68)
-         intensity = 16;
-      else if (effectiveRate<84)
-         intensity = 18;
-      else if (effectiveRate<102)
-         intensity = 19;
-      else if (effectiveRate<130)
-         intensity = 20;
-      else
-         intensity = 100;
-      intensity = IMIN(st->end,IMAX(st->start, intensity));
+      intensity = intensity_decision(effectiveBytes, LM, st->start, st->end);
    }
 
    /* Bit allocation */
@@ -1517,7 +1910,7 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, i
    bits = ((celt_int32)nbCompressedBytes*8<<BITRES) - ec_tell_frac(enc) - 1;
    anti_collapse_rsv = isTransient&&LM>=2&&bits>=(LM+2<<BITRES) ? (1<<BITRES) : 0;
    bits -= anti_collapse_rsv;
-   codedBands = compute_allocation(st->mode, st->start, st->end, offsets, cap,
+   codedBands = compute_allocation(st->mode, &st->alloc_cache, st->start, st->end, offsets, cap,
          alloc_trim, &intensity, &dual_stereo, bits, &balance, pulses,
          fine_quant, fine_priority, C, LM, enc, 1, st->lastCodedBands);
    st->lastCodedBands = codedBands;
@@ -1615,15 +2008,19 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, i
          st->prefilter_period_old=IMAX(st->prefilter_period_old, COMBFILTER_MINPERIOD);
          comb_filter(out_mem[c], out_mem[c], st->prefilter_period_old, st->prefilter_period, st->mode->shortMdctSize,
                st->prefilter_gain_old, st->prefilter_gain, st->prefilter_tapset_old, st->prefilter_tapset,
-               st->mode->window, st->overlap);
+               st->mode->crossfade, st->overlap);
          if (LM!=0)
             comb_filter(out_mem[c]+st->mode->shortMdctSize, out_mem[c]+st->mode->shortMdctSize, st->prefilter_period, pitch_index, N-st->mode->shortMdctSize,
                   st->prefilter_gain, gain1, st->prefilter_tapset, prefilter_tapset,
-                  st->mode->window, st->mode->overlap);
+                  st->mode->crossfade, st->mode->overlap);
       } while (++c<CC);
 #endif /* ENABLE_POSTFILTER */
 
-      deemphasis(out_mem, (celt_word16*)pcm, N, CC, st->upsample, st->mode->preemph, st->preemph_memD);
+      {
+         CELTOutput out;
+         native_output(&out, (void*)pcm, CC);
+         deemphasis(out_mem, &out, N, CC, CC, st->upsample, st->mode->preemph, st->preemph_memD);
+      }
       st->prefilter_period_old = st->prefilter_period;
       st->prefilter_gain_old = st->prefilter_gain;
       st->prefilter_tapset_old = st->prefilter_tapset;
@@ -1678,6 +2075,12 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, i
    if (st->signalling)
       nbCompressedBytes++;
 
+   if (st->fec)
+   {
+      st->fec_len = fec_len;
+      CELT_COPY(st->fec_buf, fec_buf, fec_len);
+   }
+
    RESTORE_STACK;
    if (ec_get_error(enc))
       return CELT_INTERNAL_ERROR;
@@ -1686,6 +2089,14 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, i
 }
 
 #ifdef FIXED_POINT
+CELT_STATIC
+int celt_encode_with_ec(CELTEncoder * restrict st, const celt_int16 * pcm, int frame_size, unsigned char *compressed, int nbCompressedBytes, ec_enc *enc)
+{
+   if (pcm==NULL)
+      return CELT_BAD_ARG;
+   return celt_encode_frame(st, pcm, NULL, frame_size, compressed, nbCompressedBytes, enc, NULL);
+}
+
 #ifndef DISABLE_FLOAT_API
 CELT_STATIC
 int celt_encode_with_ec_float(CELTEncoder * restrict st, const float * pcm, int frame_size, unsigned char *compressed, int nbCompressedBytes, ec_enc *enc)
@@ -1715,6 +2126,14 @@ int celt_encode_with_ec_float(CELTEncoder * restrict st, const float * pcm, int
 }
 #endif /*DISABLE_FLOAT_API*/
 #else
+CELT_STATIC
+int celt_encode_with_ec_float(CELTEncoder * restrict st, const celt_sig * pcm, int frame_size, unsigned char *compressed, int nbCompressedBytes, ec_enc *enc)
+{
+   if (pcm==NULL)
+      return CELT_BAD_ARG;
+   return celt_encode_frame(st, pcm, NULL, frame_size, compressed, nbCompressedBytes, enc, NULL);
+}
+
 CELT_STATIC
 int celt_encode_with_ec(CELTEncoder * restrict st, const celt_int16 * pcm, int frame_size, unsigned char *compressed, int nbCompressedBytes, ec_enc *enc)
 {
@@ -1754,24 +2173,616 @@ int celt_encode_float(CELTEncoder * restrict st, const float * pcm, int frame_si
 }
 #endif /* DISABLE_FLOAT_API */
 
-int celt_encoder_ctl(CELTEncoder * restrict st, int request, ...)
+int celt_encode_iov(CELTEncoder * restrict st, const celt_int16 * pcm, int frame_size, const CELTIovec *iov, int iovcnt, int headroom, int nbCompressedBytes)
 {
-   va_list ap;
-   
-   va_start(ap, request);
-   switch (request)
+   int i, j, ret, total;
+   VARDECL(unsigned char, buf);
+   ALLOC_STACK;
+
+   if (iov==NULL || iovcnt<1 || headroom<0)
    {
-      case CELT_SET_COMPLEXITY_REQUEST:
+      RESTORE_STACK;
+      return CELT_BAD_ARG;
+   }
+   /* Find the segment where the compressed data starts */
+   for (i=0;i<iovcnt && headroom>=iov[i].len;i++)
+      headroom -= iov[i].len;
+   total = -headroom;
+   for (j=i;j<iovcnt;j++)
+      total += iov[j].len;
+   /* No frame is larger than 1275 bytes, plus the signalling byte */
+   nbCompressedBytes = IMIN(nbCompressedBytes, IMIN(total, 1276));
+   if (i<iovcnt && iov[i].len-headroom >= nbCompressedBytes)
+   {
+      ret = celt_encode(st, pcm, frame_size, iov[i].base+headroom, nbCompressedBytes);
+      RESTORE_STACK;
+      return ret;
+   }
+
+   /* The frame may straddle segments: encode it on the side and scatter it */
+   ALLOC(buf, IMAX(1, nbCompressedBytes), unsigned char);
+   ret = celt_encode(st, pcm, frame_size, buf, nbCompressedBytes);
+   for (j=0;j<ret;i++)
+   {
+      int n = IMIN(ret-j, iov[i].len-headroom);
+      CELT_COPY(iov[i].base+headroom, buf+j, n);
+      j += n;
+      headroom = 0;
+   }
+   RESTORE_STACK;
+   return ret;
+}
+
+int celt_encode_simulcast(CELTEncoder **st, int K, const celt_int16 * pcm, int frame_size, unsigned char **compressed, const int *nbCompressedBytes, int *len)
+{
+   int j, k, b, LM, N, C, mono;
+   int ret = CELT_OK;
+   const CELTMode *mode;
+   SharedAnalysis shared;
+   VARDECL(celt_sig, emph);
+   VARDECL(celt_sig, shared_in);
+   VARDECL(celt_norm, shared_X);
+   VARDECL(celt_ener, shared_bandE);
+   VARDECL(celt_word16, shared_bandLogE);
+   VARDECL(celt_word16, in);
+   celt_sig mem0=0, mem=0;
+   ALLOC_STACK;
+
+   if (st==NULL || K<1 || pcm==NULL || compressed==NULL || nbCompressedBytes==NULL || len==NULL)
+   {
+      RESTORE_STACK;
+      return CELT_BAD_ARG;
+   }
+   mode = st[0]->mode;
+   C = CHANNELS(st[0]->channels);
+   for (k=0;k<K;k++)
+   {
+      if (st[k]->mode!=mode || st[k]->channels!=st[0]->channels || st[k]->upsample!=st[0]->upsample)
       {
-         int value = va_arg(ap, celt_int32);
-         if (value<0 || value>10)
-            goto bad_arg;
-         st->complexity = value;
+         RESTORE_STACK;
+         return CELT_BAD_ARG;
       }
-      break;
-      case CELT_SET_START_BAND_REQUEST:
-      {
-         celt_int32 value = va_arg(ap, celt_int32);
+   }
+   for (LM=0;LM<=mode->maxLM;LM++)
+      if (mode->shortMdctSize<<LM==frame_size*st[0]->upsample)
+         break;
+   if (LM>mode->maxLM)
+   {
+      RESTORE_STACK;
+      return CELT_BAD_ARG;
+   }
+   N = mode->shortMdctSize<<LM;
+
+   shared.size = 0;
+   ALLOC(shared_in, C*(N+mode->overlap), celt_sig);
+   ALLOC(shared_X, 2*C*N, celt_norm);
+   ALLOC(shared_bandE, 2*C*mode->nbEBands, celt_ener);
+   ALLOC(shared_bandLogE, 2*C*mode->nbEBands, celt_word16);
+   shared.in = shared_in;
+   for (b=0;b<2;b++)
+   {
+      shared.X[b] = shared_X+b*C*N;
+      shared.bandE[b] = shared_bandE+b*C*mode->nbEBands;
+      shared.bandLogE[b] = shared_bandLogE+b*C*mode->nbEBands;
+   }
+
+   /* A mono input only needs to be pre-emphasised once, for all the layers
+      whose filter memory is the same */
+   mono = C==1 && st[0]->upsample==1;
+   ALLOC(emph, mono ? frame_size : 1, celt_sig);
+   ALLOC(in, C*frame_size, celt_word16);
+   if (mono)
+   {
+      for (j=0;j<frame_size;j++)
+#ifdef FIXED_POINT
+         in[j] = pcm[j];
+#else
+         in[j] = SCALEOUT(pcm[j]);
+#endif
+      mem0 = mem = st[0]->preemph_memE[0];
+      preemphasis(in, emph, frame_size, 1, 1, mode->preemph, &mem, st[0]->clip);
+   }
+
+   for (k=0;k<K;k++)
+   {
+      if (mono && memcmp(&st[k]->preemph_memE[0], &mem0, sizeof(celt_sig))==0)
+      {
+         st[k]->preemph_memE[0] = mem;
+         len[k] = celt_encode_frame(st[k], NULL, emph, frame_size,
+               compressed[k], nbCompressedBytes[k], NULL, &shared);
+      } else {
+         /* A fresh copy for each layer, as the resynthesis writes to it */
+         for (j=0;j<C*frame_size;j++)
+#ifdef FIXED_POINT
+            in[j] = pcm[j];
+#else
+            in[j] = SCALEOUT(pcm[j]);
+#endif
+         len[k] = celt_encode_frame(st[k], in, NULL, frame_size,
+               compressed[k], nbCompressedBytes[k], NULL, &shared);
+      }
+      if (len[k]<0 && ret==CELT_OK)
+         ret = len[k];
+   }
+   RESTORE_STACK;
+   return ret;
+}
+
+int celt_encode_packet(CELTEncoder * restrict st, const celt_int16 * pcm, int frame_size, int nb_frames, unsigned char *compressed, int nbCompressedBytes)
+{
+   int k, LM, ret, hdr, total, vbr;
+   int len[MAX_PACKET_FRAMES];
+   unsigned char *ptr;
+   const int signalling = st->signalling;
+   const int CC = CHANNELS(st->channels);
+
+   if (pcm==NULL || compressed==NULL || nb_frames<1 || nb_frames>MAX_PACKET_FRAMES)
+      return CELT_BAD_ARG;
+   for (LM=0;LM<=st->mode->maxLM;LM++)
+      if (st->mode->shortMdctSize<<LM==frame_size*st->upsample)
+         break;
+   if (LM>st->mode->maxLM)
+      return CELT_BAD_ARG;
+   /* Room for the largest header: TOC, frame count and two bytes per
+      frame length */
+   hdr = !!signalling + 1 + 2*(nb_frames-1);
+   if (nbCompressedBytes < hdr+2*nb_frames)
+      return CELT_BAD_ARG;
+
+   if (signalling)
+   {
+      int tmp = (st->mode->effEBands-st->end)>>1;
+      st->end = IMAX(1, st->mode->effEBands-tmp);
+      compressed[0] = tmp<<5;
+      compressed[0] |= LM<<3;
+      compressed[0] |= (CHANNELS(st->stream_channels)==2)<<2;
+      /* Arbitrary number of frames */
+      compressed[0] |= 3;
+      /* Convert "standard mode" to Opus header */
+      if (st->mode->Fs==48000 && st->mode->shortMdctSize==120)
+      {
+         int c0 = toOpus(compressed[0]);
+         if (c0<0)
+            return CELT_BAD_ARG;
+         compressed[0] = c0;
+      }
+   }
+
+   /* The frames share the TOC, so they are encoded without one, after the
+      space reserved for the header. Each gets an even share of what's left. */
+   st->signalling = 0;
+   ptr = compressed+hdr;
+   total = hdr;
+   ret = CELT_OK;
+   for (k=0;k<nb_frames;k++)
+   {
+      int bytes = IMIN(1275, (nbCompressedBytes-total)/(nb_frames-k));
+      ret = celt_encode(st, pcm+k*frame_size*CC, frame_size, ptr, bytes);
+      if (ret<0)
+         break;
+      len[k] = ret;
+      ptr += ret;
+      total += ret;
+   }
+   st->signalling = signalling;
+   if (ret<0)
+      return ret;
+
+   /* The lengths are only needed when the frames differ in size */
+   vbr = 0;
+   for (k=1;k<nb_frames;k++)
+      vbr |= len[k]!=len[0];
+   ptr = compressed+!!signalling;
+   *ptr++ = vbr<<7 | nb_frames;
+   if (vbr)
+   {
+      for (k=0;k<nb_frames-1;k++)
+         ptr += encode_size(len[k], ptr);
+   }
+   /* Close the gap left by the shorter header */
+   CELT_MOVE(ptr, compressed+hdr, total-hdr);
+   return (ptr-compressed)+total-hdr;
+}
+
+/* Snapshots (see celt_encoder_snapshot()) are a sequence of little-endian
+   32-bit words, so that they depend neither on the struct layout nor on
+   pointers. Each history is preceded by the number of leading zeros, which
+   are not stored. */
+#define SNAPSHOT_MAGIC 0x544c4543
+#define SNAPSHOT_VERSION 1
+
+/* What changes the contents of the state */
+#ifdef FIXED_POINT
+#define SNAPSHOT_FIXED 1
+#else
+#define SNAPSHOT_FIXED 0
+#endif
+#ifdef ENABLE_POSTFILTER
+#define SNAPSHOT_POSTFILTER 2
+#else
+#define SNAPSHOT_POSTFILTER 0
+#endif
+#ifdef RESYNTH
+#define SNAPSHOT_RESYNTH 4
+#else
+#define SNAPSHOT_RESYNTH 0
+#endif
+#define SNAPSHOT_BUILD (SNAPSHOT_FIXED|SNAPSHOT_POSTFILTER|SNAPSHOT_RESYNTH)
+
+typedef struct {
+   unsigned char *data;
+   int len;
+   int pos;
+   int error;
+} Snapshot;
+
+static void snapshot_put(Snapshot *s, celt_uint32 x)
+{
+   /* Only count the bytes */
+   if (s->data==NULL)
+   {
+      s->pos += 4;
+      return;
+   }
+   if (s->pos+4 > s->len)
+   {
+      s->error = 1;
+      return;
+   }
+   s->data[s->pos] = x&0xFF;
+   s->data[s->pos+1] = (x>>8)&0xFF;
+   s->data[s->pos+2] = (x>>16)&0xFF;
+   s->data[s->pos+3] = x>>24;
+   s->pos += 4;
+}
+
+static celt_uint32 snapshot_get(Snapshot *s)
+{
+   celt_uint32 x;
+   if (s->pos+4 > s->len)
+   {
+      s->error = 1;
+      return 0;
+   }
+   x = s->data[s->pos] | (celt_uint32)s->data[s->pos+1]<<8
+         | (celt_uint32)s->data[s->pos+2]<<16 | (celt_uint32)s->data[s->pos+3]<<24;
+   s->pos += 4;
+   return x;
+}
+
+static inline celt_uint32 word32_bits(celt_word32 x)
+{
+#ifdef FIXED_POINT
+   return (celt_uint32)x;
+#else
+   union {float f; celt_uint32 i;} u;
+   u.f = x;
+   return u.i;
+#endif
+}
+
+static inline celt_word32 bits_word32(celt_uint32 x)
+{
+#ifdef FIXED_POINT
+   return (celt_int32)x;
+#else
+   union {float f; celt_uint32 i;} u;
+   u.i = x;
+   return u.f;
+#endif
+}
+
+/* celt_word16 is stored on a whole word, like celt_word32 */
+static inline celt_uint32 word16_bits(celt_word16 x)
+{
+#ifdef FIXED_POINT
+   return (celt_uint32)(celt_int32)x;
+#else
+   return word32_bits(x);
+#endif
+}
+
+static inline celt_word16 bits_word16(celt_uint32 x)
+{
+#ifdef FIXED_POINT
+   return (celt_word16)(celt_int32)x;
+#else
+   return bits_word32(x);
+#endif
+}
+
+static void snapshot_put_words32(Snapshot *s, const celt_word32 *x, int n)
+{
+   int i, z;
+   /* Compare the bits, -0 must stay -0 */
+   for (z=0;z<n && word32_bits(x[z])==0;z++);
+   snapshot_put(s, z);
+   for (i=z;i<n;i++)
+      snapshot_put(s, word32_bits(x[i]));
+}
+
+static void snapshot_get_words32(Snapshot *s, celt_word32 *x, int n)
+{
+   int i;
+   celt_uint32 z = snapshot_get(s);
+   if (z > (celt_uint32)n)
+   {
+      s->error = 1;
+      return;
+   }
+   for (i=0;i<(int)z;i++)
+      x[i] = 0;
+   for (;i<n;i++)
+      x[i] = bits_word32(snapshot_get(s));
+}
+
+static void snapshot_put_words16(Snapshot *s, const celt_word16 *x, int n)
+{
+   int i, z;
+   for (z=0;z<n && word16_bits(x[z])==0;z++);
+   snapshot_put(s, z);
+   for (i=z;i<n;i++)
+      snapshot_put(s, word16_bits(x[i]));
+}
+
+static void snapshot_get_words16(Snapshot *s, celt_word16 *x, int n)
+{
+   int i;
+   celt_uint32 z = snapshot_get(s);
+   if (z > (celt_uint32)n)
+   {
+      s->error = 1;
+      return;
+   }
+   for (i=0;i<(int)z;i++)
+      x[i] = 0;
+   for (;i<n;i++)
+      x[i] = bits_word16(snapshot_get(s));
+}
+
+/* Identifies the kind of state, the mode and the number of channels */
+static void snapshot_put_header(Snapshot *s, const CELTMode *mode, int channels, int decoder)
+{
+   snapshot_put(s, SNAPSHOT_MAGIC);
+   snapshot_put(s, SNAPSHOT_VERSION<<16 | decoder<<8 | SNAPSHOT_BUILD);
+   snapshot_put(s, mode->Fs);
+   snapshot_put(s, mode->shortMdctSize<<8 | mode->maxLM);
+   snapshot_put(s, mode->nbEBands<<16 | mode->overlap);
+   snapshot_put(s, channels);
+}
+
+static int snapshot_check_header(Snapshot *s, const CELTMode *mode, int channels, int decoder)
+{
+   celt_uint32 version;
+   if (snapshot_get(s)!=SNAPSHOT_MAGIC)
+      return CELT_CORRUPTED_DATA;
+   version = snapshot_get(s);
+   if (version>>8 != (celt_uint32)(SNAPSHOT_VERSION<<8 | decoder))
+      return CELT_CORRUPTED_DATA;
+   /* A valid snapshot, but for a different build or mode */
+   if ((version&0xFF)!=SNAPSHOT_BUILD
+         || snapshot_get(s)!=(celt_uint32)mode->Fs
+         || snapshot_get(s)!=(celt_uint32)(mode->shortMdctSize<<8 | mode->maxLM)
+         || snapshot_get(s)!=(celt_uint32)(mode->nbEBands<<16 | mode->overlap)
+         || snapshot_get(s)!=(celt_uint32)channels)
+      return CELT_BAD_ARG;
+   return s->error ? CELT_CORRUPTED_DATA : CELT_OK;
+}
+
+int celt_encoder_snapshot(const CELTEncoder * restrict st, unsigned char *data, int maxBytes)
+{
+   int i;
+   Snapshot s;
+   const int CC = CHANNELS(st->channels);
+   const celt_sig *prefilter_mem = st->in_mem+CC*st->overlap;
+   const celt_word16 *oldBandE = (const celt_word16*)(prefilter_mem+CC*(st->overlap+PREFILTER_HISTORY(st->mode)));
+
+   s.data = data;
+   s.len = maxBytes;
+   s.pos = 0;
+   s.error = 0;
+   snapshot_put_header(&s, st->mode, CC, 0);
+
+   /* Settings */
+   snapshot_put(&s, st->stream_channels);
+   snapshot_put(&s, st->force_intra);
+   snapshot_put(&s, st->clip);
+   snapshot_put(&s, st->disable_pf);
+   snapshot_put(&s, st->complexity);
+   snapshot_put(&s, st->upsample);
+   snapshot_put(&s, st->start);
+   snapshot_put(&s, st->end);
+   snapshot_put(&s, st->bitrate);
+   snapshot_put(&s, st->vbr);
+   snapshot_put(&s, st->signalling);
+   snapshot_put(&s, st->constrained_vbr);
+   snapshot_put(&s, st->loss_rate);
+   snapshot_put(&s, st->fec);
+
+   /* Analysis and rate control state */
+   snapshot_put(&s, st->rng);
+   snapshot_put(&s, st->spread_decision);
+   snapshot_put(&s, word32_bits(st->delayedIntra));
+   snapshot_put(&s, st->tonal_average);
+   snapshot_put(&s, st->lastCodedBands);
+   snapshot_put(&s, st->hf_average);
+   snapshot_put(&s, st->tapset_decision);
+   snapshot_put(&s, st->prefilter_period);
+   snapshot_put(&s, word16_bits(st->prefilter_gain));
+   snapshot_put(&s, st->prefilter_tapset);
+#ifdef RESYNTH
+   snapshot_put(&s, st->prefilter_period_old);
+   snapshot_put(&s, word16_bits(st->prefilter_gain_old));
+   snapshot_put(&s, st->prefilter_tapset_old);
+#endif
+   snapshot_put(&s, st->consec_transient);
+   snapshot_put(&s, st->vbr_reservoir);
+   snapshot_put(&s, st->vbr_drift);
+   snapshot_put(&s, st->vbr_offset);
+   snapshot_put(&s, st->vbr_count);
+   snapshot_put(&s, st->fec_len);
+   for (i=0;i<st->fec_len;i+=4)
+   {
+      int j;
+      celt_uint32 x = 0;
+      for (j=IMIN(i+4,st->fec_len)-1;j>=i;j--)
+         x = x<<8 | st->fec_buf[j];
+      snapshot_put(&s, x);
+   }
+   snapshot_put_words32(&s, st->preemph_memE, 2);
+   snapshot_put_words32(&s, st->preemph_memD, 2);
+
+   /* Histories */
+   snapshot_put_words32(&s, st->in_mem, CC*st->overlap);
+#ifdef ENABLE_POSTFILTER
+   /* Only the window the prefilter will look at */
+   for (i=0;i<CC;i++)
+      snapshot_put_words32(&s, prefilter_mem+i*PREFILTER_HISTORY(st->mode)+st->prefilter_pos,
+            COMBFILTER_MAXPERIOD);
+#endif
+#ifdef RESYNTH
+   for (i=0;i<CC;i++)
+      snapshot_put_words32(&s, st->syn_mem[i], 2*MAX_PERIOD);
+   snapshot_put_words32(&s, prefilter_mem+CC*PREFILTER_HISTORY(st->mode), CC*st->overlap);
+#endif
+   snapshot_put_words16(&s, oldBandE, 3*CC*st->mode->nbEBands);
+
+   if (s.error)
+      return CELT_BUFFER_TOO_SMALL;
+   return s.pos;
+}
+
+int celt_encoder_restore(CELTEncoder * restrict st, const unsigned char *data, int len)
+{
+   int i, ret, size;
+   Snapshot s;
+   const int CC = CHANNELS(st->channels);
+   celt_sig *prefilter_mem = st->in_mem+CC*st->overlap;
+   celt_word16 *oldBandE = (celt_word16*)(prefilter_mem+CC*(st->overlap+PREFILTER_HISTORY(st->mode)));
+   VARDECL(unsigned char, saved);
+   ALLOC_STACK;
+
+   if (data==NULL || len<0)
+   {
+      RESTORE_STACK;
+      return CELT_BAD_ARG;
+   }
+   s.data = (unsigned char*)data;
+   s.len = len;
+   s.pos = 0;
+   s.error = 0;
+   ret = snapshot_check_header(&s, st->mode, CC, 0);
+   if (ret!=CELT_OK)
+   {
+      RESTORE_STACK;
+      return ret;
+   }
+   /* The state is left untouched if the snapshot turns out to be bad */
+   size = celt_encoder_get_size_custom(st->mode, st->channels);
+   ALLOC(saved, size, unsigned char);
+   CELT_COPY(saved, (unsigned char*)st, size);
+
+   st->stream_channels = snapshot_get(&s);
+   st->force_intra = snapshot_get(&s);
+   st->clip = snapshot_get(&s);
+   st->disable_pf = snapshot_get(&s);
+   st->complexity = snapshot_get(&s);
+   st->upsample = snapshot_get(&s);
+   st->start = snapshot_get(&s);
+   st->end = snapshot_get(&s);
+   st->bitrate = snapshot_get(&s);
+   st->vbr = snapshot_get(&s);
+   st->signalling = snapshot_get(&s);
+   st->constrained_vbr = snapshot_get(&s);
+   st->loss_rate = snapshot_get(&s);
+   st->fec = snapshot_get(&s);
+
+   st->rng = snapshot_get(&s);
+   st->spread_decision = snapshot_get(&s);
+   st->delayedIntra = bits_word32(snapshot_get(&s));
+   st->tonal_average = snapshot_get(&s);
+   st->lastCodedBands = snapshot_get(&s);
+   st->hf_average = snapshot_get(&s);
+   st->tapset_decision = snapshot_get(&s);
+   st->prefilter_period = snapshot_get(&s);
+   st->prefilter_gain = bits_word16(snapshot_get(&s));
+   st->prefilter_tapset = snapshot_get(&s);
+#ifdef RESYNTH
+   st->prefilter_period_old = snapshot_get(&s);
+   st->prefilter_gain_old = bits_word16(snapshot_get(&s));
+   st->prefilter_tapset_old = snapshot_get(&s);
+#endif
+   st->consec_transient = snapshot_get(&s);
+   st->vbr_reservoir = snapshot_get(&s);
+   st->vbr_drift = snapshot_get(&s);
+   st->vbr_offset = snapshot_get(&s);
+   st->vbr_count = snapshot_get(&s);
+   st->fec_len = snapshot_get(&s);
+   if (st->fec_len<0 || st->fec_len>255)
+      s.error = 1;
+   for (i=0;!s.error && i<st->fec_len;i+=4)
+   {
+      int j;
+      celt_uint32 x = snapshot_get(&s);
+      for (j=i;j<IMIN(i+4,st->fec_len);j++)
+      {
+         st->fec_buf[j] = x&0xFF;
+         x >>= 8;
+      }
+   }
+   snapshot_get_words32(&s, st->preemph_memE, 2);
+   snapshot_get_words32(&s, st->preemph_memD, 2);
+
+   snapshot_get_words32(&s, st->in_mem, CC*st->overlap);
+#ifdef ENABLE_POSTFILTER
+   st->prefilter_pos = 0;
+   for (i=0;i<CC;i++)
+      snapshot_get_words32(&s, prefilter_mem+i*PREFILTER_HISTORY(st->mode), COMBFILTER_MAXPERIOD);
+#endif
+#ifdef RESYNTH
+   for (i=0;i<CC;i++)
+      snapshot_get_words32(&s, st->syn_mem[i], 2*MAX_PERIOD);
+   snapshot_get_words32(&s, prefilter_mem+CC*PREFILTER_HISTORY(st->mode), CC*st->overlap);
+#endif
+   snapshot_get_words16(&s, oldBandE, 3*CC*st->mode->nbEBands);
+
+   /* Anything used as an index has to be in range */
+   if (s.error || s.pos!=len
+         || st->stream_channels<1 || st->stream_channels>2
+         || st->upsample<1 || st->upsample>6
+         || st->complexity<0 || st->complexity>10
+         || st->start<0 || st->start>=st->end || st->end>st->mode->nbEBands
+         || st->spread_decision<0 || st->spread_decision>3
+         || st->tapset_decision<0 || st->tapset_decision>2
+         || st->prefilter_tapset<0 || st->prefilter_tapset>2
+         || st->prefilter_period<0 || st->prefilter_period>COMBFILTER_MAXPERIOD
+         || st->lastCodedBands<0 || st->lastCodedBands>st->mode->nbEBands)
+   {
+      CELT_COPY((unsigned char*)st, saved, size);
+      ret = CELT_CORRUPTED_DATA;
+   }
+   RESTORE_STACK;
+   return ret;
+}
+
+int celt_encoder_ctl(CELTEncoder * restrict st, int request, ...)
+{
+   va_list ap;
+   
+   va_start(ap, request);
+   switch (request)
+   {
+      case CELT_SET_COMPLEXITY_REQUEST:
+      {
+         int value = va_arg(ap, celt_int32);
+         if (value<0 || value>10)
+            goto bad_arg;
+         st->complexity = value;
+      }
+      break;
+      case CELT_SET_START_BAND_REQUEST:
+      {
+         celt_int32 value = va_arg(ap, celt_int32);
          if (value<0 || value>=st->mode->nbEBands)
             goto bad_arg;
          st->start = value;
@@ -1802,6 +2813,15 @@ int celt_encoder_ctl(CELTEncoder * restrict st, int request, ...)
          st->loss_rate = value;
       }
       break;
+      case CELT_SET_FEC_REQUEST:
+      {
+         int value = va_arg(ap, celt_int32);
+         if (value<0 || value>100)
+            goto bad_arg;
+         st->fec = value;
+         st->fec_len = 0;
+      }
+      break;
       case CELT_SET_VBR_CONSTRAINT_REQUEST:
       {
          celt_int32 value = va_arg(ap, celt_int32);
@@ -1831,6 +2851,22 @@ int celt_encoder_ctl(CELTEncoder * restrict st, int request, ...)
          st->stream_channels = value;
       }
       break;
+      case CELT_GET_ALLOC_CACHE_HITS_REQUEST:
+      {
+         celt_uint32 *value = va_arg(ap, celt_uint32*);
+         if (value==NULL)
+            goto bad_arg;
+         *value = st->alloc_cache.hits;
+      }
+      break;
+      case CELT_GET_ALLOC_CACHE_LOOKUPS_REQUEST:
+      {
+         celt_uint32 *value = va_arg(ap, celt_uint32*);
+         if (value==NULL)
+            goto bad_arg;
+         *value = st->alloc_cache.lookups;
+      }
+      break;
       case CELT_RESET_STATE:
       {
          CELT_MEMSET((char*)&st->ENCODER_RESET_START, 0,
@@ -1884,6 +2920,16 @@ bad_request:
 /**********************************************************************/
 #define DECODE_BUFFER_SIZE 2048
 
+/* Number of blocks (of shortMdctSize samples) in the LPC analysis window
+   when the PLC analysis is tracked */
+#define PLC_TRACK_BLOCKS 8
+
+#ifdef FIXED_POINT
+#define PLC_AC_MULT(a,b) SHR32(MULT16_16(a,b),9)
+#else
+#define PLC_AC_MULT(a,b) MULT16_16(a,b)
+#endif
+
 /** Decoder state 
  @brief Decoder state
  */
@@ -1896,6 +2942,12 @@ struct CELTDecoder {
    int downsample;
    int start, end;
    int signalling;
+   int fec;
+   int plc_tracking;
+   int plc_state;            /* The PLC tracking state is allocated */
+   int history;              /* Samples of history kept (0 or MAX_PERIOD) */
+   int decode_size;          /* Per-channel size of the history buffer */
+   int has_alloc_cache;      /* An AllocCache ends the state */
 
    /* Everything beyond this point gets cleared on a reset */
 #define DECODER_RESET_START rng
@@ -1911,14 +2963,26 @@ struct CELTDecoder {
    int postfilter_tapset;
    int postfilter_tapset_old;
 
+   /* PLC analysis state, valid once plc_valid reaches MAX_PERIOD */
+   int plc_valid;
+   int plc_ac_pos;
+
    celt_sig preemph_memD[2];
+   int decode_pos;           /* Start of the current history window */
+   int channels_differ;      /* The two channels may not have the same history */
    
-   celt_sig _decode_mem[1]; /* Size = channels*(DECODE_BUFFER_SIZE+mode->overlap) */
+   celt_sig _decode_mem[1]; /* Size = channels*(decode_size+mode->overlap) */
+   /* celt_sig overlap_mem[], Size = channels*mode->overlap */
    /* celt_word16 lpc[],  Size = channels*LPC_ORDER */
    /* celt_word16 oldEBands[], Size = 2*mode->nbEBands */
    /* celt_word16 oldLogE[], Size = 2*mode->nbEBands */
    /* celt_word16 oldLogE2[], Size = 2*mode->nbEBands */
    /* celt_word16 backgroundLogE[], Size = 2*mode->nbEBands */
+   /* Only with plc_state: */
+   /* celt_word32 plc_ac[], Size = channels*PLC_TRACK_BLOCKS*(LPC_ORDER+1) */
+   /* celt_word16 plc_pitch_buf[], Size = MAX_PERIOD>>1 */
+   /* Only with has_alloc_cache, fully keyed so it's kept on a reset: */
+   /* AllocCache alloc_cache */
 };
 
 int old_celt_decoder_get_size(int channels)
@@ -1927,15 +2991,55 @@ int old_celt_decoder_get_size(int channels)
    return celt_decoder_get_size_custom(mode, channels);
 }
 
-int celt_decoder_get_size_custom(const CELTMode *mode, int channels)
+static int decoder_size(const CELTMode *mode, int channels, int decode_size, int plc_state, int alloc_cache)
 {
    int size = sizeof(struct CELTDecoder)
-            + (channels*(DECODE_BUFFER_SIZE+mode->overlap)-1)*sizeof(celt_sig)
+            + (channels*(decode_size+2*mode->overlap)-1)*sizeof(celt_sig)
             + channels*LPC_ORDER*sizeof(celt_word16)
             + 4*2*mode->nbEBands*sizeof(celt_word16);
+   if (plc_state)
+      size += channels*PLC_TRACK_BLOCKS*(LPC_ORDER+1)*sizeof(celt_word32)
+            + (MAX_PERIOD>>1)*sizeof(celt_word16);
+   if (alloc_cache)
+      size += sizeof(AllocCache);
    return size;
 }
 
+int celt_decoder_get_size_custom(const CELTMode *mode, int channels)
+{
+   return decoder_size(mode, channels, DECODE_BUFFER_SIZE, 0, 1);
+}
+
+/* History kept by a decoder made with celt_decoder_init_history(). The
+   postfilter looks up to COMBFILTER_MAXPERIOD samples back. */
+static int plc_history(int plc)
+{
+#ifdef ENABLE_POSTFILTER
+   (void)plc;
+   return MAX_PERIOD;
+#else
+   return plc ? MAX_PERIOD : 0;
+#endif
+}
+
+static int valid_frame_size(const CELTMode *mode, int frame_size)
+{
+   int LM;
+   for (LM=0;LM<=mode->maxLM;LM++)
+      if (mode->shortMdctSize<<LM==frame_size)
+         return 1;
+   return 0;
+}
+
+int celt_decoder_get_size_history(const CELTMode *mode, int channels, int max_frame_size, int plc)
+{
+   if (!valid_frame_size(mode, max_frame_size) || plc<0 || plc>2)
+      return CELT_BAD_ARG;
+   /* The history slides along the buffer, which is only moved back to the
+      start when it's full. A smaller buffer means it's moved more often. */
+   return decoder_size(mode, channels, plc_history(plc)+max_frame_size, plc==2, 0);
+}
+
 CELTDecoder *celt_decoder_create(int sampling_rate, int channels, int *error)
 {
    CELTDecoder *st;
@@ -1972,27 +3076,68 @@ CELTDecoder *old_celt_decoder_init(CELTDecoder *st, int sampling_rate, int chann
    return st;
 }
 
-CELTDecoder *celt_decoder_init_custom(CELTDecoder *st, const CELTMode *mode, int channels, int *error)
+CELTDecoder *celt_decoder_create_history(const CELTMode *mode, int channels, int max_frame_size, int plc, int *error)
 {
-   if (channels < 0 || channels > 2)
+   CELTDecoder *st;
+   int size = celt_decoder_get_size_history(mode, channels, max_frame_size, plc);
+   if (size<0)
    {
       if (error)
-         *error = CELT_BAD_ARG;
+         *error = size;
       return NULL;
    }
-
-   if (st==NULL)
+   st = (CELTDecoder *)celt_alloc(size);
+   if (st!=NULL && celt_decoder_init_history(st, mode, channels, max_frame_size, plc, error)==NULL)
    {
-      if (error)
-         *error = CELT_ALLOC_FAIL;
-      return NULL;
+      celt_decoder_destroy(st);
+      st = NULL;
    }
+   return st;
+}
 
-   CELT_MEMSET((char*)st, 0, celt_decoder_get_size_custom(mode, channels));
+static CELTDecoder *decoder_init(CELTDecoder *st, const CELTMode *mode, int channels, int history, int decode_size, int plc_state, int alloc_cache, int *error);
 
-   st->mode = mode;
-   st->overlap = mode->overlap;
-   st->stream_channels = st->channels = channels;
+CELTDecoder *celt_decoder_init_custom(CELTDecoder *st, const CELTMode *mode, int channels, int *error)
+{
+   return decoder_init(st, mode, channels, MAX_PERIOD, DECODE_BUFFER_SIZE, 0, 1, error);
+}
+
+CELTDecoder *celt_decoder_init_history(CELTDecoder *st, const CELTMode *mode, int channels, int max_frame_size, int plc, int *error)
+{
+   if (mode==NULL || !valid_frame_size(mode, max_frame_size) || plc<0 || plc>2)
+   {
+      if (error)
+         *error = CELT_BAD_ARG;
+      return NULL;
+   }
+   return decoder_init(st, mode, channels, plc_history(plc), plc_history(plc)+max_frame_size, plc==2, 0, error);
+}
+
+static CELTDecoder *decoder_init(CELTDecoder *st, const CELTMode *mode, int channels, int history, int decode_size, int plc_state, int alloc_cache, int *error)
+{
+   if (channels < 0 || channels > 2)
+   {
+      if (error)
+         *error = CELT_BAD_ARG;
+      return NULL;
+   }
+
+   if (st==NULL)
+   {
+      if (error)
+         *error = CELT_ALLOC_FAIL;
+      return NULL;
+   }
+
+   CELT_MEMSET((char*)st, 0, decoder_size(mode, channels, decode_size, plc_state, alloc_cache));
+
+   st->mode = mode;
+   st->overlap = mode->overlap;
+   st->stream_channels = st->channels = channels;
+   st->history = history;
+   st->decode_size = decode_size;
+   st->plc_state = plc_state;
+   st->has_alloc_cache = alloc_cache;
 
    st->downsample = 1;
    st->start = 0;
@@ -2011,7 +3156,148 @@ void celt_decoder_destroy(CELTDecoder *st)
    celt_free(st);
 }
 
-static void celt_decode_lost(CELTDecoder * restrict st, celt_word16 * restrict pcm, int N, int LM)
+/* Makes room for n new samples after the st->history samples of history and
+   returns where that history starts for each channel. Each channel's buffer
+   has room for st->decode_size samples plus the overlap, which the PLC
+   uses as scratch. The history slides along the buffer and is only moved
+   back to the start once it reaches the end. */
+static void decoder_history(CELTDecoder * restrict st, celt_sig *out_mem[], celt_sig *overlap_mem[], int n)
+{
+   int c;
+   const int C = CHANNELS(st->channels);
+   const int size = st->decode_size+st->overlap;
+   if (st->decode_pos+st->history+n > st->decode_size)
+   {
+      c=0; do {
+         CELT_MOVE(st->_decode_mem+c*size, st->_decode_mem+c*size+st->decode_pos, st->history);
+      } while (++c<C);
+      st->decode_pos = 0;
+   }
+   c=0; do {
+      out_mem[c] = st->_decode_mem+c*size+st->decode_pos;
+      overlap_mem[c] = st->_decode_mem+C*size+c*st->overlap;
+   } while (++c<C);
+}
+
+/* Checks whether both channels have the same synthesis state, in which
+   case the same decoded signal gives the same output on both. This is only
+   needed when the state comes from a snapshot: otherwise channels_differ
+   keeps track of it. */
+static int channels_match(const CELTDecoder *st, celt_sig *out_mem[], celt_sig *overlap_mem[])
+{
+   return memcmp(out_mem[0], out_mem[1], st->history*sizeof(celt_sig))==0
+       && memcmp(overlap_mem[0], overlap_mem[1], st->overlap*sizeof(celt_sig))==0
+       && memcmp(&st->preemph_memD[0], &st->preemph_memD[1], sizeof(celt_sig))==0;
+}
+
+static int plc_track_blocks(const CELTMode *mode)
+{
+   return IMIN(PLC_TRACK_BLOCKS, (MAX_PERIOD-LPC_ORDER)/mode->shortMdctSize);
+}
+
+/* Autocorrelation of block b of channel c, in the PLC tracking state after
+   the energies */
+static celt_word32 *plc_ac(const CELTDecoder *st, int c, int b)
+{
+   celt_word16 *backgroundLogE_end = (celt_word16*)(st->_decode_mem+(st->decode_size+2*st->overlap)*st->channels)
+         + st->channels*LPC_ORDER + 4*2*st->mode->nbEBands;
+   return (celt_word32*)backgroundLogE_end + (c*PLC_TRACK_BLOCKS+b)*(LPC_ORDER+1);
+}
+
+static celt_word16 *plc_pitch_buf(const CELTDecoder *st)
+{
+   return (celt_word16*)plc_ac(st, st->channels, 0);
+}
+
+/* The allocation cache, or NULL for decoders that don't keep one */
+static AllocCache *decoder_alloc_cache(const CELTDecoder *st)
+{
+   if (!st->has_alloc_cache)
+      return NULL;
+   if (st->plc_state)
+      return (AllocCache*)(plc_pitch_buf(st)+(MAX_PERIOD>>1));
+   return (AllocCache*)plc_ac(st, 0, 0);
+}
+
+/* Updates the decimated pitch buffer and the per-block autocorrelation of
+   the history after n new samples were appended to out_mem */
+static void plc_track(CELTDecoder * restrict st, celt_sig *out_mem[], int n, int C)
+{
+   int c, i, k, b;
+   const int B = st->mode->shortMdctSize;
+   const int nbBlocks = plc_track_blocks(st->mode);
+   const int n2 = IMIN(n, MAX_PERIOD)>>1;
+   celt_word16 *x_lp = plc_pitch_buf(st);
+   VARDECL(celt_word16, x);
+   SAVE_STACK;
+
+   if (nbBlocks<=0)
+   {
+      RESTORE_STACK;
+      return;
+   }
+   /* Same 2:1 decimation as celtpitch_downsample(), for the new samples only */
+   for (i=0;i<(MAX_PERIOD>>1)-n2;i++)
+      x_lp[i] = x_lp[i+n2];
+   for (;i<MAX_PERIOD>>1;i++)
+   {
+      x_lp[i] = SHR32(HALF32(HALF32(out_mem[0][2*i-1]+out_mem[0][2*i+1])+out_mem[0][2*i]), SIG_SHIFT+3);
+      if (C==2)
+         x_lp[i] += SHR32(HALF32(HALF32(out_mem[1][2*i-1]+out_mem[1][2*i+1])+out_mem[1][2*i]), SIG_SHIFT+3);
+   }
+
+   ALLOC(x, B+LPC_ORDER, celt_word16);
+   for (b=IMIN(n/B, nbBlocks);b>0;b--)
+   {
+      int start = MAX_PERIOD-b*B;
+      c=0; do {
+         celt_word32 *ac = plc_ac(st, c, st->plc_ac_pos);
+         for (i=0;i<B+LPC_ORDER;i++)
+            x[i] = ROUND16(out_mem[c][start-LPC_ORDER+i], SIG_SHIFT);
+         for (k=0;k<=LPC_ORDER;k++)
+         {
+            celt_word32 sum = 0;
+            for (i=LPC_ORDER;i<B+LPC_ORDER;i++)
+               sum += PLC_AC_MULT(x[i], x[i-k]);
+            ac[k] = sum;
+         }
+      } while (++c<C);
+      st->plc_ac_pos++;
+      if (st->plc_ac_pos>=nbBlocks)
+         st->plc_ac_pos = 0;
+   }
+   st->plc_valid = IMIN(MAX_PERIOD, st->plc_valid+n);
+   RESTORE_STACK;
+}
+
+/* Autocorrelation of the last nbBlocks*shortMdctSize samples of exc, from
+   the blocks accumulated by plc_track() */
+static void plc_tracked_autocorr(const CELTDecoder * restrict st, const celt_word16 *exc, int c, celt_word32 *ac)
+{
+   int i, k, b;
+   const int nbBlocks = plc_track_blocks(st->mode);
+   const int start = MAX_PERIOD-nbBlocks*st->mode->shortMdctSize;
+   for (k=0;k<=LPC_ORDER;k++)
+   {
+      celt_word32 sum = 0;
+      for (b=0;b<nbBlocks;b++)
+         sum += plc_ac(st, c, b)[k];
+      /* Remove the products that reach back before the window */
+      for (i=start;i<start+k;i++)
+         sum -= PLC_AC_MULT(exc[i], exc[i-k]);
+      ac[k] = sum;
+   }
+   ac[0] += 10;
+#ifdef FIXED_POINT
+   {
+      int shift = celt_ilog2(ac[0])-29;
+      for (k=0;k<=LPC_ORDER;k++)
+         ac[k] = VSHR32(ac[k], shift);
+   }
+#endif
+}
+
+static void celt_decode_lost(CELTDecoder * restrict st, const CELTOutput *out, int N, int LM)
 {
    int c;
    int pitch_index;
@@ -2021,31 +3307,30 @@ static void celt_decode_lost(CELTDecoder * restrict st, celt_word16 * restrict p
    const int C = CHANNELS(st->channels);
    int offset;
    celt_sig *out_mem[2];
-   celt_sig *decode_mem[2];
    celt_sig *overlap_mem[2];
    celt_word16 *lpc;
    celt_word32 *out_syn[2];
    celt_word16 *oldBandE, *oldLogE2, *backgroundLogE;
    int plc=1;
+   int tracked;
    SAVE_STACK;
+
+   tracked = st->plc_tracking && st->plc_valid>=MAX_PERIOD;
    
-   c=0; do {
-      decode_mem[c] = st->_decode_mem + c*(DECODE_BUFFER_SIZE+st->overlap);
-      out_mem[c] = decode_mem[c]+DECODE_BUFFER_SIZE-MAX_PERIOD;
-      overlap_mem[c] = decode_mem[c]+DECODE_BUFFER_SIZE;
-   } while (++c<C);
-   lpc = (celt_word16*)(st->_decode_mem+(DECODE_BUFFER_SIZE+st->overlap)*C);
+   decoder_history(st, out_mem, overlap_mem, N);
+   lpc = (celt_word16*)(st->_decode_mem+(st->decode_size+2*st->overlap)*C);
    oldBandE = lpc+C*LPC_ORDER;
    oldLogE2 = oldBandE + C*st->mode->nbEBands;
    backgroundLogE = oldLogE2  + C*st->mode->nbEBands;
 
-   out_syn[0] = out_mem[0]+MAX_PERIOD-N;
+   /* Without a history, there's only room for the noise fill */
+   out_syn[0] = out_mem[0]+IMAX(0, st->history-N);
    if (C==2)
-      out_syn[1] = out_mem[1]+MAX_PERIOD-N;
+      out_syn[1] = out_mem[1]+IMAX(0, st->history-N);
 
    len = N+st->mode->overlap;
    
-   if (st->loss_count >= 5)
+   if (st->loss_count >= 5 || st->history==0)
    {
       VARDECL(celt_sig, freq);
       VARDECL(celt_norm, X);
@@ -2101,6 +3386,9 @@ static void celt_decode_lost(CELTDecoder * restrict st, celt_word16 * restrict p
             freq[c*N+i] = 0;
       } while (++c<C);
       compute_inv_mdcts(st->mode, 0, freq, out_syn, overlap_mem, C, LM);
+      /* Each channel got its own noise */
+      if (C==2)
+         st->channels_differ = 1;
       plc = 0;
    } else if (st->loss_count == 0)
    {
@@ -2109,7 +3397,13 @@ static void celt_decode_lost(CELTDecoder * restrict st, celt_word16 * restrict p
       /* FIXME: This is a kludge */
       if (len2>MAX_PERIOD>>1)
          len2 = MAX_PERIOD>>1;
-      celtpitch_downsample(out_mem, pitch_buf, MAX_PERIOD, C);
+      if (tracked)
+      {
+         CELT_COPY(pitch_buf, plc_pitch_buf(st), MAX_PERIOD>>1);
+         celtpitch_whiten(pitch_buf, MAX_PERIOD>>1);
+      } else {
+         celtpitch_downsample(out_mem, pitch_buf, MAX_PERIOD, C);
+      }
       celtpitch_search(pitch_buf+((MAX_PERIOD-len2)>>1), pitch_buf, len2,
                    MAX_PERIOD-len2-100, &pitch_index);
       pitch_index = MAX_PERIOD-len2-pitch_index;
@@ -2122,6 +3416,8 @@ static void celt_decode_lost(CELTDecoder * restrict st, celt_word16 * restrict p
    if (plc)
    {
       c=0; do {
+         /* The history once the concealed frame is appended */
+         celt_sig *hist = out_mem[c]+N;
          /* FIXME: This is more memory than necessary */
          celt_word32 e[2*MAX_PERIOD];
          celt_word16 exc[2*MAX_PERIOD];
@@ -2136,8 +3432,11 @@ static void celt_decode_lost(CELTDecoder * restrict st, celt_word16 * restrict p
 
          if (st->loss_count == 0)
          {
-            _old_celt_autocorr(exc, ac, st->mode->window, st->mode->overlap,
-                  LPC_ORDER, MAX_PERIOD);
+            if (tracked)
+               plc_tracked_autocorr(st, exc, c, ac);
+            else
+               _old_celt_autocorr(exc, ac, st->mode->window, st->mode->overlap,
+                     LPC_ORDER, MAX_PERIOD);
 
             /* Noise floor -40 dB */
 #ifdef FIXED_POINT
@@ -2224,58 +3523,137 @@ static void celt_decode_lost(CELTDecoder * restrict st, celt_word16 * restrict p
                }
          }
 
-#ifdef ENABLE_POSTFILTER
-         /* Apply post-filter to the MDCT overlap of the previous frame */
-         comb_filter(out_mem[c]+MAX_PERIOD, out_mem[c]+MAX_PERIOD, st->postfilter_period, st->postfilter_period, st->overlap,
-               st->postfilter_gain, st->postfilter_gain, st->postfilter_tapset, st->postfilter_tapset,
-               NULL, 0);
-#endif /* ENABLE_POSTFILTER */
-
-         for (i=0;i<MAX_PERIOD+st->mode->overlap-N;i++)
-            out_mem[c][i] = out_mem[c][N+i];
+         /* The concealed frame replaces the overlap of the previous frame,
+            so there is no need to post-filter that overlap */
 
          /* Apply TDAC to the concealed audio so that it blends with the
-         previous and next frames */
+         previous and next frames. The room after the history is used as
+         scratch so the pre-filter below can see the history. */
          for (i=0;i<overlap/2;i++)
          {
             celt_word32 tmp;
             tmp = MULT16_32_Q15(st->mode->window[i],           e[N+overlap-1-i]) +
                   MULT16_32_Q15(st->mode->window[overlap-i-1], e[N+i          ]);
-            out_mem[c][MAX_PERIOD+i] = MULT16_32_Q15(st->mode->window[overlap-i-1], tmp);
-            out_mem[c][MAX_PERIOD+overlap-i-1] = MULT16_32_Q15(st->mode->window[i], tmp);
+            hist[MAX_PERIOD+i] = MULT16_32_Q15(st->mode->window[overlap-i-1], tmp);
+            hist[MAX_PERIOD+overlap-i-1] = MULT16_32_Q15(st->mode->window[i], tmp);
          }
          for (i=0;i<N;i++)
-            out_mem[c][MAX_PERIOD-N+i] = e[i];
+            hist[MAX_PERIOD-N+i] = e[i];
 
 #ifdef ENABLE_POSTFILTER
          /* Apply pre-filter to the MDCT overlap for the next frame (post-filter will be applied then) */
-         comb_filter(e, out_mem[c]+MAX_PERIOD, st->postfilter_period, st->postfilter_period, st->overlap,
+         comb_filter(e, hist+MAX_PERIOD, st->postfilter_period, st->postfilter_period, st->overlap,
                -st->postfilter_gain, -st->postfilter_gain, st->postfilter_tapset, st->postfilter_tapset,
                NULL, 0);
 #endif /* ENABLE_POSTFILTER */
          for (i=0;i<overlap;i++)
-            out_mem[c][MAX_PERIOD+i] = e[i];
+            overlap_mem[c][i] = e[i];
+      } while (++c<C);
+      st->decode_pos += N;
+      c=0; do {
+         out_mem[c] += N;
+         out_syn[c] = out_mem[c]+MAX_PERIOD-N;
       } while (++c<C);
+      if (st->plc_tracking)
+         plc_track(st, out_mem, N, C);
+   } else {
+      /* The history is not shifted for the noise fill */
+      st->plc_valid = 0;
    }
 
-   deemphasis(out_syn, pcm, N, C, st->downsample, st->mode->preemph, st->preemph_memD);
+   deemphasis(out_syn, out, N, C, C, st->downsample, st->mode->preemph, st->preemph_memD);
    
    st->loss_count++;
 
    RESTORE_STACK;
 }
 
-#ifdef FIXED_POINT
-CELT_STATIC
-int celt_decode_with_ec(CELTDecoder * restrict st, const unsigned char *data, int len, celt_int16 * restrict pcm, int frame_size, ec_dec *dec)
+/* Reads the header byte that starts each packet when signalling is on.
+   Returns it in the custom mode format, or an error. */
+static int decode_header(CELTDecoder * restrict st, int data0, int *LM, int *C)
 {
-#else
-CELT_STATIC
-int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *data, int len, celt_sig * restrict pcm, int frame_size, ec_dec *dec)
+   /* Convert Opus header to "standard mode" */
+   if (st->mode->Fs==48000 && st->mode->shortMdctSize==120)
+   {
+      data0 = fromOpus(data0);
+      if (data0<0)
+         return CELT_CORRUPTED_DATA;
+   }
+   st->end = IMAX(1, st->mode->effEBands-2*(data0>>5));
+   *LM = (data0>>3)&0x3;
+   *C = 1 + ((data0>>2)&0x1);
+   if (*LM>st->mode->maxLM)
+      return CELT_CORRUPTED_DATA;
+   return data0;
+}
+
+/* What celt_decode_frame() found in a packet, up to the band shapes, for
+   celt_transrate(). The arrays are provided by the caller. */
+typedef struct {
+   int LM;
+   int C;
+   int end;
+   int silence;
+   int postfilter_pitch;
+   celt_word16 postfilter_gain;
+   int postfilter_tapset;
+   int isTransient;
+   int tf_select;
+   int spread_decision;
+   int alloc_trim;
+   int intensity;
+   int dual_stereo;
+   int *tf_res;          /**< tf flags as coded, before the tf_select mapping */
+   int *offsets;         /**< dynalloc boosts, in 1/8 bits */
+   celt_norm *X;         /**< Normalised band shapes, C*N */
+   celt_ener *bandE;     /**< Decoded band energies, C*nbEBands */
+   celt_word16 *bandLogE;/**< Same, in the log domain */
+} CodedFrame;
+
+/* Updates the energy history used by the PLC and the anti-collapse once the
+   energies of a frame are known */
+static void update_energy_history(CELTDecoder * restrict st, int C, int M, int isTransient)
+{
+   int c, i;
+   celt_word16 *oldBandE, *oldLogE, *oldLogE2, *backgroundLogE;
+
+   oldBandE = (celt_word16*)(st->_decode_mem+(st->decode_size+2*st->overlap)*CHANNELS(st->channels))+LPC_ORDER;
+   oldLogE = oldBandE + 2*st->mode->nbEBands;
+   oldLogE2 = oldLogE + 2*st->mode->nbEBands;
+   backgroundLogE = oldLogE2  + 2*st->mode->nbEBands;
+
+   if (C==1) {
+      for (i=0;i<st->mode->nbEBands;i++)
+         oldBandE[st->mode->nbEBands+i]=oldBandE[i];
+   }
+
+   /* In case start or end were to change */
+   c=0; do
+   {
+      for (i=0;i<st->start;i++)
+         oldBandE[c*st->mode->nbEBands+i]=0;
+      for (i=st->end;i<st->mode->nbEBands;i++)
+         oldBandE[c*st->mode->nbEBands+i]=0;
+   } while (++c<2);
+   if (!isTransient)
+   {
+      for (i=0;i<2*st->mode->nbEBands;i++)
+         oldLogE2[i] = oldLogE[i];
+      for (i=0;i<2*st->mode->nbEBands;i++)
+         oldLogE[i] = oldBandE[i];
+      for (i=0;i<2*st->mode->nbEBands;i++)
+         backgroundLogE[i] = MIN16(backgroundLogE[i] + M*QCONST16(0.001f,DB_SHIFT), oldBandE[i]);
+   } else {
+      for (i=0;i<2*st->mode->nbEBands;i++)
+         oldLogE[i] = MIN16(oldLogE[i], oldBandE[i]);
+   }
+}
+
+static int celt_decode_frame(CELTDecoder * restrict st, const unsigned char *data, int len, const CELTOutput *out, int frame_size, ec_dec *dec, CodedFrame *coded)
 {
-#endif
    int c, i, N;
    int spread_decision;
+   int tf_select;
    celt_int32 bits;
    ec_dec _dec;
    VARDECL(celt_sig, freq);
@@ -2289,11 +3667,10 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
    VARDECL(int, tf_res);
    VARDECL(unsigned char, collapse_masks);
    celt_sig *out_mem[2];
-   celt_sig *decode_mem[2];
    celt_sig *overlap_mem[2];
    celt_sig *out_syn[2];
    celt_word16 *lpc;
-   celt_word16 *oldBandE, *oldLogE, *oldLogE2, *backgroundLogE;
+   celt_word16 *oldBandE, *oldLogE, *oldLogE2;
 
    int shortBlocks;
    int isTransient;
@@ -2315,39 +3692,24 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
    int anti_collapse_rsv;
    int anti_collapse_on=0;
    int silence;
+   int nsyn;
    int C = CHANNELS(st->stream_channels);
    ALLOC_STACK;
 
    frame_size *= st->downsample;
 
-   c=0; do {
-      decode_mem[c] = st->_decode_mem + c*(DECODE_BUFFER_SIZE+st->overlap);
-      out_mem[c] = decode_mem[c]+DECODE_BUFFER_SIZE-MAX_PERIOD;
-      overlap_mem[c] = decode_mem[c]+DECODE_BUFFER_SIZE;
-   } while (++c<CC);
-   lpc = (celt_word16*)(st->_decode_mem+(DECODE_BUFFER_SIZE+st->overlap)*CC);
+   lpc = (celt_word16*)(st->_decode_mem+(st->decode_size+2*st->overlap)*CC);
    oldBandE = lpc+LPC_ORDER;
    oldLogE = oldBandE + 2*st->mode->nbEBands;
    oldLogE2 = oldLogE + 2*st->mode->nbEBands;
-   backgroundLogE = oldLogE2  + 2*st->mode->nbEBands;
 
    if (st->signalling && data!=NULL)
    {
-      int data0=data[0];
-      /* Convert "standard mode" to Opus header */
-      if (st->mode->Fs==48000 && st->mode->shortMdctSize==120)
-      {
-         data0 = fromOpus(data0);
-         if (data0<0)
-            return CELT_CORRUPTED_DATA;
-      }
-      st->end = IMAX(1, st->mode->effEBands-2*(data0>>5));
-      LM = (data0>>3)&0x3;
-      C = 1 + ((data0>>2)&0x1);
+      int data0 = decode_header(st, data[0], &LM, &C);
+      if (data0<0)
+         return data0;
       data++;
       len--;
-      if (LM>st->mode->maxLM)
-         return CELT_CORRUPTED_DATA;
       if (frame_size < st->mode->shortMdctSize<<LM)
          return CELT_BUFFER_TOO_SMALL;
       else
@@ -2361,10 +3723,13 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
    }
    M=1<<LM;
 
-   if (len<0 || len>1275 || pcm==NULL)
+   if (len<0 || len>1275 || (out==NULL && coded==NULL))
       return CELT_BAD_ARG;
 
    N = M*st->mode->shortMdctSize;
+   /* The decoder may have been made for shorter frames */
+   if (N > st->decode_size-st->history)
+      return CELT_BUFFER_TOO_SMALL;
 
    effEnd = st->end;
    if (effEnd > st->mode->effEBands)
@@ -2384,7 +3749,12 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
 
    if (data == NULL || len<=1)
    {
-      celt_decode_lost(st, pcm, N, LM);
+      if (coded!=NULL)
+      {
+         RESTORE_STACK;
+         return CELT_BAD_ARG;
+      }
+      celt_decode_lost(st, out, N, LM);
       RESTORE_STACK;
       return frame_size/st->downsample;
    }
@@ -2418,6 +3788,14 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
       tell = len*8;
       dec->nbits_total+=tell-ec_tell(dec);
    }
+   if (st->fec && tell==1)
+   {
+      /* Skip the FEC copy of the previous frame */
+      int fec_len = ec_dec_bits(dec, 8);
+      for (i=0;i<fec_len;i++)
+         ec_dec_bits(dec, 8);
+      tell = ec_tell(dec);
+   }
 
    postfilter_gain = 0;
    postfilter_pitch = 0;
@@ -2462,7 +3840,8 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
          intra_ener, dec, C, LM);
 
    ALLOC(tf_res, st->mode->nbEBands, int);
-   tf_decode(st->start, st->end, isTransient, tf_res, LM, dec);
+   tf_select = tf_decode(st->start, st->end, isTransient, tf_res,
+         coded!=NULL ? coded->tf_res : NULL, LM, dec);
 
    tell = ec_tell(dec);
    spread_decision = SPREAD_NORMAL;
@@ -2514,7 +3893,7 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
    bits = ((celt_int32)len*8<<BITRES) - ec_tell_frac(dec) - 1;
    anti_collapse_rsv = isTransient&&LM>=2&&bits>=(LM+2<<BITRES) ? (1<<BITRES) : 0;
    bits -= anti_collapse_rsv;
-   codedBands = compute_allocation(st->mode, st->start, st->end, offsets, cap,
+   codedBands = compute_allocation(st->mode, decoder_alloc_cache(st), st->start, st->end, offsets, cap,
          alloc_trim, &intensity, &dual_stereo, bits, &balance, pulses,
          fine_quant, fine_priority, C, LM, dec, 0, 0);
    
@@ -2534,12 +3913,35 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
    celtunquant_energy_finalise(st->mode, st->start, st->end, oldBandE,
          fine_quant, fine_priority, len*8-ec_tell(dec), dec, C);
 
-   if (anti_collapse_on)
+   /* The anti-collapse noise is not part of what was coded */
+   if (anti_collapse_on && coded==NULL)
       celtanti_collapse(st->mode, X, collapse_masks, LM, C, C, N,
             st->start, st->end, oldBandE, oldLogE, oldLogE2, pulses, st->rng);
 
    log2Amp(st->mode, st->start, st->end, bandE, oldBandE, C);
 
+   if (coded!=NULL)
+   {
+      coded->LM = LM;
+      coded->C = C;
+      coded->end = st->end;
+      coded->silence = silence;
+      coded->postfilter_pitch = postfilter_pitch;
+      coded->postfilter_gain = postfilter_gain;
+      coded->postfilter_tapset = postfilter_tapset;
+      coded->isTransient = isTransient;
+      coded->tf_select = tf_select;
+      coded->spread_decision = spread_decision;
+      coded->alloc_trim = alloc_trim;
+      coded->intensity = intensity;
+      coded->dual_stereo = dual_stereo;
+      for (i=0;i<st->mode->nbEBands;i++)
+         coded->offsets[i] = offsets[i];
+      CELT_COPY(coded->X, X, C*N);
+      CELT_COPY(coded->bandE, bandE, C*st->mode->nbEBands);
+      CELT_COPY(coded->bandLogE, oldBandE, C*st->mode->nbEBands);
+   }
+
    if (silence)
    {
       for (i=0;i<C*st->mode->nbEBands;i++)
@@ -2548,12 +3950,23 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
          oldBandE[i] = -QCONST16(28.f,DB_SHIFT);
       }
    }
+
+   if (coded!=NULL)
+   {
+      /* Nothing to synthesise, only the energy prediction to keep going */
+      update_energy_history(st, C, M, isTransient);
+      st->rng = dec->rng;
+      RESTORE_STACK;
+      if (ec_tell(dec) > 8*len)
+         return CELT_INTERNAL_ERROR;
+      if(ec_get_error(dec))
+         st->error = 1;
+      return frame_size/st->downsample;
+   }
    /* Synthesis */
    celtdenormalise_bands(st->mode, X, freq, bandE, effEnd, C, M);
 
-   CELT_MOVE(decode_mem[0], decode_mem[0]+N, DECODE_BUFFER_SIZE-N);
-   if (CC==2)
-      CELT_MOVE(decode_mem[1], decode_mem[1]+N, DECODE_BUFFER_SIZE-N);
+   decoder_history(st, out_mem, overlap_mem, N);
 
    c=0; do
       for (i=0;i<M*st->mode->eBands[st->start];i++)
@@ -2567,15 +3980,27 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
          freq[c*N+i] = 0;
    } while (++c<C);
 
-   out_syn[0] = out_mem[0]+MAX_PERIOD-N;
+   /* The new samples go right after the history */
+   out_syn[0] = out_mem[0]+st->history;
    if (CC==2)
-      out_syn[1] = out_mem[1]+MAX_PERIOD-N;
+      out_syn[1] = out_mem[1]+st->history;
 
+   /* A mono stream played on two channels only needs to be synthesised
+      once, as long as both channels have the same history. They do from a
+      reset until a stereo frame or a noise-filled lost one comes along. */
+   nsyn = CC;
    if (CC==2&&C==1)
    {
-      for (i=0;i<N;i++)
-         freq[N+i] = freq[i];
+      if (!st->channels_differ)
+      {
+         nsyn = 1;
+      } else {
+         for (i=0;i<N;i++)
+            freq[N+i] = freq[i];
+      }
    }
+   if (C==2)
+      st->channels_differ = 1;
    if (CC==1&&C==2)
    {
       for (i=0;i<N;i++)
@@ -2583,7 +4008,7 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
    }
 
    /* Compute inverse MDCTs */
-   compute_inv_mdcts(st->mode, shortBlocks, freq, out_syn, overlap_mem, CC, LM);
+   compute_inv_mdcts(st->mode, shortBlocks, freq, out_syn, overlap_mem, nsyn, LM);
 
 #ifdef ENABLE_POSTFILTER
    c=0; do {
@@ -2591,13 +4016,13 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
       st->postfilter_period_old=IMAX(st->postfilter_period_old, COMBFILTER_MINPERIOD);
       comb_filter(out_syn[c], out_syn[c], st->postfilter_period_old, st->postfilter_period, st->mode->shortMdctSize,
             st->postfilter_gain_old, st->postfilter_gain, st->postfilter_tapset_old, st->postfilter_tapset,
-            st->mode->window, st->overlap);
+            st->mode->crossfade, st->overlap);
       if (LM!=0)
          comb_filter(out_syn[c]+st->mode->shortMdctSize, out_syn[c]+st->mode->shortMdctSize, st->postfilter_period, postfilter_pitch, N-st->mode->shortMdctSize,
                st->postfilter_gain, postfilter_gain, st->postfilter_tapset, postfilter_tapset,
-               st->mode->window, st->mode->overlap);
+               st->mode->crossfade, st->mode->overlap);
 
-   } while (++c<CC);
+   } while (++c<nsyn);
    st->postfilter_period_old = st->postfilter_period;
    st->postfilter_gain_old = st->postfilter_gain;
    st->postfilter_tapset_old = st->postfilter_tapset;
@@ -2612,34 +4037,26 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
    }
 #endif /* ENABLE_POSTFILTER */
 
-   if (C==1) {
-      for (i=0;i<st->mode->nbEBands;i++)
-         oldBandE[st->mode->nbEBands+i]=oldBandE[i];
+   if (nsyn<CC)
+   {
+      /* Keep the second channel's history identical */
+      CELT_COPY(out_syn[1], out_syn[0], N);
+      CELT_COPY(overlap_mem[1], overlap_mem[0], st->overlap);
    }
 
-   /* In case start or end were to change */
-   c=0; do
-   {
-      for (i=0;i<st->start;i++)
-         oldBandE[c*st->mode->nbEBands+i]=0;
-      for (i=st->end;i<st->mode->nbEBands;i++)
-         oldBandE[c*st->mode->nbEBands+i]=0;
-   } while (++c<2);
-   if (!isTransient)
+   update_energy_history(st, C, M, isTransient);
+   st->rng = dec->rng;
+
+   st->decode_pos += N;
+   if (st->plc_tracking)
    {
-      for (i=0;i<2*st->mode->nbEBands;i++)
-         oldLogE2[i] = oldLogE[i];
-      for (i=0;i<2*st->mode->nbEBands;i++)
-         oldLogE[i] = oldBandE[i];
-      for (i=0;i<2*st->mode->nbEBands;i++)
-         backgroundLogE[i] = MIN16(backgroundLogE[i] + M*QCONST16(0.001f,DB_SHIFT), oldBandE[i]);
-   } else {
-      for (i=0;i<2*st->mode->nbEBands;i++)
-         oldLogE[i] = MIN16(oldLogE[i], oldBandE[i]);
+      c=0; do
+         out_mem[c] += N;
+      while (++c<CC);
+      plc_track(st, out_mem, N, CC);
    }
-   st->rng = dec->rng;
 
-   deemphasis(out_syn, pcm, N, CC, st->downsample, st->mode->preemph, st->preemph_memD);
+   deemphasis(out_syn, out, N, nsyn, CC, st->downsample, st->mode->preemph, st->preemph_memD);
    st->loss_count = 0;
    RESTORE_STACK;
    if (ec_tell(dec) > 8*len)
@@ -2649,54 +4066,33 @@ int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *da
    return frame_size/st->downsample;
 }
 
-#ifdef FIXED_POINT
-#ifndef DISABLE_FLOAT_API
 CELT_STATIC
-int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *data, int len, float * restrict pcm, int frame_size, ec_dec *dec)
+int celt_decode_with_ec(CELTDecoder * restrict st, const unsigned char *data, int len, celt_int16 * restrict pcm, int frame_size, ec_dec *dec)
 {
-   int j, ret, C, N;
-   VARDECL(celt_int16, out);
-   ALLOC_STACK;
-
+   CELTOutput out;
    if (pcm==NULL)
       return CELT_BAD_ARG;
-
-   C = CHANNELS(st->channels);
-   N = frame_size;
-   
-   ALLOC(out, C*N, celt_int16);
-   ret=celt_decode_with_ec(st, data, len, out, frame_size, dec);
-   if (ret>0)
-      for (j=0;j<C*ret;j++)
-         pcm[j]=out[j]*(1.f/32768.f);
-     
-   RESTORE_STACK;
-   return ret;
+   out.format = CELT_FORMAT_INT16;
+   out.channel[0] = pcm;
+   out.channel[1] = pcm+1;
+   out.stride = CHANNELS(st->channels);
+   out.gain = 0;
+   return celt_decode_frame(st, data, len, &out, frame_size, dec, NULL);
 }
-#endif /*DISABLE_FLOAT_API*/
-#else
+
+#if !defined(FIXED_POINT) || !defined(DISABLE_FLOAT_API)
 CELT_STATIC
-int celt_decode_with_ec(CELTDecoder * restrict st, const unsigned char *data, int len, celt_int16 * restrict pcm, int frame_size, ec_dec *dec)
+int celt_decode_with_ec_float(CELTDecoder * restrict st, const unsigned char *data, int len, float * restrict pcm, int frame_size, ec_dec *dec)
 {
-   int j, ret, C, N;
-   VARDECL(celt_sig, out);
-   ALLOC_STACK;
-
+   CELTOutput out;
    if (pcm==NULL)
       return CELT_BAD_ARG;
-
-   C = CHANNELS(st->channels);
-   N = frame_size;
-   ALLOC(out, C*N, celt_sig);
-
-   ret=celt_decode_with_ec_float(st, data, len, out, frame_size, dec);
-
-   if (ret>0)
-      for (j=0;j<C*ret;j++)
-         pcm[j] = FLOAT2INT16 (out[j]);
-   
-   RESTORE_STACK;
-   return ret;
+   out.format = CELT_FORMAT_FLOAT;
+   out.channel[0] = pcm;
+   out.channel[1] = pcm+1;
+   out.stride = CHANNELS(st->channels);
+   out.gain = 0;
+   return celt_decode_frame(st, data, len, &out, frame_size, dec, NULL);
 }
 #endif
 
@@ -2712,14 +4108,623 @@ int celt_decode_float(CELTDecoder * restrict st, const unsigned char *data, int
 }
 #endif /* DISABLE_FLOAT_API */
 
-int celt_decoder_ctl(CELTDecoder * restrict st, int request, ...)
+int celt_decode_to(CELTDecoder * restrict st, const unsigned char *data, int len, const CELTOutput *out, int frame_size)
 {
-   va_list ap;
+   if (out==NULL || out->channel[0]==NULL || (st->channels==2 && out->channel[1]==NULL) || out->stride<1)
+      return CELT_BAD_ARG;
+#if defined(FIXED_POINT) && defined(DISABLE_FLOAT_API)
+   if (out->format<CELT_FORMAT_INT16 || out->format>CELT_FORMAT_INT32)
+#else
+   if (out->format<CELT_FORMAT_INT16 || out->format>CELT_FORMAT_FLOAT)
+#endif
+      return CELT_BAD_ARG;
+   return celt_decode_frame(st, data, len, out, frame_size, NULL, NULL);
+}
 
-   va_start(ap, request);
-   switch (request)
-   {
-      case CELT_SET_START_BAND_REQUEST:
+/* Copies the FEC data for the previous frame out of a packet and returns
+   its length (0 if there is none) */
+static int extract_fec(CELTDecoder * restrict st, const unsigned char *data, int len, unsigned char *fec)
+{
+   int i, fec_len;
+   ec_dec dec;
+   if (!st->fec || data==NULL)
+      return 0;
+   if (st->signalling)
+   {
+      data++;
+      len--;
+   }
+   if (len<=1 || len>1275)
+      return 0;
+   ec_dec_init(&dec, (unsigned char*)data, len);
+   if (ec_dec_bit_logp(&dec, 15))
+      return 0;
+   fec_len = ec_dec_bits(&dec, 8);
+   for (i=0;i<fec_len;i++)
+      fec[i] = ec_dec_bits(&dec, 8);
+   if (ec_tell(&dec) > 8*len)
+      return 0;
+   return fec_len;
+}
+
+int celt_decode_fec(CELTDecoder * restrict st, const unsigned char *data, int len, celt_int16 * restrict pcm, int frame_size)
+{
+   int ret;
+   unsigned char fec[255];
+   int fec_len = extract_fec(st, data, len, fec);
+   if (fec_len<=1)
+      return celt_decode_with_ec(st, NULL, 0, pcm, frame_size, NULL);
+   /* The FEC copy itself carries no FEC */
+   st->fec = 0;
+   ret = celt_decode_with_ec(st, fec, fec_len, pcm, frame_size, NULL);
+   st->fec = 1;
+   return ret;
+}
+
+#ifndef DISABLE_FLOAT_API
+int celt_decode_fec_float(CELTDecoder * restrict st, const unsigned char *data, int len, float * restrict pcm, int frame_size)
+{
+   int ret;
+   unsigned char fec[255];
+   int fec_len = extract_fec(st, data, len, fec);
+   if (fec_len<=1)
+      return celt_decode_with_ec_float(st, NULL, 0, pcm, frame_size, NULL);
+   st->fec = 0;
+   ret = celt_decode_with_ec_float(st, fec, fec_len, pcm, frame_size, NULL);
+   st->fec = 1;
+   return ret;
+}
+#endif /* DISABLE_FLOAT_API */
+
+int celt_decode_packet(CELTDecoder * restrict st, const unsigned char *data, int len, celt_int16 * restrict pcm, int frame_size, int max_frames)
+{
+   int k, count, LM, C, ret;
+   int size[MAX_PACKET_FRAMES];
+   const int signalling = st->signalling;
+   const int stream_channels = st->stream_channels;
+
+   if (data==NULL || pcm==NULL || len<1 || len>MAX_PACKET_FRAMES*1275 || max_frames<1)
+      return CELT_BAD_ARG;
+   if (signalling)
+   {
+      int data0 = decode_header(st, data[0], &LM, &C);
+      if (data0<0)
+         return data0;
+      if ((data0&0x3)!=3)
+         return CELT_CORRUPTED_DATA;
+      if (frame_size*st->downsample < st->mode->shortMdctSize<<LM)
+         return CELT_BUFFER_TOO_SMALL;
+      frame_size = (st->mode->shortMdctSize<<LM)/st->downsample;
+      data++;
+      len--;
+   }
+   if (len<1 || (data[0]&0x40))
+      return CELT_CORRUPTED_DATA;
+   count = data[0]&0x3F;
+   if (count<1 || count>MAX_PACKET_FRAMES)
+      return CELT_CORRUPTED_DATA;
+   if (count>max_frames)
+      return CELT_BUFFER_TOO_SMALL;
+   if (data[0]&0x80)
+   {
+      int last;
+      data++;
+      len--;
+      last = len;
+      for (k=0;k<count-1;k++)
+      {
+         int n = parse_size(data, len, &size[k]);
+         if (n<0)
+            return CELT_CORRUPTED_DATA;
+         data += n;
+         len -= n;
+         last -= n+size[k];
+      }
+      if (last<0)
+         return CELT_CORRUPTED_DATA;
+      size[count-1] = last;
+   } else {
+      data++;
+      len--;
+      if (len%count)
+         return CELT_CORRUPTED_DATA;
+      for (k=0;k<count;k++)
+         size[k] = len/count;
+   }
+   for (k=0;k<count;k++)
+      if (size[k]>1275)
+         return CELT_CORRUPTED_DATA;
+
+   /* Each frame is decoded in place, as described by the TOC read above */
+   if (signalling)
+   {
+      st->signalling = 0;
+      st->stream_channels = C;
+   }
+   ret = CELT_OK;
+   for (k=0;k<count;k++)
+   {
+      ret = old_celt_decode(st, data, size[k], pcm+k*frame_size*CHANNELS(st->channels), frame_size);
+      if (ret<0)
+         break;
+      data += size[k];
+   }
+   st->signalling = signalling;
+   st->stream_channels = stream_channels;
+   if (ret<0)
+      return ret;
+   return count*frame_size;
+}
+
+int celt_transrate(CELTDecoder * restrict dec, CELTEncoder * restrict st, const unsigned char *data, int len, int frame_size, unsigned char *compressed, int nbCompressedBytes)
+{
+   int i, c, N, ret;
+   CodedFrame coded;
+   ec_enc _enc;
+   ec_enc *enc;
+   VARDECL(celt_norm, X);
+   VARDECL(celt_ener, bandE);
+   VARDECL(celt_word16, bandLogE);
+   VARDECL(int, coded_tf_res);
+   VARDECL(int, coded_offsets);
+   VARDECL(celt_word16, error);
+   VARDECL(int, fine_quant);
+   VARDECL(int, pulses);
+   VARDECL(int, cap);
+   VARDECL(int, offsets);
+   VARDECL(int, fine_priority);
+   VARDECL(int, tf_res);
+   VARDECL(unsigned char, collapse_masks);
+   celt_word16 *oldBandE, *oldLogE, *oldLogE2;
+   const int CC = CHANNELS(st->channels);
+   int C;
+   int LM, M;
+   int end, effEnd;
+   int shortBlocks;
+   int codedBands;
+   int alloc_trim;
+   int intensity=0;
+   int dual_stereo=0;
+   int dynalloc_logp;
+   celt_int32 bits;
+   celt_int32 total_bits;
+   celt_int32 total_boost;
+   celt_int32 balance;
+   celt_int32 tell;
+   int anti_collapse_rsv;
+   int anti_collapse_on=0;
+   ALLOC_STACK;
+
+   if (dec->mode!=st->mode || dec->channels!=st->channels || dec->start!=st->start
+         || compressed==NULL || nbCompressedBytes<2)
+      return CELT_BAD_ARG;
+
+   /* Decode everything but the synthesis */
+   N = st->mode->shortMdctSize<<st->mode->maxLM;
+   ALLOC(X, 2*N, celt_norm);
+   ALLOC(bandE, 2*st->mode->nbEBands, celt_ener);
+   ALLOC(bandLogE, 2*st->mode->nbEBands, celt_word16);
+   ALLOC(coded_tf_res, st->mode->nbEBands, int);
+   ALLOC(coded_offsets, st->mode->nbEBands, int);
+   for (i=0;i<st->mode->nbEBands;i++)
+      coded_tf_res[i] = coded_offsets[i] = 0;
+   coded.X = X;
+   coded.bandE = bandE;
+   coded.bandLogE = bandLogE;
+   coded.tf_res = coded_tf_res;
+   coded.offsets = coded_offsets;
+   ret = celt_decode_frame(dec, data, len, NULL, frame_size, NULL, &coded);
+   if (ret<0)
+   {
+      RESTORE_STACK;
+      return ret;
+   }
+
+   C = coded.C;
+   LM = coded.LM;
+   M = 1<<LM;
+   N = M*st->mode->shortMdctSize;
+   end = coded.end;
+   if (C>CC)
+   {
+      RESTORE_STACK;
+      return CELT_BAD_ARG;
+   }
+
+   oldBandE = (celt_word16*)(st->in_mem+CC*(2*st->overlap+PREFILTER_HISTORY(st->mode)));
+   oldLogE = oldBandE + CC*st->mode->nbEBands;
+   oldLogE2 = oldLogE + CC*st->mode->nbEBands;
+
+   if (st->signalling)
+   {
+      int tmp = (st->mode->effEBands-end)>>1;
+      end = IMAX(1, st->mode->effEBands-2*tmp);
+      compressed[0] = tmp<<5;
+      compressed[0] |= LM<<3;
+      compressed[0] |= (C==2)<<2;
+      /* Convert "standard mode" to Opus header */
+      if (st->mode->Fs==48000 && st->mode->shortMdctSize==120)
+      {
+         int c0 = toOpus(compressed[0]);
+         if (c0<0)
+         {
+            RESTORE_STACK;
+            return CELT_BAD_ARG;
+         }
+         compressed[0] = c0;
+      }
+      compressed++;
+      nbCompressedBytes--;
+   }
+   effEnd = end;
+   if (effEnd > st->mode->effEBands)
+      effEnd = st->mode->effEBands;
+
+   /* Can't produce more than 1275 output bytes */
+   nbCompressedBytes = IMIN(nbCompressedBytes,1275);
+   total_bits = nbCompressedBytes*8;
+   ec_enc_init(&_enc, compressed, nbCompressedBytes);
+   enc = &_enc;
+
+   /* From here on, the decisions that were decoded are written in the same
+      order as celt_encode_frame() does, only at the new rate */
+   ec_enc_bit_logp(enc, coded.silence, 15);
+   if (coded.silence)
+   {
+      /* Pretend we've filled all the remaining bits with zeros */
+      enc->nbits_total+=total_bits-ec_tell(enc);
+   }
+   if (st->fec && !coded.silence)
+   {
+      /* No FEC copy, but the field has to be there */
+      ec_enc_bits(enc, 0, 8);
+      st->fec_len = 0;
+   }
+
+   if (coded.postfilter_gain>0 && st->start==0 && nbCompressedBytes>12*C)
+   {
+      int qg, octave;
+      int pitch_index = coded.postfilter_pitch;
+#ifdef FIXED_POINT
+      qg = ((coded.postfilter_gain+1536)>>10)/3-1;
+#else
+      qg = floor(.5+coded.postfilter_gain*32/3)-1;
+#endif
+      ec_enc_bit_logp(enc, 1, 1);
+      pitch_index += 1;
+      octave = EC_ILOG(pitch_index)-5;
+      ec_enc_uint(enc, octave, 6);
+      ec_enc_bits(enc, pitch_index-(16<<octave), 4+octave);
+      ec_enc_bits(enc, qg, 3);
+      if (ec_tell(enc)+2<=total_bits)
+         ec_enc_icdf(enc, coded.postfilter_tapset, tapset_icdf, 2);
+   } else if (st->start==0 && ec_tell(enc)+16<=total_bits) {
+      ec_enc_bit_logp(enc, 0, 1);
+   }
+
+   shortBlocks = 0;
+   if (LM>0 && ec_tell(enc)+3<=total_bits)
+   {
+      ec_enc_bit_logp(enc, coded.isTransient, 3);
+      if (coded.isTransient)
+         shortBlocks = M;
+   } else if (coded.isTransient) {
+      /* The shapes are interleaved for short blocks */
+      RESTORE_STACK;
+      return CELT_BUFFER_TOO_SMALL;
+   }
+
+   ALLOC(error, C*st->mode->nbEBands, celt_word16);
+   celtquant_coarse_energy(st->mode, st->start, end, effEnd, bandLogE,
+         oldBandE, total_bits, error, enc,
+         C, LM, nbCompressedBytes, st->force_intra,
+         &st->delayedIntra, st->complexity >= 4, st->loss_rate);
+
+   /* The shapes are in the MDCT domain, so the tf resolution is free to
+      change if there isn't room for all of it */
+   ALLOC(tf_res, st->mode->nbEBands, int);
+   for (i=0;i<st->mode->nbEBands;i++)
+      tf_res[i] = coded_tf_res[i];
+   tf_encode(st->start, end, coded.isTransient, tf_res, LM, coded.tf_select, enc);
+
+   st->spread_decision = SPREAD_NORMAL;
+   if (ec_tell(enc)+4<=total_bits)
+   {
+      st->spread_decision = coded.spread_decision;
+      ec_enc_icdf(enc, st->spread_decision, spread_icdf, 5);
+   }
+
+   ALLOC(cap, st->mode->nbEBands, int);
+   ALLOC(offsets, st->mode->nbEBands, int);
+   init_caps(st->mode,cap,LM,C);
+   dynalloc_logp = 6;
+   total_bits<<=BITRES;
+   total_boost = 0;
+   tell = ec_tell_frac(enc);
+   for (i=st->start;i<end;i++)
+   {
+      int width, quanta;
+      int dynalloc_loop_logp;
+      int boost;
+      int j;
+      width = C*(st->mode->eBands[i+1]-st->mode->eBands[i])<<LM;
+      quanta = IMIN(width<<BITRES, IMAX(6<<BITRES, width));
+      dynalloc_loop_logp = dynalloc_logp;
+      boost = 0;
+      for (j = 0; tell+(dynalloc_loop_logp<<BITRES) < total_bits-total_boost
+            && boost < cap[i]; j++)
+      {
+         int flag;
+         flag = boost < coded_offsets[i];
+         ec_enc_bit_logp(enc, flag, dynalloc_loop_logp);
+         tell = ec_tell_frac(enc);
+         if (!flag)
+            break;
+         boost += quanta;
+         total_boost += quanta;
+         dynalloc_loop_logp = 1;
+      }
+      if (j)
+         dynalloc_logp = IMAX(2, dynalloc_logp-1);
+      offsets[i] = boost;
+   }
+   for (;i<st->mode->nbEBands;i++)
+      offsets[i] = 0;
+   alloc_trim = 5;
+   if (tell+(6<<BITRES) <= total_bits - total_boost)
+   {
+      alloc_trim = coded.alloc_trim;
+      ec_enc_icdf(enc, alloc_trim, trim_icdf, 7);
+   }
+
+   if (C==2)
+   {
+      /* Intensity stereo never starts higher than it did in the input,
+         where the side was not coded */
+      dual_stereo = coded.dual_stereo;
+      intensity = IMIN(coded.intensity,
+            intensity_decision(nbCompressedBytes, LM, st->start, end));
+   }
+
+   /* Bit allocation at the new rate */
+   ALLOC(fine_quant, st->mode->nbEBands, int);
+   ALLOC(pulses, st->mode->nbEBands, int);
+   ALLOC(fine_priority, st->mode->nbEBands, int);
+   bits = ((celt_int32)nbCompressedBytes*8<<BITRES) - ec_tell_frac(enc) - 1;
+   anti_collapse_rsv = coded.isTransient&&LM>=2&&bits>=(LM+2<<BITRES) ? (1<<BITRES) : 0;
+   bits -= anti_collapse_rsv;
+   codedBands = compute_allocation(st->mode, &st->alloc_cache, st->start, end, offsets, cap,
+         alloc_trim, &intensity, &dual_stereo, bits, &balance, pulses,
+         fine_quant, fine_priority, C, LM, enc, 1, st->lastCodedBands);
+   st->lastCodedBands = codedBands;
+
+   celtquant_fine_energy(st->mode, st->start, end, oldBandE, error, fine_quant, enc, C);
+
+   /* Re-quantise the decoded shapes */
+   ALLOC(collapse_masks, C*st->mode->nbEBands, unsigned char);
+   celtquant_all_bands(1, st->mode, st->start, end, X, C==2 ? X+N : NULL, collapse_masks,
+         bandE, pulses, shortBlocks, st->spread_decision, dual_stereo, intensity, tf_res, 0,
+         nbCompressedBytes*(8<<BITRES)-anti_collapse_rsv, balance, enc, LM, codedBands, &st->rng);
+
+   if (anti_collapse_rsv > 0)
+   {
+      anti_collapse_on = st->consec_transient<2;
+      ec_enc_bits(enc, anti_collapse_on, 1);
+   }
+   celtquant_energy_finalise(st->mode, st->start, end, oldBandE, error, fine_quant, fine_priority, nbCompressedBytes*8-ec_tell(enc), enc, C);
+
+   if (coded.silence)
+   {
+      for (i=0;i<C*st->mode->nbEBands;i++)
+         oldBandE[i] = -QCONST16(28.f,DB_SHIFT);
+   }
+
+   if (CC==2&&C==1) {
+      for (i=0;i<st->mode->nbEBands;i++)
+         oldBandE[st->mode->nbEBands+i]=oldBandE[i];
+   }
+
+   /* In case start or end were to change */
+   c=0; do
+   {
+      for (i=0;i<st->start;i++)
+         oldBandE[c*st->mode->nbEBands+i]=0;
+      for (i=end;i<st->mode->nbEBands;i++)
+         oldBandE[c*st->mode->nbEBands+i]=0;
+   } while (++c<CC);
+   if (!coded.isTransient)
+   {
+      for (i=0;i<CC*st->mode->nbEBands;i++)
+         oldLogE2[i] = oldLogE[i];
+      for (i=0;i<CC*st->mode->nbEBands;i++)
+         oldLogE[i] = oldBandE[i];
+   } else {
+      for (i=0;i<CC*st->mode->nbEBands;i++)
+         oldLogE[i] = MIN16(oldLogE[i], oldBandE[i]);
+   }
+   if (coded.isTransient)
+      st->consec_transient++;
+   else
+      st->consec_transient=0;
+   st->rng = enc->rng;
+
+   ec_enc_done(enc);
+
+   if (st->signalling)
+      nbCompressedBytes++;
+
+   RESTORE_STACK;
+   if (ec_get_error(enc))
+      return CELT_INTERNAL_ERROR;
+   else
+      return nbCompressedBytes;
+}
+
+int celt_decoder_snapshot(const CELTDecoder * restrict st, unsigned char *data, int maxBytes)
+{
+   int c;
+   Snapshot s;
+   const int CC = CHANNELS(st->channels);
+   const int size = st->decode_size+st->overlap;
+
+   s.data = data;
+   s.len = maxBytes;
+   s.pos = 0;
+   s.error = 0;
+   snapshot_put_header(&s, st->mode, CC, 1);
+   snapshot_put(&s, st->history);
+
+   /* Settings */
+   snapshot_put(&s, st->stream_channels);
+   snapshot_put(&s, st->downsample);
+   snapshot_put(&s, st->start);
+   snapshot_put(&s, st->end);
+   snapshot_put(&s, st->signalling);
+   snapshot_put(&s, st->fec);
+   snapshot_put(&s, st->plc_tracking);
+
+   snapshot_put(&s, st->rng);
+   snapshot_put(&s, st->error);
+   snapshot_put(&s, st->last_pitch_index);
+   snapshot_put(&s, st->loss_count);
+   snapshot_put(&s, st->postfilter_period);
+   snapshot_put(&s, st->postfilter_period_old);
+   snapshot_put(&s, word16_bits(st->postfilter_gain));
+   snapshot_put(&s, word16_bits(st->postfilter_gain_old));
+   snapshot_put(&s, st->postfilter_tapset);
+   snapshot_put(&s, st->postfilter_tapset_old);
+   /* The PLC analysis is only kept up to date when tracking */
+   if (st->plc_tracking)
+   {
+      snapshot_put(&s, st->plc_valid);
+      snapshot_put(&s, st->plc_ac_pos);
+      snapshot_put_words16(&s, plc_pitch_buf(st), MAX_PERIOD>>1);
+      snapshot_put_words32(&s, plc_ac(st, 0, 0), CC*PLC_TRACK_BLOCKS*(LPC_ORDER+1));
+   }
+   snapshot_put_words32(&s, st->preemph_memD, 2);
+
+   /* Only the history is live, the rest of the buffer is scratch space */
+   c=0; do
+      snapshot_put_words32(&s, st->_decode_mem+c*size+st->decode_pos, st->history);
+   while (++c<CC);
+   snapshot_put_words32(&s, st->_decode_mem+CC*size, CC*st->overlap);
+   /* LPC and energies */
+   snapshot_put_words16(&s, (const celt_word16*)(st->_decode_mem+CC*(size+st->overlap)),
+         CC*LPC_ORDER+4*2*st->mode->nbEBands);
+
+   if (s.error)
+      return CELT_BUFFER_TOO_SMALL;
+   return s.pos;
+}
+
+int celt_decoder_restore(CELTDecoder * restrict st, const unsigned char *data, int len)
+{
+   int c, ret, bytes;
+   Snapshot s;
+   const int CC = CHANNELS(st->channels);
+   const int size = st->decode_size+st->overlap;
+   VARDECL(unsigned char, saved);
+   ALLOC_STACK;
+
+   if (data==NULL || len<0)
+   {
+      RESTORE_STACK;
+      return CELT_BAD_ARG;
+   }
+   s.data = (unsigned char*)data;
+   s.len = len;
+   s.pos = 0;
+   s.error = 0;
+   ret = snapshot_check_header(&s, st->mode, CC, 1);
+   if (ret==CELT_OK && snapshot_get(&s)!=(celt_uint32)st->history)
+      ret = s.error ? CELT_CORRUPTED_DATA : CELT_BAD_ARG;
+   if (ret!=CELT_OK)
+   {
+      RESTORE_STACK;
+      return ret;
+   }
+   /* The state is left untouched if the snapshot turns out to be bad */
+   bytes = decoder_size(st->mode, st->channels, st->decode_size, st->plc_state, st->has_alloc_cache);
+   ALLOC(saved, bytes, unsigned char);
+   CELT_COPY(saved, (unsigned char*)st, bytes);
+
+   st->stream_channels = snapshot_get(&s);
+   st->downsample = snapshot_get(&s);
+   st->start = snapshot_get(&s);
+   st->end = snapshot_get(&s);
+   st->signalling = snapshot_get(&s);
+   st->fec = snapshot_get(&s);
+   st->plc_tracking = snapshot_get(&s);
+
+   st->rng = snapshot_get(&s);
+   st->error = snapshot_get(&s);
+   st->last_pitch_index = snapshot_get(&s);
+   st->loss_count = snapshot_get(&s);
+   st->postfilter_period = snapshot_get(&s);
+   st->postfilter_period_old = snapshot_get(&s);
+   st->postfilter_gain = bits_word16(snapshot_get(&s));
+   st->postfilter_gain_old = bits_word16(snapshot_get(&s));
+   st->postfilter_tapset = snapshot_get(&s);
+   st->postfilter_tapset_old = snapshot_get(&s);
+   st->plc_valid = 0;
+   st->plc_ac_pos = 0;
+   /* Only a decoder with the tracking state can take it */
+   if (st->plc_tracking && !st->plc_state)
+   {
+      CELT_COPY((unsigned char*)st, saved, bytes);
+      RESTORE_STACK;
+      return CELT_BAD_ARG;
+   }
+   if (st->plc_tracking)
+   {
+      st->plc_valid = snapshot_get(&s);
+      st->plc_ac_pos = snapshot_get(&s);
+      snapshot_get_words16(&s, plc_pitch_buf(st), MAX_PERIOD>>1);
+      snapshot_get_words32(&s, plc_ac(st, 0, 0), CC*PLC_TRACK_BLOCKS*(LPC_ORDER+1));
+   }
+   snapshot_get_words32(&s, st->preemph_memD, 2);
+
+   st->decode_pos = 0;
+   c=0; do
+      snapshot_get_words32(&s, st->_decode_mem+c*size, st->history);
+   while (++c<CC);
+   snapshot_get_words32(&s, st->_decode_mem+CC*size, CC*st->overlap);
+   snapshot_get_words16(&s, (celt_word16*)(st->_decode_mem+CC*(size+st->overlap)),
+         CC*LPC_ORDER+4*2*st->mode->nbEBands);
+
+   /* Anything used as an index has to be in range */
+   if (s.error || s.pos!=len
+         || st->stream_channels<1 || st->stream_channels>2
+         || st->downsample<1 || st->downsample>6
+         || st->start<0 || st->start>=st->end || st->end>st->mode->nbEBands
+         || st->last_pitch_index<0 || st->last_pitch_index>MAX_PERIOD
+         || st->postfilter_period<0 || st->postfilter_period>COMBFILTER_MAXPERIOD
+         || st->postfilter_period_old<0 || st->postfilter_period_old>COMBFILTER_MAXPERIOD
+         || st->postfilter_tapset<0 || st->postfilter_tapset>2
+         || st->postfilter_tapset_old<0 || st->postfilter_tapset_old>2
+         || st->plc_valid<0 || st->plc_valid>MAX_PERIOD
+         || st->plc_ac_pos<0 || st->plc_ac_pos>=PLC_TRACK_BLOCKS)
+   {
+      CELT_COPY((unsigned char*)st, saved, bytes);
+      ret = CELT_CORRUPTED_DATA;
+   } else if (CC==2)
+   {
+      celt_sig *out_mem[2], *overlap_mem[2];
+      decoder_history(st, out_mem, overlap_mem, 0);
+      st->channels_differ = !channels_match(st, out_mem, overlap_mem);
+   }
+   RESTORE_STACK;
+   return ret;
+}
+
+int celt_decoder_ctl(CELTDecoder * restrict st, int request, ...)
+{
+   va_list ap;
+
+   va_start(ap, request);
+   switch (request)
+   {
+      case CELT_SET_START_BAND_REQUEST:
       {
          celt_int32 value = va_arg(ap, celt_int32);
          if (value<0 || value>=st->mode->nbEBands)
@@ -2735,6 +4740,23 @@ int celt_decoder_ctl(CELTDecoder * restrict st, int request, ...)
          st->end = value;
       }
       break;
+      case CELT_SET_FEC_REQUEST:
+      {
+         celt_int32 value = va_arg(ap, celt_int32);
+         st->fec = value!=0;
+      }
+      break;
+      case CELT_SET_PLC_TRACKING_REQUEST:
+      {
+         celt_int32 value = va_arg(ap, celt_int32);
+         /* Tracking needs its state */
+         if (value && !st->plc_state)
+            goto bad_arg;
+         if (!st->plc_tracking)
+            st->plc_valid = 0;
+         st->plc_tracking = value!=0;
+      }
+      break;
       case CELT_SET_CHANNELS_REQUEST:
       {
          celt_int32 value = va_arg(ap, celt_int32);
@@ -2760,10 +4782,28 @@ int celt_decoder_ctl(CELTDecoder * restrict st, int request, ...)
          *value = st->overlap/st->downsample;
       }
       break;
+      case CELT_GET_ALLOC_CACHE_HITS_REQUEST:
+      {
+         celt_uint32 *value = va_arg(ap, celt_uint32*);
+         const AllocCache *cache = decoder_alloc_cache(st);
+         if (value==NULL)
+            goto bad_arg;
+         *value = cache!=NULL ? cache->hits : 0;
+      }
+      break;
+      case CELT_GET_ALLOC_CACHE_LOOKUPS_REQUEST:
+      {
+         celt_uint32 *value = va_arg(ap, celt_uint32*);
+         const AllocCache *cache = decoder_alloc_cache(st);
+         if (value==NULL)
+            goto bad_arg;
+         *value = cache!=NULL ? cache->lookups : 0;
+      }
+      break;
       case CELT_RESET_STATE:
       {
          CELT_MEMSET((char*)&st->DECODER_RESET_START, 0,
-               celt_decoder_get_size_custom(st->mode, st->channels)-
+               decoder_size(st->mode, st->channels, st->decode_size, st->plc_state, 0)-
                ((char*)&st->DECODER_RESET_START - (char*)st));
       }
       break;
@@ -52,6 +52,7 @@ extern "C" {
 #define _celt_check_int(x) (((void)((x) == (celt_int32)0)), (celt_int32)(x))
 #define _celt_check_mode_ptr_ptr(ptr) ((ptr) + ((ptr) - (const CELTMode**)(ptr)))
 #define _celt_check_int_ptr(ptr) ((ptr) + ((ptr) - (int*)(ptr)))
+#define _celt_check_uint32_ptr(ptr) ((ptr) + ((ptr) - (celt_uint32*)(ptr)))
 
 /* Error codes */
 /** No error */
@@ -115,6 +116,34 @@ extern "C" {
 #define CELT_SET_LOSS_PERC_REQUEST    20
 #define CELT_SET_LOSS_PERC(x) CELT_SET_LOSS_PERC_REQUEST, _celt_check_int(x)
 
+#define CELT_SET_FEC_REQUEST    22
+/** Encoder: percentage of each packet (0-100) spent on a redundant copy of
+    the previous frame, 0 disables FEC (default). Decoder: non-zero if the
+    stream carries FEC. Both sides must agree on whether FEC is used. */
+#define CELT_SET_FEC(x) CELT_SET_FEC_REQUEST, _celt_check_int(x)
+
+#define CELT_SET_PLC_TRACKING_REQUEST    24
+/** Decoder: if non-zero, the pitch and LPC analysis used for packet loss
+    concealment is updated a little on every decoded frame instead of all at
+    once when a packet is lost (default: 0). Only decoders made with
+    celt_decoder_create_history() with plc set to 2 keep the state this
+    needs; the others return CELT_BAD_ARG. */
+#define CELT_SET_PLC_TRACKING(x) CELT_SET_PLC_TRACKING_REQUEST, _celt_check_int(x)
+
+#define CELT_GET_ALLOC_CACHE_HITS_REQUEST    25
+/** Number of frames that reused the interpolation between the allocation
+    vectors from the previous frame instead of searching for it again, as a
+    celt_uint32. Like CELT_GET_ALLOC_CACHE_LOOKUPS, it wraps around after
+    2^32 frames, so take the difference between two readings for long-lived
+    states. */
+#define CELT_GET_ALLOC_CACHE_HITS(x) CELT_GET_ALLOC_CACHE_HITS_REQUEST, _celt_check_uint32_ptr(x)
+
+#define CELT_GET_ALLOC_CACHE_LOOKUPS_REQUEST    27
+/** Number of frames that looked for a reusable bit allocation. The hit rate
+    is CELT_GET_ALLOC_CACHE_HITS over this. Always 0 for decoders made with
+    celt_decoder_create_history(), which don't keep the cache. */
+#define CELT_GET_ALLOC_CACHE_LOOKUPS(x) CELT_GET_ALLOC_CACHE_LOOKUPS_REQUEST, _celt_check_uint32_ptr(x)
+
 /* Internal */
 #define CELT_SET_START_BAND_REQUEST    10000
 #define CELT_SET_START_BAND(x) CELT_SET_START_BAND_REQUEST, _celt_check_int(x)
@@ -142,6 +171,28 @@ typedef struct CELTDecoder CELTDecoder;
     bad */
 typedef struct CELTMode CELTMode;
 
+/* Sample formats for CELTOutput */
+#define CELT_FORMAT_INT16 0 /**< 16-bit signed integer */
+#define CELT_FORMAT_INT24 1 /**< 24-bit signed integer in the low bits of a 32-bit word */
+#define CELT_FORMAT_INT32 2 /**< 32-bit signed integer */
+#define CELT_FORMAT_FLOAT 3 /**< float, with full scale at +/-1 */
+
+/** Describes where and in which format celt_decode_to() writes the decoded
+    samples. Interleaved stereo uses channel[1] = channel[0] + one sample and
+    a stride of 2, planar output uses a stride of 1 and separate buffers. */
+typedef struct {
+   int format;       /**< One of the CELT_FORMAT_* values */
+   void *channel[2]; /**< First output sample of each channel */
+   int stride;       /**< Distance between two samples of a channel, in samples */
+   int gain;         /**< Output gain in Q8 dB (0: unity, at most +18 dB) */
+} CELTOutput;
+
+/** One segment of the packet buffer given to celt_encode_iov() */
+typedef struct {
+   unsigned char *base; /**< Start of the segment */
+   int len;             /**< Size of the segment in bytes */
+} CELTIovec;
+
 
 /** \defgroup codec Encoding and decoding */
 /*  @{ */
@@ -235,6 +286,63 @@ EXPORT int celt_encode_float(CELTEncoder *st, const float *pcm, int frame_size,
  */
 EXPORT int celt_encode(CELTEncoder *st, const celt_int16 *pcm, int frame_size, unsigned char *compressed, int maxCompressedBytes);
 
+/** Encodes a frame of audio straight into a packet buffer, after the
+    headroom that the caller reserves for its own header (e.g. RTP). The
+    buffer can be made of several segments. When the compressed data fits
+    in the segment where it starts, which is always the case for a single
+    segment, it is encoded in place with no copy, including when VBR
+    shrinks the frame.
+ @param st Encoder state
+ @param pcm PCM audio in signed 16-bit format (native endian). There must be
+ *          exactly frame_size samples per channel.
+ @param iov Segments making up the packet buffer, in order
+ @param iovcnt Number of segments
+ @param headroom Number of bytes to leave untouched at the start of the buffer
+ @param maxCompressedBytes Maximum number of bytes to use for compressing the frame
+ @return Number of bytes written after the headroom (see celt_encode()), or
+ *       an error code
+ */
+EXPORT int celt_encode_iov(CELTEncoder *st, const celt_int16 *pcm, int frame_size, const CELTIovec *iov, int iovcnt, int headroom, int maxCompressedBytes);
+
+/** Encodes the same frame for each of K encoders, typically set to
+    different bitrates for simulcast. Each encoder keeps its own state and
+    produces exactly what celt_encode() would, but the analysis of the input
+    (pre-emphasis, transient analysis, MDCT, band energies and
+    normalisation) is only done once for all the encoders for which it
+    comes out the same. That is the case when they have been fed the same
+    audio and the same settings, except for the rate.
+ @param st Array of K encoder states, all using the same mode, number of
+ *         channels and upsampling factor
+ @param K Number of encoders
+ @param pcm PCM audio in signed 16-bit format (native endian). There must be
+ *          exactly frame_size samples per channel.
+ @param compressed Array of K buffers for the compressed frames
+ @param maxCompressedBytes Array of K maximum numbers of bytes, one for
+ *          each frame (see celt_encode())
+ @param len Array receiving the value celt_encode() would have returned for
+ *          each encoder
+ @return CELT_OK if all the frames were encoded, otherwise the first error
+ */
+EXPORT int celt_encode_simulcast(CELTEncoder **st, int K, const celt_int16 *pcm, int frame_size, unsigned char **compressed, const int *maxCompressedBytes, int *len);
+
+/** Encodes several consecutive frames into a single packet, which saves the
+    per-packet overhead for short frames. With signalling on, the frames
+    share one TOC byte (Opus code 3 framing). It is followed by a byte with
+    the number of frames. The frame lengths come next, one or two bytes
+    each, and are left out when all the frames have the same size.
+    Without signalling there is no TOC byte.
+ @param st Encoder state
+ @param pcm PCM audio in signed 16-bit format (native endian). There must be
+ *          exactly nb_frames*frame_size samples per channel.
+ @param frame_size Number of samples per channel in each frame
+ @param nb_frames Number of frames (1 to 48)
+ @param compressed The compressed packet
+ @param maxCompressedBytes Maximum number of bytes for the whole packet,
+ *          which is shared evenly between the frames
+ @return Number of bytes written to "compressed", or an error code
+ */
+EXPORT int celt_encode_packet(CELTEncoder *st, const celt_int16 *pcm, int frame_size, int nb_frames, unsigned char *compressed, int maxCompressedBytes);
+
 /** Query and set encoder parameters 
  @param st Encoder state
  @param request Parameter to change or query
@@ -243,6 +351,29 @@ EXPORT int celt_encode(CELTEncoder *st, const celt_int16 *pcm, int frame_size, u
 */
 EXPORT int celt_encoder_ctl(CELTEncoder * st, int request, ...);
 
+/** Saves the state of an encoder, including its settings, into a blob that
+    holds no pointer, so that it can be restored in another process (of the
+    same build). What can be recomputed and runs of zeros at the start of
+    the histories are left out.
+ @param st Encoder state
+ @param data Where the snapshot is written, or NULL to get its size
+ @param maxBytes Size of "data"
+ @return Size of the snapshot in bytes, or an error code
+ */
+EXPORT int celt_encoder_snapshot(const CELTEncoder *st, unsigned char *data, int maxBytes);
+
+/** Restores an encoder from a snapshot made by celt_encoder_snapshot(). The
+    encoder carries on exactly as the one the snapshot was made from.
+ @param st Encoder state, initialised with the same mode and number of
+           channels as the one the snapshot was made from
+ @param data Snapshot
+ @param len Size of the snapshot in bytes
+ @return CELT_OK, CELT_BAD_ARG if the snapshot is for a different mode,
+         number of channels or build, or CELT_CORRUPTED_DATA. The state is
+         unchanged on error.
+ */
+EXPORT int celt_encoder_restore(CELTEncoder *st, const unsigned char *data, int len);
+
 /* Decoder stuff */
 
 EXPORT int old_celt_decoder_get_size(int channels);
@@ -273,6 +404,40 @@ EXPORT CELTDecoder *old_celt_decoder_init(CELTDecoder *st, int sampling_rate, in
 
 EXPORT CELTDecoder *celt_decoder_init_custom(CELTDecoder *st, const CELTMode *mode, int channels, int *error);
 
+/** Returns the size of a decoder state that only keeps the history needed for
+    frames of up to max_frame_size samples, instead of enough for any frame
+    size. These decoders also don't keep the bit allocation of the previous
+    frame (see CELT_GET_ALLOC_CACHE_HITS).
+ @param mode Mode the decoder will use
+ @param channels Number of channels
+ @param max_frame_size Largest frame size that will be decoded (one of the
+                       frame sizes supported by the mode)
+ @param plc 1 to keep the history needed by the pitch-based packet loss
+            concealment, 2 to also keep the state used by
+            CELT_SET_PLC_TRACKING, 0 for neither. Without the history, lost
+            packets are filled with noise. Builds with the postfilter always
+            keep the history.
+ @return Size in bytes, or CELT_BAD_ARG
+ */
+EXPORT int celt_decoder_get_size_history(const CELTMode *mode, int channels, int max_frame_size, int plc);
+
+/** Creates a decoder state of the size returned by
+    celt_decoder_get_size_history(). Decoding a frame larger than
+    max_frame_size returns CELT_BUFFER_TOO_SMALL.
+ @param mode Mode the decoder will use
+ @param channels Number of channels
+ @param max_frame_size Largest frame size that will be decoded
+ @param plc What to keep for the packet loss concealment (see
+            celt_decoder_get_size_history())
+ @param error Returns an error code
+ @return Newly created decoder state.
+ */
+EXPORT CELTDecoder *celt_decoder_create_history(const CELTMode *mode, int channels, int max_frame_size, int plc, int *error);
+
+/** Same as celt_decoder_create_history(), in memory allocated by the caller
+    with the size returned by celt_decoder_get_size_history(). */
+EXPORT CELTDecoder *celt_decoder_init_history(CELTDecoder *st, const CELTMode *mode, int channels, int max_frame_size, int plc, int *error);
+
 /** Destroys a a decoder state.
  @param st Decoder state to be destroyed
  */
@@ -300,6 +465,76 @@ EXPORT int celt_decode_float(CELTDecoder *st, const unsigned char *data, int len
  */
 EXPORT int old_celt_decode(CELTDecoder *st, const unsigned char *data, int len, celt_int16 *pcm, int frame_size);
 
+/** Decodes a frame of audio directly into the caller's output layout, with
+    no intermediate buffer or conversion pass.
+ @param st Decoder state
+ @param data Compressed data produced by an encoder (NULL for a lost packet)
+ @param len Number of bytes to read from "data"
+ @param out Format, location and gain of the output
+ @param frame_size Number of samples per channel to decode
+ @return Number of samples decoded per channel, or an error code
+ */
+EXPORT int celt_decode_to(CELTDecoder *st, const unsigned char *data, int len, const CELTOutput *out, int frame_size);
+
+/** Decodes the frame preceding a packet, when that frame's own packet was
+    lost, from the FEC copy carried in the packet (see CELT_SET_FEC). Falls
+    back to regular packet loss concealment if there is no FEC copy.
+ @param st Decoder state
+ @param data Packet following the lost one
+ @param len Number of bytes to read from "data"
+ @param pcm One frame (frame_size samples per channel) of decoded PCM will be
+            returned here in float format.
+ @return Error code.
+ */
+EXPORT int celt_decode_fec_float(CELTDecoder *st, const unsigned char *data, int len, float *pcm, int frame_size);
+
+/** Decodes the frame preceding a packet, when that frame's own packet was
+    lost, from the FEC copy carried in the packet (see CELT_SET_FEC). Falls
+    back to regular packet loss concealment if there is no FEC copy.
+ @param st Decoder state
+ @param data Packet following the lost one
+ @param len Number of bytes to read from "data"
+ @param pcm One frame (frame_size samples per channel) of decoded PCM will be
+            returned here in 16-bit PCM format (native endian).
+ @return Error code.
+ */
+EXPORT int celt_decode_fec(CELTDecoder *st, const unsigned char *data, int len, celt_int16 *pcm, int frame_size);
+
+/** Decodes all the frames of a packet made by celt_encode_packet(). The
+    frames are decoded straight from "data", with no copy.
+ @param st Decoder state
+ @param data Compressed packet
+ @param len Number of bytes to read from "data"
+ @param pcm The frames are returned here one after the other, in 16-bit PCM
+ *          format (native endian). There must be room for max_frames frames.
+ @param frame_size Number of samples per channel in each frame. With
+ *          signalling on, the frame size is read from the packet and this
+ *          is the most that fits (see old_celt_decode()).
+ @param max_frames Most frames that "pcm" can hold
+ @return Number of samples per channel decoded, or an error code
+ */
+EXPORT int celt_decode_packet(CELTDecoder *st, const unsigned char *data, int len, celt_int16 *pcm, int frame_size, int max_frames);
+
+/** Re-encodes a packet at a different size without going back to the time
+    domain. The energies, band shapes and coding decisions are decoded and
+    written again with the bit allocation of the new size. The output can be
+    decoded by any decoder that would accept the encoder's own packets.
+ @param dec Decoder state following the input stream. It must not be used
+            for anything else.
+ @param st Encoder state following the output stream. It must not be used
+           for anything else and must use the same mode, channels and start
+           band as the decoder. Its bitrate, VBR, FEC and prediction settings
+           are ignored.
+ @param data Input packet (must not be NULL: lost packets can't be transrated)
+ @param len Number of bytes to read from "data"
+ @param frame_size Number of samples per channel in the frame
+ @param compressed The output packet
+ @param nbCompressedBytes Size of the output packet, which is always filled
+ @return Number of bytes written to "compressed", or a negative error code.
+         CELT_BUFFER_TOO_SMALL if the output can't carry the transient flag.
+ */
+EXPORT int celt_transrate(CELTDecoder *dec, CELTEncoder *st, const unsigned char *data, int len, int frame_size, unsigned char *compressed, int nbCompressedBytes);
+
 /** Query and set decoder parameters
    @param st Decoder state
    @param request Parameter to change or query
@@ -308,6 +543,24 @@ EXPORT int old_celt_decode(CELTDecoder *st, const unsigned char *data, int len,
  */
 EXPORT int celt_decoder_ctl(CELTDecoder * st, int request, ...);
 
+/** Saves the state of a decoder into a blob. See celt_encoder_snapshot().
+ @param st Decoder state
+ @param data Where the snapshot is written, or NULL to get its size
+ @param maxBytes Size of "data"
+ @return Size of the snapshot in bytes, or an error code
+ */
+EXPORT int celt_decoder_snapshot(const CELTDecoder *st, unsigned char *data, int maxBytes);
+
+/** Restores a decoder from a snapshot made by celt_decoder_snapshot(). See
+    celt_encoder_restore().
+ @param st Decoder state, initialised with the same mode and number of
+           channels as the one the snapshot was made from
+ @param data Snapshot
+ @param len Size of the snapshot in bytes
+ @return Error code. The state is unchanged on error.
+ */
+EXPORT int celt_decoder_restore(CELTDecoder *st, const unsigned char *data, int len);
+
 
 /** Returns the English string that corresponds to an error code
  * @param error Error code (negative for an error, 0 for success
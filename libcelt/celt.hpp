@@ -0,0 +1,229 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/**
+  @file celt.hpp
+  @brief C++ wrapper for the functions in celt.h (requires C++20)
+ */
+
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CELT_HPP
+#define CELT_HPP
+
+#include "celt.h"
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+namespace celt {
+
+/** Thrown for any error code returned by the C API */
+class Error : public std::runtime_error {
+public:
+   explicit Error(int code) : std::runtime_error(celt_strerror(code)), code_(code) {}
+   /** The CELT_* error code */
+   int code() const noexcept { return code_; }
+private:
+   int code_;
+};
+
+namespace detail {
+
+inline int check(int ret)
+{
+   if (ret < 0)
+      throw Error(ret);
+   return ret;
+}
+
+/* What differs between the encoder and the decoder state */
+struct EncoderTraits {
+   typedef CELTEncoder State;
+   static int get_size(const CELTMode *m, int channels) { return celt_encoder_get_size_custom(m, channels); }
+   static State *init(State *st, const CELTMode *m, int channels, int *err) { return celt_encoder_init_custom(st, m, channels, err); }
+   template <class... Args>
+   static int ctl(State *st, int request, Args... args) { return celt_encoder_ctl(st, request, args...); }
+};
+
+struct DecoderTraits {
+   typedef CELTDecoder State;
+   static int get_size(const CELTMode *m, int channels) { return celt_decoder_get_size_custom(m, channels); }
+   static State *init(State *st, const CELTMode *m, int channels, int *err) { return celt_decoder_init_custom(st, m, channels, err); }
+   template <class... Args>
+   static int ctl(State *st, int request, Args... args) { return celt_decoder_ctl(st, request, args...); }
+};
+
+}
+
+/** A mode, shared by all the encoders and decoders created from it. Copies
+    refer to the same mode, which is destroyed along with the last encoder,
+    decoder or Mode that uses it. */
+class Mode {
+public:
+   /** See celt_mode_create() */
+   Mode(celt_int32 Fs, int frame_size)
+   {
+      int err = CELT_OK;
+      CELTMode *m = celt_mode_create(Fs, frame_size, &err);
+      if (m == NULL)
+         throw Error(err != CELT_OK ? err : CELT_ALLOC_FAIL);
+      mode_.reset(m, celt_mode_destroy);
+   }
+   const CELTMode *get() const noexcept { return mode_.get(); }
+private:
+   std::shared_ptr<CELTMode> mode_;
+};
+
+/** Owns an encoder or decoder state allocated through Allocator and
+    initialised in place with celt_*_init_custom(). Move-only. */
+template <class Traits, class Allocator>
+class State {
+public:
+   typedef typename std::allocator_traits<Allocator>::template rebind_alloc<std::byte> allocator_type;
+
+   State(Mode mode, int channels, const Allocator &alloc = Allocator())
+      : mode_(std::move(mode)), alloc_(alloc), channels_(channels)
+   {
+      int err = CELT_OK;
+      int size = Traits::get_size(mode_.get(), channels);
+      if (size <= 0)
+         throw Error(CELT_BAD_ARG);
+      std::byte *mem = std::allocator_traits<allocator_type>::allocate(alloc_, size);
+      st_ = Traits::init(reinterpret_cast<typename Traits::State*>(mem), mode_.get(), channels, &err);
+      if (st_ == NULL)
+      {
+         std::allocator_traits<allocator_type>::deallocate(alloc_, mem, size);
+         throw Error(err != CELT_OK ? err : CELT_INTERNAL_ERROR);
+      }
+      size_ = size;
+   }
+   State(State &&other) noexcept
+      : mode_(std::move(other.mode_)), alloc_(std::move(other.alloc_)),
+        st_(std::exchange(other.st_, nullptr)), size_(other.size_), channels_(other.channels_) {}
+   State &operator=(State &&other) noexcept
+   {
+      if (this != &other)
+      {
+         release();
+         mode_ = std::move(other.mode_);
+         alloc_ = std::move(other.alloc_);
+         st_ = std::exchange(other.st_, nullptr);
+         size_ = other.size_;
+         channels_ = other.channels_;
+      }
+      return *this;
+   }
+   State(const State &) = delete;
+   State &operator=(const State &) = delete;
+   ~State() { release(); }
+
+   /** Forwards to celt_encoder_ctl() or celt_decoder_ctl(), e.g.
+       enc.ctl(CELT_SET_COMPLEXITY(5)) */
+   template <class... Args>
+   void ctl(int request, Args... args) { detail::check(Traits::ctl(st_, request, args...)); }
+
+   int channels() const noexcept { return channels_; }
+   const Mode &mode() const noexcept { return mode_; }
+   typename Traits::State *get() noexcept { return st_; }
+
+private:
+   void release() noexcept
+   {
+      if (st_ != nullptr)
+         std::allocator_traits<allocator_type>::deallocate(alloc_,
+               reinterpret_cast<std::byte*>(st_), size_);
+      st_ = nullptr;
+   }
+
+   Mode mode_;
+   allocator_type alloc_;
+   typename Traits::State *st_ = nullptr;
+   int size_ = 0;
+   int channels_;
+};
+
+/** See celt_encoder_create_custom(). The frame size is taken from the
+    size of the input, which holds interleaved channels. */
+template <class Allocator = std::allocator<std::byte> >
+class BasicEncoder : public State<detail::EncoderTraits, Allocator> {
+public:
+   using State<detail::EncoderTraits, Allocator>::State;
+
+   /** Encodes one frame into out and returns the part of out that was
+       used. See celt_encode_float(). */
+   std::span<std::byte> encode(std::span<const float> pcm, std::span<std::byte> out)
+   {
+      int len = detail::check(celt_encode_float(this->get(), pcm.data(),
+            (int)pcm.size()/this->channels(), reinterpret_cast<unsigned char*>(out.data()),
+            (int)out.size()));
+      return out.first(len);
+   }
+   /** Same as above, for 16-bit input. See celt_encode(). */
+   std::span<std::byte> encode(std::span<const celt_int16> pcm, std::span<std::byte> out)
+   {
+      int len = detail::check(celt_encode(this->get(), pcm.data(),
+            (int)pcm.size()/this->channels(), reinterpret_cast<unsigned char*>(out.data()),
+            (int)out.size()));
+      return out.first(len);
+   }
+};
+
+/** See old_celt_decoder_create_custom(). The frame size is taken from the
+    size of the output, which holds interleaved channels. */
+template <class Allocator = std::allocator<std::byte> >
+class BasicDecoder : public State<detail::DecoderTraits, Allocator> {
+public:
+   using State<detail::DecoderTraits, Allocator>::State;
+
+   /** Decodes one frame into pcm and returns the part of pcm that was
+       written. An empty packet runs the packet loss concealment. See
+       celt_decode_float(). */
+   std::span<float> decode(std::span<const std::byte> data, std::span<float> pcm)
+   {
+      int frame_size = (int)pcm.size()/this->channels();
+      detail::check(celt_decode_float(this->get(),
+            data.empty() ? NULL : reinterpret_cast<const unsigned char*>(data.data()),
+            (int)data.size(), pcm.data(), frame_size));
+      return pcm.first(frame_size*this->channels());
+   }
+   /** Same as above, for 16-bit output. See old_celt_decode(). */
+   std::span<celt_int16> decode(std::span<const std::byte> data, std::span<celt_int16> pcm)
+   {
+      int frame_size = (int)pcm.size()/this->channels();
+      detail::check(old_celt_decode(this->get(),
+            data.empty() ? NULL : reinterpret_cast<const unsigned char*>(data.data()),
+            (int)data.size(), pcm.data(), frame_size));
+      return pcm.first(frame_size*this->channels());
+   }
+};
+
+typedef BasicEncoder<> Encoder;
+typedef BasicDecoder<> Decoder;
+
+}
+
+#endif /* CELT_HPP */
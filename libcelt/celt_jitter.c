@@ -0,0 +1,365 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+   
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+   
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+   
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include "celt_jitter.h"
+#include "os_support.h"
+#include "arch.h"
+
+/* Number of recent packets over which the jitter is measured */
+#define JITTER_WINDOW 64
+
+/* Each packet's margin is how far ahead of its playout time it arrived
+   (negative if it was late). The buffer keeps the smallest margin over the
+   last JITTER_WINDOW packets between 0 and one frame: if it goes negative,
+   a concealed frame is played without consuming a packet, which delays
+   playout by one frame; if it reaches a whole frame, one frame is skipped.
+   Margins are stored relative to the playout point, so they are shifted
+   whenever the playout point is moved. */
+struct CELTJitter {
+   int frame_size;
+   int margin;
+   int max_delay;
+
+#define JITTER_RESET_START started
+   int started;
+   celt_uint32 next_ts;
+
+   int underruns;
+   int late;
+   int inserted;
+   int dropped;
+
+   int nb_margins;
+   int margin_pos;
+   celt_int32 margins[JITTER_WINDOW];
+
+   int len[CELT_JITTER_MAX_PACKETS];
+   celt_uint32 timestamp[CELT_JITTER_MAX_PACKETS];
+   unsigned char data[CELT_JITTER_MAX_PACKETS][CELT_JITTER_MAX_BYTES];
+};
+
+int celt_jitter_get_size(void)
+{
+   return sizeof(CELTJitter);
+}
+
+CELTJitter *celt_jitter_create(int frame_size, int *error)
+{
+   CELTJitter *jb = (CELTJitter *)celt_alloc(celt_jitter_get_size());
+   if (jb!=NULL && celt_jitter_init(jb, frame_size, error)==NULL)
+   {
+      celt_jitter_destroy(jb);
+      jb = NULL;
+   }
+   return jb;
+}
+
+static void jitter_reset(CELTJitter *jb)
+{
+   int i;
+   CELT_MEMSET((char*)&jb->JITTER_RESET_START, 0,
+         sizeof(CELTJitter)-
+         ((char*)&jb->JITTER_RESET_START - (char*)jb));
+   for (i=0;i<CELT_JITTER_MAX_PACKETS;i++)
+      jb->len[i] = -1;
+}
+
+CELTJitter *celt_jitter_init(CELTJitter *jb, int frame_size, int *error)
+{
+   if (frame_size <= 0)
+   {
+      if (error)
+         *error = CELT_BAD_ARG;
+      return NULL;
+   }
+
+   if (jb==NULL)
+   {
+      if (error)
+         *error = CELT_ALLOC_FAIL;
+      return NULL;
+   }
+
+   jb->frame_size = frame_size;
+   jb->margin = 0;
+   jb->max_delay = (CELT_JITTER_MAX_PACKETS/2)*frame_size;
+   jitter_reset(jb);
+
+   if (error)
+      *error = CELT_OK;
+   return jb;
+}
+
+void celt_jitter_destroy(CELTJitter *jb)
+{
+   celt_free(jb);
+}
+
+static void jitter_shift(CELTJitter *jb, int shift)
+{
+   int i;
+   for (i=0;i<jb->nb_margins;i++)
+      jb->margins[i] += shift;
+}
+
+int celt_jitter_put(CELTJitter *jb, const unsigned char *data, int len, celt_uint32 timestamp)
+{
+   int i, slot;
+   celt_int32 margin;
+
+   if (data==NULL || len<0 || len>CELT_JITTER_MAX_BYTES)
+      return CELT_BAD_ARG;
+
+   margin = (celt_int32)(timestamp - jb->next_ts);
+   /* A timestamp jump larger than the buffer can hold means the sender
+      restarted: start over instead of waiting for the stream to catch up */
+   if (jb->started && (margin > CELT_JITTER_MAX_PACKETS*jb->frame_size
+         || margin < -CELT_JITTER_MAX_PACKETS*jb->frame_size))
+      jitter_reset(jb);
+   if (!jb->started)
+   {
+      jb->started = 1;
+      jb->next_ts = timestamp - jb->margin;
+      margin = jb->margin;
+   }
+
+   jb->margins[jb->margin_pos] = margin;
+   jb->margin_pos = (jb->margin_pos+1)%JITTER_WINDOW;
+   if (jb->nb_margins < JITTER_WINDOW)
+      jb->nb_margins++;
+
+   if (margin < 0)
+   {
+      jb->late++;
+      return CELT_OK;
+   }
+
+   slot = -1;
+   for (i=0;i<CELT_JITTER_MAX_PACKETS;i++)
+   {
+      if (jb->len[i] < 0)
+      {
+         if (slot < 0)
+            slot = i;
+      } else if (jb->timestamp[i] == timestamp)
+      {
+         /* Duplicate */
+         return CELT_OK;
+      }
+   }
+   if (slot < 0)
+      return CELT_BUFFER_TOO_SMALL;
+
+   CELT_COPY(jb->data[slot], data, len);
+   jb->len[slot] = len;
+   jb->timestamp[slot] = timestamp;
+   return CELT_OK;
+}
+
+/* Moves the playout point to the next frame and returns the slot holding
+   the packet to decode for it, or -1 if the frame has to be concealed. For
+   a missing packet, fec_slot is set to the slot of the following packet,
+   which may carry an FEC copy of the missing frame, or -1. */
+static int jitter_next(CELTJitter *jb, int *fec_slot)
+{
+   int i;
+   int slot=-1;
+   const int N = jb->frame_size;
+
+   *fec_slot = -1;
+   if (!jb->started)
+      return -1;
+
+   if (jb->nb_margins > 0)
+   {
+      celt_int32 min_margin, max_margin;
+      min_margin = max_margin = jb->margins[0];
+      for (i=1;i<jb->nb_margins;i++)
+      {
+         min_margin = MIN32(min_margin, jb->margins[i]);
+         max_margin = MAX32(max_margin, jb->margins[i]);
+      }
+      min_margin -= jb->margin;
+      if (min_margin < 0 && max_margin+N <= jb->max_delay)
+      {
+         jb->inserted++;
+         jitter_shift(jb, N);
+         return -1;
+      }
+      if (min_margin >= N && jb->nb_margins == JITTER_WINDOW)
+      {
+         for (i=0;i<CELT_JITTER_MAX_PACKETS;i++)
+            if (jb->len[i] >= 0 && jb->timestamp[i] == jb->next_ts)
+               jb->len[i] = -1;
+         jb->next_ts += N;
+         jb->dropped++;
+         jitter_shift(jb, -N);
+      }
+   }
+
+   /* Anything older than the playout point can no longer be used */
+   for (i=0;i<CELT_JITTER_MAX_PACKETS;i++)
+   {
+      if (jb->len[i] < 0)
+         continue;
+      if (jb->timestamp[i] == jb->next_ts)
+         slot = i;
+      else if (jb->timestamp[i] == jb->next_ts+N)
+         *fec_slot = i;
+      else if ((celt_int32)(jb->timestamp[i] - jb->next_ts) < 0)
+         jb->len[i] = -1;
+   }
+   if (slot < 0)
+      jb->underruns++;
+   jb->next_ts += N;
+   return slot;
+}
+
+int celt_jitter_decode(CELTJitter *jb, CELTDecoder *dec, celt_int16 *pcm)
+{
+   int ret, fec_slot;
+   int slot = jitter_next(jb, &fec_slot);
+   if (slot >= 0)
+   {
+      ret = old_celt_decode(dec, jb->data[slot], jb->len[slot], pcm, jb->frame_size);
+      jb->len[slot] = -1;
+   } else if (fec_slot >= 0)
+   {
+      ret = celt_decode_fec(dec, jb->data[fec_slot], jb->len[fec_slot], pcm, jb->frame_size);
+   } else {
+      ret = old_celt_decode(dec, NULL, 0, pcm, jb->frame_size);
+   }
+   return ret;
+}
+
+#ifndef DISABLE_FLOAT_API
+int celt_jitter_decode_float(CELTJitter *jb, CELTDecoder *dec, float *pcm)
+{
+   int ret, fec_slot;
+   int slot = jitter_next(jb, &fec_slot);
+   if (slot >= 0)
+   {
+      ret = celt_decode_float(dec, jb->data[slot], jb->len[slot], pcm, jb->frame_size);
+      jb->len[slot] = -1;
+   } else if (fec_slot >= 0)
+   {
+      ret = celt_decode_fec_float(dec, jb->data[fec_slot], jb->len[fec_slot], pcm, jb->frame_size);
+   } else {
+      ret = celt_decode_float(dec, NULL, 0, pcm, jb->frame_size);
+   }
+   return ret;
+}
+#endif /* DISABLE_FLOAT_API */
+
+int celt_jitter_ctl(CELTJitter *jb, int request, ...)
+{
+   va_list ap;
+
+   va_start(ap, request);
+   switch (request)
+   {
+      case CELT_JITTER_SET_MARGIN_REQUEST:
+      {
+         celt_int32 value = va_arg(ap, celt_int32);
+         if (value<0)
+            goto bad_arg;
+         jb->margin = value;
+      }
+      break;
+      case CELT_JITTER_SET_MAX_DELAY_REQUEST:
+      {
+         celt_int32 value = va_arg(ap, celt_int32);
+         if (value<0)
+            goto bad_arg;
+         jb->max_delay = value;
+      }
+      break;
+      case CELT_JITTER_GET_DELAY_REQUEST:
+      {
+         int *value = va_arg(ap, int*);
+         int i;
+         if (value==NULL)
+            goto bad_arg;
+         *value = 0;
+         for (i=0;i<jb->nb_margins;i++)
+            *value = IMAX(*value, jb->margins[i]);
+      }
+      break;
+      case CELT_JITTER_GET_UNDERRUNS_REQUEST:
+      {
+         int *value = va_arg(ap, int*);
+         if (value==NULL)
+            goto bad_arg;
+         *value = jb->underruns;
+      }
+      break;
+      case CELT_JITTER_GET_LATE_REQUEST:
+      {
+         int *value = va_arg(ap, int*);
+         if (value==NULL)
+            goto bad_arg;
+         *value = jb->late;
+      }
+      break;
+      case CELT_JITTER_GET_INSERTED_REQUEST:
+      {
+         int *value = va_arg(ap, int*);
+         if (value==NULL)
+            goto bad_arg;
+         *value = jb->inserted;
+      }
+      break;
+      case CELT_JITTER_GET_DROPPED_REQUEST:
+      {
+         int *value = va_arg(ap, int*);
+         if (value==NULL)
+            goto bad_arg;
+         *value = jb->dropped;
+      }
+      break;
+      case CELT_RESET_STATE:
+      {
+         jitter_reset(jb);
+      }
+      break;
+      default:
+         goto bad_request;
+   }
+   va_end(ap);
+   return CELT_OK;
+bad_arg:
+   va_end(ap);
+   return CELT_BAD_ARG;
+bad_request:
+   va_end(ap);
+   return CELT_UNIMPLEMENTED;
+}
@@ -0,0 +1,151 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+   
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+   
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+   
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/**
+  @file celt_jitter.h
+  @brief Adaptive jitter buffer feeding a CELT decoder
+ */
+
+#ifndef CELT_JITTER_H
+#define CELT_JITTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "celt.h"
+#include "celt_types.h"
+
+/** Maximum number of packets held by the jitter buffer */
+#define CELT_JITTER_MAX_PACKETS 64
+
+/** Maximum size of a packet held by the jitter buffer (in bytes) */
+#define CELT_JITTER_MAX_BYTES 1275
+
+/* Jitter buffer requests. All delays are in samples (per channel) */
+
+#define CELT_JITTER_SET_MARGIN_REQUEST 100
+/** Extra delay kept on top of what the measured jitter requires (default 0) */
+#define CELT_JITTER_SET_MARGIN(x) CELT_JITTER_SET_MARGIN_REQUEST, _celt_check_int(x)
+
+#define CELT_JITTER_SET_MAX_DELAY_REQUEST 102
+/** Delay above which the buffer stops growing and lets late packets go */
+#define CELT_JITTER_SET_MAX_DELAY(x) CELT_JITTER_SET_MAX_DELAY_REQUEST, _celt_check_int(x)
+
+#define CELT_JITTER_GET_DELAY_REQUEST 104
+/** Current delay added by the buffer, i.e. the longest time a recent
+    packet had to wait before being played */
+#define CELT_JITTER_GET_DELAY(x) CELT_JITTER_GET_DELAY_REQUEST, _celt_check_int_ptr(x)
+
+#define CELT_JITTER_GET_UNDERRUNS_REQUEST 106
+/** Number of frames concealed because their packet was not there in time */
+#define CELT_JITTER_GET_UNDERRUNS(x) CELT_JITTER_GET_UNDERRUNS_REQUEST, _celt_check_int_ptr(x)
+
+#define CELT_JITTER_GET_LATE_REQUEST 108
+/** Number of packets discarded because they arrived after their playout time */
+#define CELT_JITTER_GET_LATE(x) CELT_JITTER_GET_LATE_REQUEST, _celt_check_int_ptr(x)
+
+#define CELT_JITTER_GET_INSERTED_REQUEST 110
+/** Number of concealed frames inserted to grow the delay */
+#define CELT_JITTER_GET_INSERTED(x) CELT_JITTER_GET_INSERTED_REQUEST, _celt_check_int_ptr(x)
+
+#define CELT_JITTER_GET_DROPPED_REQUEST 112
+/** Number of frames skipped to shrink the delay */
+#define CELT_JITTER_GET_DROPPED(x) CELT_JITTER_GET_DROPPED_REQUEST, _celt_check_int_ptr(x)
+
+/** State of a jitter buffer. It sits in front of a decoder: packets are
+    put in as they arrive from the network and one frame of audio is taken
+    out each time the audio device needs one. Packets carry a timestamp in
+    samples, incremented by frame_size for every frame at the sender.
+    @brief Jitter buffer state
+ */
+typedef struct CELTJitter CELTJitter;
+
+EXPORT int celt_jitter_get_size(void);
+
+/** Creates a new jitter buffer.
+ @param frame_size Number of samples (per channel) in each packet
+ @param error Returns an error code
+ @return Newly created jitter buffer.
+ */
+EXPORT CELTJitter *celt_jitter_create(int frame_size, int *error);
+
+EXPORT CELTJitter *celt_jitter_init(CELTJitter *jb, int frame_size, int *error);
+
+/** Destroys a jitter buffer.
+ @param jb Jitter buffer to be destroyed
+ */
+EXPORT void celt_jitter_destroy(CELTJitter *jb);
+
+/** Adds a packet to the jitter buffer. Packets may arrive in any order;
+    duplicates and packets that arrive after their playout time are
+    discarded (the latter also make the buffer increase its delay).
+ @param jb Jitter buffer
+ @param data Compressed data produced by an encoder
+ @param len Number of bytes in "data"
+ @param timestamp Timestamp of the first sample of the packet
+ @return Error code.
+ */
+EXPORT int celt_jitter_put(CELTJitter *jb, const unsigned char *data, int len, celt_uint32 timestamp);
+
+/** Decodes the next frame of audio. If its packet is missing, the frame
+    is recovered from the FEC copy in the following packet when that one is
+    already there (see CELT_SET_FEC), or concealed otherwise. Must be called
+    once per frame_size samples of playback.
+ @param jb Jitter buffer
+ @param dec Decoder state for the stream
+ @param pcm One frame (frame_size samples per channel) of decoded PCM will be
+            returned here in 16-bit PCM format (native endian).
+ @return Number of samples decoded (per channel), or a negative error code.
+ */
+EXPORT int celt_jitter_decode(CELTJitter *jb, CELTDecoder *dec, celt_int16 *pcm);
+
+/** Decodes the next frame of audio. If its packet is missing, the frame
+    is recovered from the FEC copy in the following packet when that one is
+    already there (see CELT_SET_FEC), or concealed otherwise. Must be called
+    once per frame_size samples of playback.
+ @param jb Jitter buffer
+ @param dec Decoder state for the stream
+ @param pcm One frame (frame_size samples per channel) of decoded PCM will be
+            returned here in float format.
+ @return Number of samples decoded (per channel), or a negative error code.
+ */
+EXPORT int celt_jitter_decode_float(CELTJitter *jb, CELTDecoder *dec, float *pcm);
+
+/** Query and set jitter buffer parameters
+   @param jb Jitter buffer
+   @param request Parameter to change or query
+   @param value Pointer to a 32-bit int value
+   @return Error code
+ */
+EXPORT int celt_jitter_ctl(CELTJitter *jb, int request, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CELT_JITTER_H */
@@ -43,9 +43,12 @@
 #ifdef FIXED_POINT
 #define WORD16 INT16
 #define WORD32 INT32
+#define WORD16_EXACT INT16
 #else
 #define WORD16 FLOAT
 #define WORD32 FLOAT
+/* Enough digits for the value to be read back exactly */
+#define WORD16_EXACT "%.9g"
 #endif
 
 
@@ -77,6 +80,10 @@ void dump_modes(FILE *file, CELTMode **modes, int nb_modes)
          for (j=0;j<mode->nbEBands+2;j++)
             fprintf (file, "%d, ", mode->eBands[j]);
          fprintf (file, "};\n");
+         fprintf (file, "static const unsigned char binBand%d_%d[%d] = {\n", mode->Fs, mdctSize, mode->eBands[mode->nbEBands]);
+         for (j=0;j<mode->eBands[mode->nbEBands];j++)
+            fprintf (file, "%d, ", mode->binBand[j]);
+         fprintf (file, "};\n");
          fprintf(file, "#endif\n");
          fprintf(file, "\n");
       }
@@ -87,6 +94,10 @@ void dump_modes(FILE *file, CELTMode **modes, int nb_modes)
       for (j=0;j<mode->overlap;j++)
          fprintf (file, WORD16 ", ", mode->window[j]);
       fprintf (file, "};\n");
+      fprintf (file, "static const celt_word16 crossfade%d[%d] = {\n", mode->overlap, mode->overlap);
+      for (j=0;j<mode->overlap;j++)
+         fprintf (file, WORD16_EXACT ", ", mode->crossfade[j]);
+      fprintf (file, "};\n");
       fprintf(file, "#endif\n");
       fprintf(file, "\n");
       
@@ -212,6 +223,10 @@ void dump_modes(FILE *file, CELTMode **modes, int nb_modes)
          fprintf(file, "eband5ms,\t/* eBands */\n");
       else
          fprintf(file, "eBands%d_%d,\t/* eBands */\n", mode->Fs, mdctSize);
+      if (standard)
+         fprintf(file, "bin_band5ms,\t/* binBand */\n");
+      else
+         fprintf(file, "binBand%d_%d,\t/* binBand */\n", mode->Fs, mdctSize);
       fprintf(file, "%d,\t/* nbAllocVectors */\n", mode->nbAllocVectors);
       if (standard)
          fprintf(file, "band_allocation,\t/* allocVectors */\n");
@@ -224,6 +239,7 @@ void dump_modes(FILE *file, CELTMode **modes, int nb_modes)
       fprintf (file, "}, mdct_twiddles%d},\t/* mdct */\n", mdctSize);
 
       fprintf(file, "window%d,\t/* window */\n", mode->overlap);
+      fprintf(file, "crossfade%d,\t/* crossfade */\n", mode->overlap);
       fprintf(file, "%d,\t/* maxLM */\n", mode->maxLM);
       fprintf(file, "%d,\t/* nbShortMdcts */\n", mode->nbShortMdcts);
       fprintf(file, "%d,\t/* shortMdctSize */\n", mode->shortMdctSize);
@@ -45,15 +45,11 @@ unsigned celtisqrt32(celt_uint32 _val);
 
 #ifndef FIXED_POINT
 
-#define celt_sqrt(x) ((float)sqrt(x))
-#define celt_rsqrt(x) (1.f/celt_sqrt(x))
 #define celt_rsqrt_norm(x) (celt_rsqrt(x))
 #define celt_acos acos
 #define celt_exp exp
 #define celt_cos_norm(x) ((float)cos((.5f*M_PI)*(x)))
 #define celt_atan atan
-#define celt_rcp(x) (1.f/(x))
-#define celt_div(a,b) ((a)/(b))
 #define frac_div32(a,b) ((float)(a)/(b))
 
 #ifdef FLOAT_APPROX
@@ -61,6 +57,62 @@ unsigned celtisqrt32(celt_uint32 _val);
 /* Note: This assumes radix-2 floating point with the exponent at bits 23..30 and an offset of 127
          denorm, +/- inf and NaN are *not* handled */
 
+/* None of these branch or call libm, so loops using them can be vectorised */
+
+/** Reciprocal square root approximation (1/sqrt(x)): initial guess from the
+    exponent bits, then two Newton steps (relative error below 5e-6) */
+static inline float celt_rsqrt(float x)
+{
+   float y;
+   union {
+      float f;
+      celt_uint32 i;
+   } in;
+   in.f = x;
+   in.i = 0x5f3759df - (in.i>>1);
+   y = in.f;
+   y = y*(1.5f - .5f*x*y*y);
+   y = y*(1.5f - .5f*x*y*y);
+   return y;
+}
+
+/** Square root approximation. Exact for x=0. */
+static inline float celt_sqrt(float x)
+{
+   return x*celt_rsqrt(x);
+}
+
+/** Reciprocal approximation (1/x): initial guess from the exponent bits,
+    then three Newton steps */
+static inline float celt_rcp(float x)
+{
+   float y;
+   union {
+      float f;
+      celt_uint32 i;
+   } in;
+   in.f = x;
+   in.i = 0x7ef311c7 - in.i;
+   y = in.f;
+   y = y*(2.f - x*y);
+   y = y*(2.f - x*y);
+   y = y*(2.f - x*y);
+   return y;
+}
+
+#define celt_div(a,b) ((a)*celt_rcp(b))
+
+/** atan2() approximation for positive inputs, with the same polynomial as
+    the fixed-point version (error below 2.5e-4) */
+static inline float celt_atan2p(float y, float x)
+{
+   float r;
+   int swap = y > x;
+   r = swap ? x*celt_rcp(y) : y*celt_rcp(x);
+   r = r*(0.99996948f + r*(-0.00064087f + r*(-0.36447144f + 0.15063477f*r)));
+   return swap ? 1.5707963f - r : r;
+}
+
 /** Base-2 log approximation (log2(x)). */
 static inline float celt_log2(float x)
 {
@@ -88,18 +140,23 @@ static inline float celt_exp2(float x)
       float f;
       celt_uint32 i;
    } res;
-   integer = floor(x);
-   if (integer < -50)
-      return 0;
+   /* floor() without the libm call */
+   integer = (int)x;
+   integer -= x < integer;
    frac = x-integer;
    /* K0 = 1, K1 = log(2), K2 = 3-4*log(2), K3 = 3*log(2) - 2 */
    res.f = 0.99992522f + frac * (0.69583354f
            + frac * (0.22606716f + 0.078024523f*frac));
-   res.i = (res.i + (integer<<23)) & 0x7fffffff;
-   return res.f;
+   res.i = (res.i + ((celt_uint32)integer<<23)) & 0x7fffffff;
+   return integer < -50 ? 0 : res.f;
 }
 
 #else
+#define celt_sqrt(x) ((float)sqrt(x))
+#define celt_rsqrt(x) (1.f/celt_sqrt(x))
+#define celt_rcp(x) (1.f/(x))
+#define celt_div(a,b) ((a)/(b))
+#define celt_atan2p(y,x) atan2(y,x)
 #define celt_log2(x) ((float)(1.442695040888963387*log(x)))
 #define celt_exp2(x) ((float)exp(0.6931471805599453094*(x)))
 #endif
@@ -43,6 +43,15 @@ static const celt_int16 eband5ms[] = {
   0,  1,  2,  3,  4,  5,  6,  7,  8, 10, 12, 14, 16, 20, 24, 28, 34, 40, 48, 60, 78, 100
 };
 
+/* Band that each bin of eband5ms belongs to */
+static const unsigned char bin_band5ms[100] = {
+   0,  1,  2,  3,  4,  5,  6,  7,  8,  8,  9,  9, 10, 10, 11, 11, 12, 12, 12, 12,
+  13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15, 15, 15, 16, 16, 16, 16, 16, 16,
+  17, 17, 17, 17, 17, 17, 17, 17, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18,
+  19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 20, 20,
+  20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20
+};
+
 /* Alternate tuning (partially derived from Vorbis) */
 #define BITALLOC_SIZE 11
 /* Bit allocation table in units of 1/32 bit/sample (0.1875 dB SNR) */
@@ -228,6 +237,8 @@ CELTMode *celt_mode_create(celt_int32 Fs, int frame_size, int *error)
    CELTMode *mode=NULL;
    int res;
    celt_word16 *window;
+   celt_word16 *crossfade;
+   unsigned char *binBand;
    celt_int16 *logN;
    int LM;
    ALLOC_STACK;
@@ -347,6 +358,17 @@ CELTMode *celt_mode_create(celt_int32 Fs, int frame_size, int *error)
    if (mode->eBands==NULL)
       goto failure;
 
+   binBand = (unsigned char*)celt_alloc(mode->eBands[mode->nbEBands]*sizeof(unsigned char));
+   if (binBand==NULL)
+      goto failure;
+   for (i=0;i<mode->nbEBands;i++)
+   {
+      int j;
+      for (j=mode->eBands[i];j<mode->eBands[i+1];j++)
+         binBand[j] = i;
+   }
+   mode->binBand = binBand;
+
    mode->effEBands = mode->nbEBands;
    while (mode->eBands[mode->effEBands] > mode->shortMdctSize)
       mode->effEBands--;
@@ -371,6 +393,13 @@ CELTMode *celt_mode_create(celt_int32 Fs, int frame_size, int *error)
 #endif
    mode->window = window;
 
+   crossfade = (celt_word16*)celt_alloc(mode->overlap*sizeof(celt_word16));
+   if (crossfade==NULL)
+      goto failure;
+   for (i=0;i<mode->overlap;i++)
+      crossfade[i] = MULT16_16_Q15(window[i], window[i]);
+   mode->crossfade = crossfade;
+
    logN = (celt_int16*)celt_alloc(mode->nbEBands*sizeof(celt_int16));
    if (logN==NULL)
       goto failure;
@@ -418,9 +447,11 @@ void celt_mode_destroy(CELTMode *mode)
    }
 #endif /* CUSTOM_MODES_ONLY */
    celt_free((celt_int16*)mode->eBands);
+   celt_free((unsigned char*)mode->binBand);
    celt_free((celt_int16*)mode->allocVectors);
    
    celt_free((celt_word16*)mode->window);
+   celt_free((celt_word16*)mode->crossfade);
    celt_free((celt_int16*)mode->logN);
 
    celt_free((celt_int16*)mode->cache.index);
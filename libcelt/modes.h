@@ -75,6 +75,7 @@ struct CELTMode {
    int          effEBands;
    celt_word16    preemph[4];
    const celt_int16   *eBands;   /**< Definition for each "pseudo-critical band" */
+   const unsigned char *binBand; /**< Band each bin belongs to (for LM=0) */
    
    int          nbAllocVectors; /**< Number of lines in the matrix below */
    const unsigned char   *allocVectors;   /**< Number of bits in each band for several rates */
@@ -83,6 +84,7 @@ struct CELTMode {
    mdct_lookup mdct;
 
    const celt_word16 *window;
+   const celt_word16 *crossfade; /**< window[i]^2, used to switch comb filters */
 
    int         maxLM;
    int         nbShortMdcts;
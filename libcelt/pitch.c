@@ -103,9 +103,6 @@ void celtpitch_downsample(celt_sig * restrict x[], celt_word16 * restrict x_lp,
       int len, int _C)
 {
    int i;
-   celt_word32 ac[5];
-   celt_word16 tmp=Q15ONE;
-   celt_word16 lpc[4], mem[4]={0,0,0,0};
    const int C = CHANNELS(_C);
    for (i=1;i<len>>1;i++)
       x_lp[i] = SHR32(HALF32(HALF32(x[0][(2*i-1)]+x[0][(2*i+1)])+x[0][2*i]), SIG_SHIFT+3);
@@ -116,9 +113,18 @@ void celtpitch_downsample(celt_sig * restrict x[], celt_word16 * restrict x_lp,
          x_lp[i] += SHR32(HALF32(HALF32(x[1][(2*i-1)]+x[1][(2*i+1)])+x[1][2*i]), SIG_SHIFT+3);
       x_lp[0] += SHR32(HALF32(HALF32(x[1][1])+x[1][0]), SIG_SHIFT+3);
    }
+   celtpitch_whiten(x_lp, len>>1);
+}
+
+void celtpitch_whiten(celt_word16 * restrict x_lp, int len)
+{
+   int i;
+   celt_word32 ac[5];
+   celt_word16 tmp=Q15ONE;
+   celt_word16 lpc[4], mem[4]={0,0,0,0};
 
    _old_celt_autocorr(x_lp, ac, NULL, 0,
-                  4, len>>1);
+                  4, len);
 
    /* Noise floor -40 dB */
 #ifdef FIXED_POINT
@@ -143,11 +149,11 @@ void celtpitch_downsample(celt_sig * restrict x[], celt_word16 * restrict x_lp,
       tmp = MULT16_16_Q15(QCONST16(.9f,15), tmp);
       lpc[i] = MULT16_16_Q15(lpc[i], tmp);
    }
-   fir(x_lp, lpc, x_lp, len>>1, 4, mem);
+   fir(x_lp, lpc, x_lp, len, 4, mem);
 
    mem[0]=0;
    lpc[0]=QCONST16(.8f,12);
-   fir(x_lp, lpc, x_lp, len>>1, 1, mem);
+   fir(x_lp, lpc, x_lp, len, 1, mem);
 
 }
 
@@ -40,6 +40,9 @@
 void celtpitch_downsample(celt_sig * restrict x[], celt_word16 * restrict x_lp,
       int len, int _C);
 
+/* Whitens an already decimated signal (second half of celtpitch_downsample) */
+void celtpitch_whiten(celt_word16 * restrict x_lp, int len);
+
 void celtpitch_search(const celt_word16 * restrict x_lp, celt_word16 * restrict y,
                   int len, int max_pitch, int *pitch);
 
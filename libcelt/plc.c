@@ -98,21 +98,48 @@ void fir(const celt_word16 *x,
          celt_word16 *mem)
 {
    int i,j;
+   VARDECL(celt_word16, buf);
+   SAVE_STACK;
 
+   /* The history and the input are kept in one linear buffer so the filter
+      memory never has to be shifted, and four outputs are computed at once.
+      The products are accumulated in the same order as the direct form, so
+      the output is unchanged. */
+   ALLOC(buf, N+ord, celt_word16);
+   for (i=0;i<ord;i++)
+      buf[i] = mem[ord-1-i];
    for (i=0;i<N;i++)
+      buf[ord+i] = x[i];
+   for (i=0;i<N-3;i+=4)
    {
-      celt_word32 sum = SHL32(EXTEND32(x[i]), SIG_SHIFT);
+      const celt_word16 *xx = buf+ord+i;
+      celt_word32 sum0 = SHL32(EXTEND32(xx[0]), SIG_SHIFT);
+      celt_word32 sum1 = SHL32(EXTEND32(xx[1]), SIG_SHIFT);
+      celt_word32 sum2 = SHL32(EXTEND32(xx[2]), SIG_SHIFT);
+      celt_word32 sum3 = SHL32(EXTEND32(xx[3]), SIG_SHIFT);
       for (j=0;j<ord;j++)
       {
-         sum += MULT16_16(num[j],mem[j]);
-      }
-      for (j=ord-1;j>=1;j--)
-      {
-         mem[j]=mem[j-1];
+         sum0 += MULT16_16(num[j],xx[-1-j]);
+         sum1 += MULT16_16(num[j],xx[-j]);
+         sum2 += MULT16_16(num[j],xx[1-j]);
+         sum3 += MULT16_16(num[j],xx[2-j]);
       }
-      mem[0] = x[i];
+      y[i  ] = ROUND16(sum0, SIG_SHIFT);
+      y[i+1] = ROUND16(sum1, SIG_SHIFT);
+      y[i+2] = ROUND16(sum2, SIG_SHIFT);
+      y[i+3] = ROUND16(sum3, SIG_SHIFT);
+   }
+   for (;i<N;i++)
+   {
+      const celt_word16 *xx = buf+ord+i;
+      celt_word32 sum = SHL32(EXTEND32(xx[0]), SIG_SHIFT);
+      for (j=0;j<ord;j++)
+         sum += MULT16_16(num[j],xx[-1-j]);
       y[i] = ROUND16(sum, SIG_SHIFT);
    }
+   for (i=0;i<ord;i++)
+      mem[i] = buf[N+ord-1-i];
+   RESTORE_STACK;
 }
 
 void iir(const celt_word32 *x,
@@ -123,20 +150,26 @@ void iir(const celt_word32 *x,
          celt_word16 *mem)
 {
    int i,j;
+   VARDECL(celt_word16, buf);
+   SAVE_STACK;
+
+   /* Same as fir(): the past outputs are kept in a linear buffer instead of
+      being shifted through the memory on every sample */
+   ALLOC(buf, N+ord, celt_word16);
+   for (i=0;i<ord;i++)
+      buf[i] = mem[ord-1-i];
    for (i=0;i<N;i++)
    {
+      const celt_word16 *yy = buf+ord+i;
       celt_word32 sum = x[i];
       for (j=0;j<ord;j++)
-      {
-         sum -= MULT16_16(den[j],mem[j]);
-      }
-      for (j=ord-1;j>=1;j--)
-      {
-         mem[j]=mem[j-1];
-      }
-      mem[0] = ROUND16(sum,SIG_SHIFT);
+         sum -= MULT16_16(den[j],yy[-1-j]);
+      buf[ord+i] = ROUND16(sum,SIG_SHIFT);
       y[i] = sum;
    }
+   for (i=0;i<ord;i++)
+      mem[i] = buf[N+ord-1-i];
+   RESTORE_STACK;
 }
 
 void _old_celt_autocorr(
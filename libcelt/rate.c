@@ -247,28 +247,31 @@ void compute_pulse_cache(CELTMode *m, int LM)
 
 #define ALLOC_STEPS 6
 
-static inline int interp_bits2pulses(const CELTMode *m, int start, int end, int skip_start,
-      const int *bits1, const int *bits2, const int *thresh, const int *cap, celt_int32 total, celt_int32 *_balance,
-      int skip_rsv, int *intensity, int intensity_rsv, int *dual_stereo, int dual_stereo_rsv, int *bits,
-      int *ebits, int *fine_priority, int _C, int LM, ec_ctx *ec, int encode, int prev)
+/* Narrows [*min_total, *max_total) down to the totals for which psum > total
+   gives the same answer as for total */
+static inline void bisection_range(celt_int32 psum, celt_int32 total, celt_int32 *min_total, celt_int32 *max_total)
+{
+   if (psum > total)
+      *max_total = IMIN(*max_total, psum);
+   else
+      *min_total = IMAX(*min_total, psum);
+}
+
+/* Finds where to interpolate between bits1 and bits2 so that the bands fit in
+   total and returns the bits that takes, with the allocation of each band in
+   bits */
+static inline celt_int32 interp_bisection(int start, int end, const int *bits1, const int *bits2,
+      const int *thresh, const int *cap, celt_int32 total, int *bits, int C,
+      celt_int32 *min_total, celt_int32 *max_total)
 {
    celt_int32 psum;
    int lo, hi;
    int i, j;
-   int logM;
-   const int C = CHANNELS(_C);
-   int stereo;
-   int codedBands=-1;
    int alloc_floor;
-   celt_int32 left, percoeff;
    int done;
-   int balance;
-   SAVE_STACK;
 
    alloc_floor = C<<BITRES;
-   stereo = C>1;
 
-   logM = LM<<BITRES;
    lo = 0;
    hi = 1<<ALLOC_STEPS;
    for (i=0;i<ALLOC_STEPS;i++)
@@ -289,6 +292,7 @@ static inline int interp_bits2pulses(const CELTMode *m, int start, int end, int
                psum += alloc_floor;
          }
       }
+      bisection_range(psum, total, min_total, max_total);
       if (psum > total)
          hi = mid;
       else
@@ -313,6 +317,28 @@ static inline int interp_bits2pulses(const CELTMode *m, int start, int end, int
       bits[j] = tmp;
       psum += tmp;
    }
+   return psum;
+}
+
+static inline int interp_bits2pulses(const CELTMode *m, int start, int end, int skip_start,
+      const int *thresh, const int *cap, celt_int32 total, celt_int32 psum, celt_int32 *_balance,
+      int skip_rsv, int *intensity, int intensity_rsv, int *dual_stereo, int dual_stereo_rsv, int *bits,
+      int *ebits, int *fine_priority, int _C, int LM, ec_ctx *ec, int encode, int prev)
+{
+   int j;
+   int logM;
+   const int C = CHANNELS(_C);
+   int stereo;
+   int codedBands=-1;
+   int alloc_floor;
+   celt_int32 left, percoeff;
+   int balance;
+   SAVE_STACK;
+
+   alloc_floor = C<<BITRES;
+   stereo = C>1;
+
+   logM = LM<<BITRES;
 
    /* Decide which bands to skip, working backwards from the end. */
    for (codedBands=end;;codedBands--)
@@ -522,51 +548,23 @@ static inline int interp_bits2pulses(const CELTMode *m, int start, int end, int
    return codedBands;
 }
 
-int compute_allocation(const CELTMode *m, int start, int end, const int *offsets, const int *cap, int alloc_trim, int *intensity, int *dual_stereo,
-      celt_int32 total, celt_int32 *balance, int *pulses, int *ebits, int *fine_priority, int _C, int LM, ec_ctx *ec, int encode, int prev)
+/* Interpolates between the two allocation vectors that bracket total, giving
+   bits1 + x*bits2 for 0<=x<1 as the allocation of each band. The result only
+   depends on total through the comparisons made by the bisection, so it's
+   the same for any total in [*min_total, *max_total). */
+static void interp_bounds(const CELTMode *m, int start, int end, const int *offsets, const int *cap,
+      const int *thresh, int alloc_trim, celt_int32 total, int *bits1, int *bits2, int *skip_start,
+      int C, int LM, celt_int32 *min_total, celt_int32 *max_total)
 {
    int lo, hi, len, j;
-   const int C = CHANNELS(_C);
-   int codedBands;
-   int skip_start;
-   int skip_rsv;
-   int intensity_rsv;
-   int dual_stereo_rsv;
-   VARDECL(int, bits1);
-   VARDECL(int, bits2);
-   VARDECL(int, thresh);
    VARDECL(int, trim_offset);
    SAVE_STACK;
-   
-   total = IMAX(total, 0);
+
    len = m->nbEBands;
-   skip_start = start;
-   /* Reserve a bit to signal the end of manually skipped bands. */
-   skip_rsv = total >= 1<<BITRES ? 1<<BITRES : 0;
-   total -= skip_rsv;
-   /* Reserve bits for the intensity and dual stereo parameters. */
-   intensity_rsv = dual_stereo_rsv = 0;
-   if (C==2)
-   {
-      intensity_rsv = LOG2_FRAC_TABLE[end-start];
-      if (intensity_rsv>total)
-         intensity_rsv = 0;
-      else
-      {
-         total -= intensity_rsv;
-         dual_stereo_rsv = total>=1<<BITRES ? 1<<BITRES : 0;
-         total -= dual_stereo_rsv;
-      }
-   }
-   ALLOC(bits1, len, int);
-   ALLOC(bits2, len, int);
-   ALLOC(thresh, len, int);
    ALLOC(trim_offset, len, int);
 
    for (j=start;j<end;j++)
    {
-      /* Below this threshold, we're sure not to allocate any PVQ bits */
-      thresh[j] = IMAX((C)<<BITRES, (3*(m->eBands[j+1]-m->eBands[j])<<LM<<BITRES)>>4);
       /* Tilt of the allocation curve */
       trim_offset[j] = C*(m->eBands[j+1]-m->eBands[j])*(alloc_trim-5-LM)*(end-j-1)
             <<(LM+BITRES)>>6;
@@ -575,12 +573,14 @@ int compute_allocation(const CELTMode *m, int start, int end, const int *offsets
       if ((m->eBands[j+1]-m->eBands[j])<<LM==1)
          trim_offset[j] -= C<<BITRES;
    }
+   *min_total = 0;
+   *max_total = 0x7fffffff;
    lo = 1;
    hi = m->nbAllocVectors - 1;
    do
    {
       int done = 0;
-      int psum = 0;
+      celt_int32 psum = 0;
       int mid = (lo+hi) >> 1;
       for (j=end;j-->start;)
       {
@@ -600,6 +600,7 @@ int compute_allocation(const CELTMode *m, int start, int end, const int *offsets
                psum += C<<BITRES;
          }
       }
+      bisection_range(psum, total, min_total, max_total);
       if (psum > total)
          hi = mid - 1;
       else
@@ -609,6 +610,7 @@ int compute_allocation(const CELTMode *m, int start, int end, const int *offsets
    while (lo <= hi);
    hi = lo--;
    /*printf ("interp between %d and %d\n", lo, hi);*/
+   *skip_start = start;
    for (j=start;j<end;j++)
    {
       int bits1j, bits2j;
@@ -624,15 +626,114 @@ int compute_allocation(const CELTMode *m, int start, int end, const int *offsets
          bits1j += offsets[j];
       bits2j += offsets[j];
       if (offsets[j]>0)
-         skip_start = j;
+         *skip_start = j;
       bits2j = IMAX(0,bits2j-bits1j);
       bits1[j] = bits1j;
       bits2[j] = bits2j;
    }
-   codedBands = interp_bits2pulses(m, start, end, skip_start, bits1, bits2, thresh, cap,
-         total, balance, skip_rsv, intensity, intensity_rsv, dual_stereo, dual_stereo_rsv,
+   RESTORE_STACK;
+}
+
+int compute_allocation(const CELTMode *m, AllocCache *cache, int start, int end, const int *offsets, const int *cap, int alloc_trim, int *intensity, int *dual_stereo,
+      celt_int32 total, celt_int32 *balance, int *pulses, int *ebits, int *fine_priority, int _C, int LM, ec_ctx *ec, int encode, int prev)
+{
+   int j;
+   const int C = CHANNELS(_C);
+   int codedBands;
+   int skip_start;
+   int skip_rsv;
+   int intensity_rsv;
+   int dual_stereo_rsv;
+   int hit=0;
+   celt_int32 psum;
+   VARDECL(int, thresh);
+   SAVE_STACK;
+   
+   total = IMAX(total, 0);
+   /* Reserve a bit to signal the end of manually skipped bands. */
+   skip_rsv = total >= 1<<BITRES ? 1<<BITRES : 0;
+   total -= skip_rsv;
+   /* Reserve bits for the intensity and dual stereo parameters. */
+   intensity_rsv = dual_stereo_rsv = 0;
+   if (C==2)
+   {
+      intensity_rsv = LOG2_FRAC_TABLE[end-start];
+      if (intensity_rsv>total)
+         intensity_rsv = 0;
+      else
+      {
+         total -= intensity_rsv;
+         dual_stereo_rsv = total>=1<<BITRES ? 1<<BITRES : 0;
+         total -= dual_stereo_rsv;
+      }
+   }
+   ALLOC(thresh, m->nbEBands, int);
+
+   for (j=start;j<end;j++)
+   {
+      /* Below this threshold, we're sure not to allocate any PVQ bits */
+      thresh[j] = IMAX((C)<<BITRES, (3*(m->eBands[j+1]-m->eBands[j])<<LM<<BITRES)>>4);
+   }
+
+   if (cache!=NULL && end<=ALLOC_CACHE_BANDS)
+   {
+      /* The caps only depend on the mode, LM and C, so this is everything
+         the allocation depends on before the skipping */
+      cache->lookups++;
+      hit = cache->valid && cache->alloc_trim==alloc_trim && cache->start==start
+            && cache->end==end && cache->C==C && cache->LM==LM
+            && total>=cache->interp_min && total<cache->interp_max;
+      for (j=start;j<end && hit;j++)
+         hit = cache->offsets[j]==offsets[j];
+      if (hit)
+      {
+         cache->hits++;
+      } else {
+         interp_bounds(m, start, end, offsets, cap, thresh, alloc_trim, total,
+               cache->bits1, cache->bits2, &cache->skip_start, C, LM,
+               &cache->interp_min, &cache->interp_max);
+         cache->valid = 1;
+         cache->alloc_trim = alloc_trim;
+         cache->start = start;
+         cache->end = end;
+         cache->C = C;
+         cache->LM = LM;
+         for (j=start;j<end;j++)
+            cache->offsets[j] = offsets[j];
+         /* Force the bisection below */
+         cache->bisect_min = cache->bisect_max = 0;
+      }
+      /* The bisection is often the same as well */
+      if (total>=cache->bisect_min && total<cache->bisect_max)
+      {
+         for (j=start;j<end;j++)
+            pulses[j] = cache->bits[j];
+         psum = cache->psum;
+      } else {
+         cache->bisect_min = 0;
+         cache->bisect_max = 0x7fffffff;
+         psum = interp_bisection(start, end, cache->bits1, cache->bits2, thresh, cap, total,
+               pulses, C, &cache->bisect_min, &cache->bisect_max);
+         for (j=start;j<end;j++)
+            cache->bits[j] = pulses[j];
+         cache->psum = psum;
+      }
+      skip_start = cache->skip_start;
+   } else {
+      celt_int32 min_total, max_total;
+      VARDECL(int, bits1);
+      VARDECL(int, bits2);
+      ALLOC(bits1, m->nbEBands, int);
+      ALLOC(bits2, m->nbEBands, int);
+      interp_bounds(m, start, end, offsets, cap, thresh, alloc_trim, total,
+            bits1, bits2, &skip_start, C, LM, &min_total, &max_total);
+      psum = interp_bisection(start, end, bits1, bits2, thresh, cap, total,
+            pulses, C, &min_total, &max_total);
+   }
+
+   codedBands = interp_bits2pulses(m, start, end, skip_start, thresh, cap,
+         total, psum, balance, skip_rsv, intensity, intensity_rsv, dual_stereo, dual_stereo_rsv,
          pulses, ebits, fine_priority, C, LM, ec, encode, prev);
    RESTORE_STACK;
    return codedBands;
 }
-
@@ -88,19 +88,48 @@ static inline int pulses2bits(const CELTMode *m, int band, int LM, int pulses)
    return pulses == 0 ? 0 : cache[pulses]+1;
 }
 
+/* Largest number of bands an AllocCache can hold */
+#define ALLOC_CACHE_BANDS 32
+
+/** Allocation of the last frame before the band skipping. The
+    interpolation between the allocation vectors is reused as long as the
+    trim and the dynalloc offsets don't change (e.g. CBR without boosts) and
+    the bits available lead the bisection over the vectors to the same
+    result, and likewise for the bisection of the interpolation. Zero means
+    empty. */
+typedef struct {
+   int valid;
+   int alloc_trim;
+   int start, end;
+   int C, LM;
+   int offsets[ALLOC_CACHE_BANDS];
+   celt_int32 interp_min;    /* Totals that give the same interpolation */
+   celt_int32 interp_max;
+   int bits1[ALLOC_CACHE_BANDS];
+   int bits2[ALLOC_CACHE_BANDS];
+   int skip_start;
+   celt_int32 bisect_min;    /* Totals that give the same bisection */
+   celt_int32 bisect_max;
+   int bits[ALLOC_CACHE_BANDS];
+   celt_int32 psum;
+   celt_uint32 lookups;      /* Both wrap around rather than overflow */
+   celt_uint32 hits;         /* Lookups that reused the interpolation */
+} AllocCache;
+
 /** Computes a cache of the pulses->bits mapping in each band */
 celt_int16 **compute_alloc_cache(CELTMode *m, int M);
 
 /** Compute the pulse allocation, i.e. how many pulses will go in each
   * band. 
  @param m mode
+ @param cache Allocation of the previous frame, or NULL
  @param offsets Requested increase or decrease in the number of bits for
                 each band
  @param total Number of bands
  @param pulses Number of pulses per band (returned)
  @return Total number of bits allocated
 */
-int compute_allocation(const CELTMode *m, int start, int end, const int *offsets, const int *cap, int alloc_trim, int *intensity, int *dual_stero,
+int compute_allocation(const CELTMode *m, AllocCache *cache, int start, int end, const int *offsets, const int *cap, int alloc_trim, int *intensity, int *dual_stero,
       celt_int32 total, celt_int32 *balance, int *pulses, int *ebits, int *fine_priority, int _C, int LM, ec_ctx *ec, int encode, int prev);
 
 
@@ -7,6 +7,8 @@
 #define DEF_WINDOW120
 static const celt_word16 window120[120] = {
 2, 20, 55, 108, 178, 266, 372, 494, 635, 792, 966, 1157, 1365, 1590, 1831, 2089, 2362, 2651, 2956, 3276, 3611, 3961, 4325, 4703, 5094, 5499, 5916, 6346, 6788, 7241, 7705, 8179, 8663, 9156, 9657, 10167, 10684, 11207, 11736, 12271, 12810, 13353, 13899, 14447, 14997, 15547, 16098, 16648, 17197, 17744, 18287, 18827, 19363, 19893, 20418, 20936, 21447, 21950, 22445, 22931, 23407, 23874, 24330, 24774, 25208, 25629, 26039, 26435, 26819, 27190, 27548, 27893, 28224, 28541, 28845, 29135, 29411, 29674, 29924, 30160, 30384, 30594, 30792, 30977, 31151, 31313, 31463, 31602, 31731, 31849, 31958, 32057, 32148, 32229, 32303, 32370, 32429, 32481, 32528, 32568, 32604, 32634, 32661, 32683, 32701, 32717, 32729, 32740, 32748, 32754, 32758, 32762, 32764, 32766, 32767, 32767, 32767, 32767, 32767, 32767, };
+static const celt_word16 crossfade120[120] = {
+0, 0, 0, 0, 0, 2, 4, 7, 12, 19, 28, 40, 56, 77, 102, 133, 170, 214, 266, 327, 397, 478, 570, 674, 791, 922, 1068, 1228, 1406, 1600, 1811, 2041, 2290, 2558, 2845, 3154, 3483, 3832, 4203, 4595, 5007, 5441, 5895, 6369, 6863, 7376, 7908, 8458, 9025, 9608, 10205, 10817, 11441, 12076, 12722, 13376, 14037, 14703, 15374, 16047, 16720, 17394, 18064, 18730, 19392, 20045, 20691, 21325, 21950, 22561, 23159, 23743, 24310, 24859, 25391, 25904, 26397, 26872, 27326, 27759, 28173, 28564, 28935, 29283, 29613, 29922, 30209, 30477, 30726, 30955, 31168, 31361, 31539, 31698, 31844, 31976, 32093, 32196, 32289, 32369, 32440, 32500, 32554, 32598, 32634, 32666, 32690, 32712, 32728, 32740, 32748, 32756, 32760, 32764, 32766, 32766, 32766, 32766, 32766, 32766, };
 #endif
 
 #ifndef DEF_LOGN400
@@ -112,10 +114,12 @@ static const CELTMode mode48000_960_120 = {
 21,	/* effEBands */
 {27853, 0, 4096, 8192, },	/* preemph */
 eband5ms,	/* eBands */
+bin_band5ms,	/* binBand */
 11,	/* nbAllocVectors */
 band_allocation,	/* allocVectors */
 {1920, 3, {&fft_state48000_960_0, &fft_state48000_960_1, &fft_state48000_960_2, &fft_state48000_960_3, }, mdct_twiddles960},	/* mdct */
 window120,	/* window */
+crossfade120,	/* crossfade */
 3,	/* maxLM */
 8,	/* nbShortMdcts */
 120,	/* shortMdctSize */
@@ -7,6 +7,8 @@
 #define DEF_WINDOW120
 static const celt_word16 window120[120] = {
 0.000067, 0.000606, 0.001682, 0.003295, 0.005444, 0.008128, 0.011344, 0.015091, 0.019365, 0.024164, 0.029483, 0.035320, 0.041669, 0.048525, 0.055884, 0.063738, 0.072082, 0.080907, 0.090208, 0.099974, 0.110198, 0.120869, 0.131977, 0.143512, 0.155462, 0.167814, 0.180555, 0.193673, 0.207152, 0.220977, 0.235132, 0.249602, 0.264369, 0.279414, 0.294720, 0.310268, 0.326038, 0.342009, 0.358162, 0.374474, 0.390925, 0.407491, 0.424152, 0.440884, 0.457665, 0.474471, 0.491280, 0.508068, 0.524813, 0.541491, 0.558080, 0.574557, 0.590900, 0.607088, 0.623100, 0.638913, 0.654509, 0.669868, 0.684971, 0.699800, 0.714339, 0.728571, 0.742480, 0.756054, 0.769279, 0.782143, 0.794634, 0.806744, 0.818465, 0.829787, 0.840707, 0.851218, 0.861317, 0.871002, 0.880271, 0.889125, 0.897564, 0.905591, 0.913209, 0.920423, 0.927237, 0.933660, 0.939697, 0.945357, 0.950649, 0.955584, 0.960171, 0.964422, 0.968349, 0.971963, 0.975279, 0.978309, 0.981066, 0.983565, 0.985819, 0.987842, 0.989649, 0.991253, 0.992669, 0.993910, 0.994990, 0.995923, 0.996722, 0.997399, 0.997967, 0.998437, 0.998822, 0.999132, 0.999376, 0.999565, 0.999708, 0.999812, 0.999886, 0.999936, 0.999967, 0.999985, 0.999995, 0.999999, 1.000000, 1.000000, };
+static const celt_word16 crossfade120[120] = {
+4.48900028e-09, 3.67236026e-07, 2.82912401e-06, 1.08570248e-05, 2.96371363e-05, 6.60643927e-05, 0.000128686326, 0.000227738288, 0.000375003205, 0.000583898916, 0.000869247306, 0.00124750228, 0.00173630554, 0.0023546759, 0.00312302145, 0.00406253291, 0.00519581465, 0.00654594321, 0.00813748315, 0.0099948002, 0.0121435989, 0.0146093164, 0.0174179301, 0.0205956921, 0.0241684318, 0.0281615388, 0.0326001085, 0.037509229, 0.0429119505, 0.0488308333, 0.0552870557, 0.0623011626, 0.069890976, 0.0780721828, 0.0868598744, 0.0962662399, 0.106300779, 0.116970159, 0.128280014, 0.140230775, 0.152822345, 0.166048914, 0.179904908, 0.194378689, 0.209457248, 0.225122735, 0.24135603, 0.258133113, 0.275428683, 0.293212473, 0.311453313, 0.330115765, 0.349162817, 0.368555874, 0.388253599, 0.408209801, 0.428382039, 0.448723137, 0.469185233, 0.489720047, 0.510280252, 0.530815721, 0.551276505, 0.571617603, 0.591790199, 0.611747682, 0.631443143, 0.650835872, 0.66988492, 0.688546479, 0.706788242, 0.724572062, 0.741866946, 0.758644521, 0.774877071, 0.790543258, 0.805621147, 0.820095062, 0.833950698, 0.847178459, 0.859768391, 0.87172097, 0.883030474, 0.893699884, 0.903733552, 0.913140774, 0.921928346, 0.930109799, 0.937699735, 0.944712043, 0.951169074, 0.95708847, 0.962490499, 0.967400074, 0.97183907, 0.975831866, 0.979405165, 0.982582569, 0.985391736, 0.987857103, 0.990005076, 0.991862595, 0.993454695, 0.99480474, 0.995938122, 0.996876419, 0.997645319, 0.99826473, 0.998752415, 0.999130189, 0.999416053, 0.999624074, 0.999771953, 0.999871969, 0.999933958, 0.999969959, 0.999989986, 0.999997973, 1, 1, };
 #endif
 
 #ifndef DEF_LOGN400
@@ -116,10 +118,12 @@ static const CELTMode mode48000_960_120 = {
 21,	/* effEBands */
 {0.850006, 0.000000, 1.000000, 1.000000, },	/* preemph */
 eband5ms,	/* eBands */
+bin_band5ms,	/* binBand */
 11,	/* nbAllocVectors */
 band_allocation,	/* allocVectors */
 {1920, 3, {&fft_state48000_960_0, &fft_state48000_960_1, &fft_state48000_960_2, &fft_state48000_960_3, }, mdct_twiddles960},	/* mdct */
 window120,	/* window */
+crossfade120,	/* crossfade */
 3,	/* maxLM */
 8,	/* nbShortMdcts */
 120,	/* shortMdctSize */
@@ -66,65 +66,111 @@ static void exp_rotation1(celt_norm *X, int len, int stride, celt_word16 c, celt
    }
 }
 
-static void exp_rotation(celt_norm *X, int len, int dir, int stride, int K, int spread)
+/* Same as exp_rotation1() on each of the nb_blocks consecutive blocks of len
+   samples. The blocks go in the inner loop: each block is a serial chain of
+   rotations, but the chains are independent and can run side by side. */
+static void exp_rotation_blocks(celt_norm *X, int len, int nb_blocks, int stride, celt_word16 c, celt_word16 s)
 {
-   static const int SPREAD_FACTOR[3]={15,10,5};
-   int i;
+   int i, j;
+   for (j=0;j<len-stride;j++)
+   {
+      celt_norm *Xptr = X+j;
+      for (i=0;i<nb_blocks;i++)
+      {
+         celt_norm x1, x2;
+         x1 = Xptr[0];
+         x2 = Xptr[stride];
+         Xptr[stride] = EXTRACT16(SHR32(MULT16_16(c,x2) + MULT16_16(s,x1), 15));
+         Xptr[0]      = EXTRACT16(SHR32(MULT16_16(c,x1) - MULT16_16(s,x2), 15));
+         Xptr += len;
+      }
+   }
+   for (j=len-2*stride-1;j>=0;j--)
+   {
+      celt_norm *Xptr = X+j;
+      for (i=0;i<nb_blocks;i++)
+      {
+         celt_norm x1, x2;
+         x1 = Xptr[0];
+         x2 = Xptr[stride];
+         Xptr[stride] = EXTRACT16(SHR32(MULT16_16(c,x2) + MULT16_16(s,x1), 15));
+         Xptr[0]      = EXTRACT16(SHR32(MULT16_16(c,x1) - MULT16_16(s,x2), 15));
+         Xptr += len;
+      }
+   }
+}
+
+/* Spreading rotation for a band. It only depends on the size of the band,
+   the number of pulses, the spreading and the number of blocks, so it's
+   computed once for both directions. */
+typedef struct {
    celt_word16 c, s;
+   int stride2;
+} SpreadRotation;
+
+/* Returns 0 when no rotation is needed */
+static int spread_rotation(SpreadRotation *rot, int len, int stride, int K, int spread)
+{
+   static const int SPREAD_FACTOR[3]={15,10,5};
    celt_word16 gain, theta;
-   int stride2=0;
    int factor;
-   /*int i;
-   if (len>=30)
-   {
-      for (i=0;i<len;i++)
-         X[i] = 0;
-      X[14] = 1;
-      K=5;
-   }*/
+
    if (2*K>=len || spread==SPREAD_NONE)
-      return;
+      return 0;
    factor = SPREAD_FACTOR[spread-1];
 
    gain = celt_div((celt_word32)MULT16_16(Q15_ONE,len),(celt_word32)(len+factor*K));
    /* FIXME: Make that HALF16 instead of HALF32 */
    theta = HALF32(MULT16_16_Q15(gain,gain));
 
-   c = celt_cos_norm(EXTEND32(theta));
-   s = celt_cos_norm(EXTEND32(SUB16(Q15ONE,theta))); /*  sin(theta) */
+   rot->c = celt_cos_norm(EXTEND32(theta));
+   rot->s = celt_cos_norm(EXTEND32(SUB16(Q15ONE,theta))); /*  sin(theta) */
 
+   rot->stride2 = 0;
    if (len>=8*stride)
    {
-      stride2 = 1;
+      rot->stride2 = 1;
       /* This is just a simple way of computing sqrt(len/stride) with rounding.
          It's basically incrementing long as (stride2+0.5)^2 < len/stride.
          I _think_ it is bit-exact */
-      while ((stride2*stride2+stride2)*stride + (stride>>2) < len)
-         stride2++;
+      while ((rot->stride2*rot->stride2+rot->stride2)*stride + (stride>>2) < len)
+         rot->stride2++;
    }
+   return 1;
+}
+
+static void exp_rotation(celt_norm *X, int len, int dir, int stride, const SpreadRotation *rot)
+{
+   celt_word16 c = rot->c;
+   celt_word16 s = rot->s;
+   int stride2 = rot->stride2;
    /*TODO: We should be passing around log2(B), not B, for both this and for
       extract_collapse_mask().*/
    len /= stride;
-   for (i=0;i<stride;i++)
+   if (stride==1)
    {
       if (dir < 0)
       {
          if (stride2)
-            exp_rotation1(X+i*len, len, stride2, s, c);
-         exp_rotation1(X+i*len, len, 1, c, s);
+            exp_rotation1(X, len, stride2, s, c);
+         exp_rotation1(X, len, 1, c, s);
+      } else {
+         exp_rotation1(X, len, 1, c, -s);
+         if (stride2)
+            exp_rotation1(X, len, stride2, s, -c);
+      }
+   } else {
+      if (dir < 0)
+      {
+         if (stride2)
+            exp_rotation_blocks(X, len, stride, stride2, s, c);
+         exp_rotation_blocks(X, len, stride, 1, c, s);
       } else {
-         exp_rotation1(X+i*len, len, 1, c, -s);
+         exp_rotation_blocks(X, len, stride, 1, c, -s);
          if (stride2)
-            exp_rotation1(X+i*len, len, stride2, s, -c);
+            exp_rotation_blocks(X, len, stride, stride2, s, -c);
       }
    }
-   /*if (len>=30)
-   {
-      for (i=0;i<len;i++)
-         printf ("%f ", X[i]);
-      printf ("\n");
-      exit(0);
-   }*/
 }
 
 /** Takes the pitch vector and the decoded residual vector, computes the gain
@@ -184,6 +230,8 @@ unsigned alg_quant(celt_norm *X, int N, int K, int spread, int B,
    celt_word32 xy;
    celt_word16 yy;
    unsigned collapse_mask;
+   SpreadRotation rot;
+   int rotate;
    SAVE_STACK;
 
    celt_assert2(K!=0, "alg_quant() needs at least one pulse");
@@ -192,7 +240,9 @@ unsigned alg_quant(celt_norm *X, int N, int K, int spread, int B,
    ALLOC(iy, N, int);
    ALLOC(signx, N, celt_word16);
    
-   exp_rotation(X, N, 1, B, K, spread);
+   rotate = spread_rotation(&rot, N, B, K, spread);
+   if (rotate)
+      exp_rotation(X, N, 1, B, &rot);
 
    /* Get rid of the sign */
    sum = 0;
@@ -325,7 +375,8 @@ unsigned alg_quant(celt_norm *X, int N, int K, int spread, int B,
    if (resynth)
    {
       normalise_residual(iy, X, N, yy, gain);
-      exp_rotation(X, N, -1, B, K, spread);
+      if (rotate)
+         exp_rotation(X, N, -1, B, &rot);
    }
    collapse_mask = extract_collapse_mask(iy, N, B);
    RESTORE_STACK;
@@ -341,6 +392,7 @@ unsigned alg_unquant(celt_norm *X, int N, int K, int spread, int B,
    int i;
    celt_word32 Ryy;
    unsigned collapse_mask;
+   SpreadRotation rot;
    VARDECL(int, iy);
    SAVE_STACK;
 
@@ -353,7 +405,8 @@ unsigned alg_unquant(celt_norm *X, int N, int K, int spread, int B,
       Ryy = MAC16_16(Ryy, iy[i], iy[i]);
    } while (++i < N);
    normalise_residual(iy, X, N, Ryy, gain);
-   exp_rotation(X, N, -1, B, K, spread);
+   if (spread_rotation(&rot, N, B, K, spread))
+      exp_rotation(X, N, -1, B, &rot);
    collapse_mask = extract_collapse_mask(iy, N, B);
    RESTORE_STACK;
    return collapse_mask;
@@ -423,7 +476,7 @@ int stereo_itheta(celt_norm *X, celt_norm *Y, int stereo, int N)
    /* 0.63662 = 2/pi */
    itheta = MULT16_16_Q15(QCONST16(0.63662f,15),celt_atan2p(side, mid));
 #else
-   itheta = (int)floor(.5f+16384*0.63662f*atan2(side,mid));
+   itheta = (int)floor(.5f+16384*0.63662f*celt_atan2p(side,mid));
 #endif
 
    return itheta;
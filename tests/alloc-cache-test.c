@@ -0,0 +1,133 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Checks that the bit allocation cache gets hits on a CBR stream, that the
+   encoder and the decoder see the same hits, and that a decoder whose cache
+   was filled by another stream decodes exactly like a fresh one.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "celt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "test-signal.h"
+
+#define MAX_FRAME_SIZE 960
+#define NB_FRAMES 100
+
+static int run(CELTMode *mode, int C, int frame_size, int bytes)
+{
+   int i, err;
+   celt_uint32 enc_hits, enc_lookups, dec_hits, dec_lookups;
+   unsigned int seed = 1;
+   CELTEncoder *enc;
+   CELTDecoder *dec, *warm;
+   short in[2*MAX_FRAME_SIZE];
+   short out[2*MAX_FRAME_SIZE], out2[2*MAX_FRAME_SIZE];
+   unsigned char data[1276];
+
+   enc = celt_encoder_create_custom(mode, C, &err);
+   dec = old_celt_decoder_create_custom(mode, C, &err);
+   warm = old_celt_decoder_create_custom(mode, C, &err);
+   if (enc==NULL || dec==NULL || warm==NULL)
+   {
+      fprintf(stderr, "Error: cannot create the encoder and decoders: %s\n", celt_strerror(err));
+      return 1;
+   }
+
+   /* Fill the cache of the second decoder with another rate. The cache is
+      kept across the reset. */
+   for (i=0;i<10;i++)
+   {
+      int len;
+      test_signal(in, C, frame_size, i*frame_size, 0, &seed);
+      len = celt_encode(enc, in, frame_size, data, bytes+bytes/2);
+      old_celt_decode(warm, data, len, out2, frame_size);
+   }
+   celt_encoder_ctl(enc, CELT_RESET_STATE);
+   celt_decoder_ctl(warm, CELT_RESET_STATE);
+   celt_encoder_ctl(enc, CELT_GET_ALLOC_CACHE_LOOKUPS(&enc_lookups));
+   if (enc_lookups!=10)
+   {
+      fprintf(stderr, "Error: %u lookups instead of 10\n", (unsigned)enc_lookups);
+      return 1;
+   }
+
+   seed = 1;
+   for (i=0;i<NB_FRAMES;i++)
+   {
+      int len, ret, ret2;
+      test_signal(in, C, frame_size, i*frame_size, 0, &seed);
+      len = celt_encode(enc, in, frame_size, data, bytes);
+      ret = old_celt_decode(dec, data, len, out, frame_size);
+      ret2 = old_celt_decode(warm, data, len, out2, frame_size);
+      if (ret!=ret2 || memcmp(out, out2, frame_size*C*sizeof(short)))
+      {
+         fprintf(stderr, "Error: the warm decoder differs in frame %d (%d channels, frame size %d)\n",
+               i, C, frame_size);
+         return 1;
+      }
+   }
+
+   celt_encoder_ctl(enc, CELT_GET_ALLOC_CACHE_HITS(&enc_hits));
+   celt_encoder_ctl(enc, CELT_GET_ALLOC_CACHE_LOOKUPS(&enc_lookups));
+   celt_decoder_ctl(dec, CELT_GET_ALLOC_CACHE_HITS(&dec_hits));
+   celt_decoder_ctl(dec, CELT_GET_ALLOC_CACHE_LOOKUPS(&dec_lookups));
+   if (enc_lookups!=NB_FRAMES+10 || dec_lookups!=NB_FRAMES)
+   {
+      fprintf(stderr, "Error: %u and %u lookups for %d frames\n", (unsigned)enc_lookups,
+            (unsigned)dec_lookups, NB_FRAMES);
+      return 1;
+   }
+   if (dec_hits==0 || dec_hits>=dec_lookups || enc_hits<dec_hits)
+   {
+      fprintf(stderr, "Error: %u encoder and %u decoder hits (%d channels, frame size %d)\n",
+            (unsigned)enc_hits, (unsigned)dec_hits, C, frame_size);
+      return 1;
+   }
+
+   celt_encoder_destroy(enc);
+   celt_decoder_destroy(dec);
+   celt_decoder_destroy(warm);
+   return 0;
+}
+
+int main(void)
+{
+   CELTMode *mode;
+
+   mode = celt_mode_create(48000, 960, NULL);
+   if (run(mode, 1, 120, 40) || run(mode, 2, 240, 60) || run(mode, 1, 960, 120)
+         || run(mode, 2, 960, 160))
+      return 1;
+   celt_mode_destroy(mode);
+   printf("The allocation cache hits and decodes the same\n");
+   return 0;
+}
@@ -0,0 +1,381 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Bit-exactness harness. Encodes and decodes a set of synthetic signals
+   with every frame size, both channel counts, a few complexities and a
+   bitrate sweep, without and with lost packets. Each is run in CBR and VBR,
+   through the float API, and with a stereo encoder and decoder on a mono
+   stream, alone and switching to stereo. It compares a hash of the packets,
+   a hash of the decoded audio and its SNR with golden files recorded from a
+   reference build.
+
+   Usage: golden-test <golden dir>      compare with the golden file
+          golden-test -r <golden dir>   (re)record the golden file
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "celt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SAMPLING_RATE 48000
+#define LENGTH 11520
+#define MAX_FRAME_SIZE 960
+#define MAX_PACKET 1275
+
+/* How much lower than the golden SNR a build may be. Only matters when the
+   bits are allowed to change (approximate math). The concealment carries on
+   from whatever was decoded before a loss, so small differences there can
+   grow into larger ones in the concealed frames. */
+#define SNR_MARGIN 0.5
+#define LOSS_SNR_MARGIN 2.0
+
+#ifdef FIXED_POINT
+#define ARITH "fixed"
+#elif defined(FLOAT_APPROX)
+#define ARITH "float-approx"
+#else
+#define ARITH "float"
+#endif
+#ifdef ENABLE_POSTFILTER
+#define VARIANT "-postfilter"
+#else
+#define VARIANT ""
+#endif
+
+/* The approximations are expected to change the bits, not the quality */
+#ifdef FLOAT_APPROX
+#define CHECK_HASH 0
+#else
+#define CHECK_HASH 1
+#endif
+
+static const char *signal_names[] = {"sine", "noise", "transient", "silence"};
+#define NB_SIGNALS 4
+
+/* How each run drives the codec */
+#define RUN_CBR    0   /* 16-bit API at a constant bitrate */
+#define RUN_VBR    1   /* 16-bit API at a variable bitrate */
+#define RUN_FLOAT  2   /* float API at a constant bitrate */
+#define RUN_MONO   3   /* stereo encoder and decoder on a mono stream */
+#define RUN_SWITCH 4   /* same, with the stream going stereo and back */
+static const char *kind_names[] = {"cbr", "vbr", "float", "mono", "switch"};
+#define NB_KINDS 5
+
+static const int frame_sizes[] = {120, 240, 480, 960};
+static const int complexities[] = {0, 5, 10};
+static const int bitrates[] = {32, 64, 128}; /* kb/s */
+
+/* With loss, two frames in every ten are concealed, one of them a burst of
+   two so that the concealment goes past its first frame */
+static int lost(int loss, int i)
+{
+   return loss && (i%10==3 || i%10==7 || i%10==8);
+}
+
+static void generate(int type, int C, short *pcm)
+{
+   int i, c;
+   unsigned int seed = 42;
+   for (i=0;i<LENGTH;i++)
+   {
+      for (c=0;c<C;c++)
+      {
+         double x=0;
+         seed = 1664525*seed + 1013904223;
+         switch (type)
+         {
+            case 0:
+               x = 8000*sin(.031*i*(c+1)) + 3000*sin(.47*i+c);
+               break;
+            case 1:
+               x = ((int)(seed>>16)-32768)*.25;
+               break;
+            case 2:
+               /* Decaying clicks on a quiet background */
+               x = ((int)(seed>>16)-32768)*.01
+                 + 20000*exp(-.01*((i+300*c)%2000))*sin(.9*i);
+               break;
+            default:
+               x = 0;
+         }
+         pcm[i*C+c] = (short)floor(.5+x);
+      }
+   }
+}
+
+static unsigned int hash(unsigned int h, const unsigned char *data, int len)
+{
+   int i;
+   /* FNV-1a, including the length so that frame boundaries count */
+   h = (h^(len&0xff))*16777619;
+   h = (h^(len>>8))*16777619;
+   for (i=0;i<len;i++)
+      h = (h^data[i])*16777619;
+   return h;
+}
+
+/* Same over 16-bit samples, taken as little-endian whatever the host */
+static unsigned int hash_pcm(unsigned int h, const short *pcm, int len)
+{
+   int i;
+   unsigned char bytes[2*2*MAX_FRAME_SIZE];
+   for (i=0;i<len;i++)
+   {
+      bytes[2*i] = pcm[i]&0xff;
+      bytes[2*i+1] = (pcm[i]>>8)&0xff;
+   }
+   return hash(h, bytes, 2*len);
+}
+
+/* Same over the bits of 32-bit float samples */
+static unsigned int hash_float(unsigned int h, const float *pcm, int len)
+{
+   int i;
+   unsigned char bytes[4*2*MAX_FRAME_SIZE];
+   for (i=0;i<len;i++)
+   {
+      unsigned int x;
+      memcpy(&x, &pcm[i], 4);
+      bytes[4*i] = x&0xff;
+      bytes[4*i+1] = (x>>8)&0xff;
+      bytes[4*i+2] = (x>>16)&0xff;
+      bytes[4*i+3] = x>>24;
+   }
+   return hash(h, bytes, 4*len);
+}
+
+/* In the switching runs, the stream goes from mono to stereo and back every
+   eight frames */
+static int stream_channels(int kind, int C, int i)
+{
+   if (kind==RUN_MONO)
+      return 1;
+   if (kind==RUN_SWITCH)
+      return (i/8)%2 ? 2 : 1;
+   return C;
+}
+
+static int run(CELTMode *mode, const short *pcm, int kind, int C, int frame_size, int complexity,
+      int bytes, int loss, unsigned int *h, unsigned int *hpcm, double *snr)
+{
+   int i, err, skip;
+   int frame;
+   int pos;
+   double S=0, N=0;
+   CELTEncoder *enc;
+   CELTDecoder *dec;
+   short out[2*MAX_FRAME_SIZE];
+   float fin[2*MAX_FRAME_SIZE];
+   float fout[2*MAX_FRAME_SIZE];
+   unsigned char data[MAX_PACKET];
+
+   enc = celt_encoder_create_custom(mode, C, &err);
+   dec = old_celt_decoder_create_custom(mode, C, &err);
+   if (enc==NULL || dec==NULL)
+      return 1;
+   celt_encoder_ctl(enc, CELT_SET_COMPLEXITY(complexity));
+   celt_decoder_ctl(dec, CELT_GET_LOOKAHEAD(&skip));
+   if (kind==RUN_VBR)
+   {
+      celt_encoder_ctl(enc, CELT_SET_VBR(1));
+      celt_encoder_ctl(enc, CELT_SET_BITRATE(bytes*8*SAMPLING_RATE/frame_size));
+   }
+
+   *h = *hpcm = 2166136261u;
+   for (pos=0,frame=0;pos+frame_size<=LENGTH;pos+=frame_size,frame++)
+   {
+      int len, ret;
+      const unsigned char *packet;
+      int max_bytes = kind==RUN_VBR ? MAX_PACKET : bytes;
+      if (kind==RUN_MONO || kind==RUN_SWITCH)
+      {
+         celt_encoder_ctl(enc, CELT_SET_CHANNELS(stream_channels(kind, C, frame)));
+         celt_decoder_ctl(dec, CELT_SET_CHANNELS(stream_channels(kind, C, frame)));
+      }
+      if (kind==RUN_FLOAT)
+      {
+         for (i=0;i<frame_size*C;i++)
+            fin[i] = pcm[pos*C+i]*(1.f/32768);
+         len = celt_encode_float(enc, fin, frame_size, data, max_bytes);
+      } else {
+         len = celt_encode(enc, pcm+pos*C, frame_size, data, max_bytes);
+      }
+      if (len<=0)
+         return 1;
+      packet = lost(loss, frame) ? NULL : data;
+      if (kind==RUN_FLOAT)
+      {
+         ret = celt_decode_float(dec, packet, len, fout, frame_size);
+         for (i=0;i<frame_size*C;i++)
+         {
+            double x = floor(.5+32768*fout[i]);
+            out[i] = x>32767 ? 32767 : x<-32768 ? -32768 : (short)x;
+         }
+      } else {
+         ret = old_celt_decode(dec, packet, len, out, frame_size);
+      }
+      if (ret!=frame_size)
+         return 1;
+      *h = hash(*h, data, len);
+      if (kind==RUN_FLOAT)
+         *hpcm = hash_float(*hpcm, fout, frame_size*C);
+      else
+         *hpcm = hash_pcm(*hpcm, out, frame_size*C);
+      /* The decoded audio lags the input by the lookahead */
+      for (i=0;i<frame_size*C;i++)
+      {
+         int j = (pos-skip)*C+i;
+         if (j>=0)
+         {
+            S += (double)pcm[j]*pcm[j];
+            N += (double)(pcm[j]-out[i])*(pcm[j]-out[i]);
+         }
+      }
+   }
+   *snr = 10*log10((S+1)/(N+1));
+   celt_encoder_destroy(enc);
+   celt_decoder_destroy(dec);
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   int kind, s, C, f, k, b, l;
+   int record = 0;
+   int errors = 0;
+   int count = 0;
+   char path[1024];
+   FILE *file;
+   CELTMode *mode;
+   short pcm[2*LENGTH];
+
+   if (argc>1 && strcmp(argv[1], "-r")==0)
+   {
+      record = 1;
+      argc--;
+      argv++;
+   }
+   if (argc!=2)
+   {
+      fprintf(stderr, "Usage: golden-test [-r] <golden dir>\n");
+      return 1;
+   }
+   sprintf(path, "%.1000s/%s%s.txt", argv[1], ARITH, VARIANT);
+   file = fopen(path, record ? "w" : "r");
+   if (file==NULL)
+   {
+      fprintf(stderr, "Cannot open %s\n", path);
+      return 1;
+   }
+
+   mode = celt_mode_create(SAMPLING_RATE, 960, NULL);
+   for (kind=0;kind<NB_KINDS;kind++)
+   {
+      for (s=0;s<NB_SIGNALS;s++)
+      {
+         /* The mono stream runs only make sense with stereo encoders and decoders */
+         for (C=kind>=RUN_MONO ? 2 : 1;C<=2;C++)
+         {
+            generate(s, C, pcm);
+            for (f=0;f<4;f++)
+            {
+               for (k=0;k<3;k++)
+               {
+                  for (b=0;b<3;b++)
+                  {
+                     for (l=0;l<2;l++)
+                     {
+                        unsigned int h, hpcm;
+                        double snr;
+                        int differs = 0;
+                        int frame_size = frame_sizes[f];
+                        int bytes = bitrates[b]*1000/8*frame_size/SAMPLING_RATE;
+                        if (run(mode, pcm, kind, C, frame_size, complexities[k], bytes, l, &h, &hpcm, &snr))
+                        {
+                           fprintf(stderr, "Error: %s %s %d %d %d %d %d failed to encode or decode\n",
+                                 kind_names[kind], signal_names[s], C, frame_size, complexities[k], bytes, l);
+                           return 1;
+                        }
+                        if (record)
+                        {
+                           fprintf(file, "%s %s %d %d %d %d %d %08x %08x %.2f\n", kind_names[kind], signal_names[s], C,
+                                 frame_size, complexities[k], bytes, l, h, hpcm, snr);
+                        } else {
+                           char gkind[32], name[32];
+                           int gC, gf, gk, gb, gl;
+                           unsigned int gh, ghpcm;
+                           double gsnr;
+                           if (fscanf(file, "%31s %31s %d %d %d %d %d %x %x %lf", gkind, name, &gC, &gf, &gk, &gb, &gl,
+                                    &gh, &ghpcm, &gsnr)!=10
+                                 || strcmp(gkind, kind_names[kind]) || strcmp(name, signal_names[s]) || gC!=C || gf!=frame_size
+                                 || gk!=complexities[k] || gb!=bytes || gl!=l)
+                           {
+                              fprintf(stderr, "Error: %s does not match this test\n", path);
+                              return 1;
+                           }
+                           if (CHECK_HASH && h!=gh)
+                           {
+                              fprintf(stderr, "%s %s %d %d %d %d %d: packets changed (%08x instead of %08x)\n",
+                                    gkind, name, C, frame_size, complexities[k], bytes, l, h, gh);
+                              differs = 1;
+                           }
+                           if (CHECK_HASH && hpcm!=ghpcm)
+                           {
+                              fprintf(stderr, "%s %s %d %d %d %d %d: decoded audio changed (%08x instead of %08x)\n",
+                                    gkind, name, C, frame_size, complexities[k], bytes, l, hpcm, ghpcm);
+                              differs = 1;
+                           }
+                           if (snr < gsnr-(l ? LOSS_SNR_MARGIN : SNR_MARGIN))
+                           {
+                              fprintf(stderr, "%s %s %d %d %d %d %d: SNR dropped to %.2f dB from %.2f dB\n",
+                                    gkind, name, C, frame_size, complexities[k], bytes, l, snr, gsnr);
+                              differs = 1;
+                           }
+                           errors += differs;
+                        }
+                        count++;
+                     }
+                  }
+               }
+            }
+         }
+      }
+   }
+   fclose(file);
+   celt_mode_destroy(mode);
+   if (record)
+      printf("Recorded %d runs in %s\n", count, path);
+   else if (errors)
+      fprintf(stderr, "%d of %d runs differ from %s\n", errors, count, path);
+   else
+      printf("All %d runs match %s\n", count, path);
+   return errors!=0;
+}
@@ -0,0 +1,13 @@
+#!/bin/sh
+
+# Checks that this build produces the same packets and decoded audio, and at
+# least the same SNR, as the golden files in golden/. There is one file per arithmetic
+# (fixed, float or float-approx) and postfilter setting. To update them after
+# an intended bitstream change, run "./golden-test -r golden" from a reference
+# build of each.
+
+if [ -z "$srcdir" ]; then
+   srcdir=.
+fi
+
+./golden-test "$srcdir/golden"
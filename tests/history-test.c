@@ -0,0 +1,162 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Checks that decoders made with celt_decoder_create_history() for a
+   smaller maximum frame size decode exactly like full-size ones, and that
+   they refuse larger frames.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "celt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "test-signal.h"
+
+#define MAX_FRAME_SIZE 960
+#define NB_FRAMES 40
+
+static int lost(int i)
+{
+   return i%7==3 || i==20 || i==21;
+}
+
+/* A decoder made for frame_size must decode like a full-size one. Without
+   the PLC history, only good packets are compared. */
+static int run(CELTMode *mode, int C, int frame_size, int plc)
+{
+   int i, err, size;
+   celt_uint32 lookups;
+   unsigned int seed = 1;
+   int bytes = 64000/8*frame_size/48000;
+   CELTEncoder *enc;
+   CELTDecoder *dec, *small;
+   short in[2*MAX_FRAME_SIZE];
+   short out[2*MAX_FRAME_SIZE], out2[2*MAX_FRAME_SIZE];
+   unsigned char data[1276];
+
+   size = celt_decoder_get_size_history(mode, C, frame_size, plc);
+   if (size<=0 || size>=celt_decoder_get_size_custom(mode, C))
+   {
+      fprintf(stderr, "Error: a decoder for frame size %d takes %d bytes\n", frame_size, size);
+      return 1;
+   }
+   enc = celt_encoder_create_custom(mode, C, &err);
+   dec = old_celt_decoder_create_custom(mode, C, &err);
+   small = celt_decoder_create_history(mode, C, frame_size, plc, &err);
+   if (enc==NULL || dec==NULL || small==NULL)
+   {
+      fprintf(stderr, "Error: cannot create the encoder and decoders: %s\n", celt_strerror(err));
+      return 1;
+   }
+
+   for (i=0;i<NB_FRAMES;i++)
+   {
+      int len, ret, ret2;
+      int loss = plc && lost(i);
+      test_signal(in, C, frame_size, i*frame_size, 0, &seed);
+      len = celt_encode(enc, in, frame_size, data, bytes);
+      ret = old_celt_decode(dec, loss ? NULL : data, len, out, frame_size);
+      ret2 = old_celt_decode(small, loss ? NULL : data, len, out2, frame_size);
+      if (ret!=ret2 || memcmp(out, out2, frame_size*C*sizeof(short)))
+      {
+         fprintf(stderr, "Error: the small decoder differs in frame %d (%d channels, frame size %d, plc %d)\n",
+               i, C, frame_size, plc);
+         return 1;
+      }
+   }
+   /* Small decoders don't keep the allocation cache */
+   celt_decoder_ctl(small, CELT_GET_ALLOC_CACHE_LOOKUPS(&lookups));
+   if (lookups!=0)
+   {
+      fprintf(stderr, "Error: %u allocation cache lookups in a small decoder\n", (unsigned)lookups);
+      return 1;
+   }
+   /* Concealment still works without the history */
+   if (old_celt_decode(small, NULL, 0, out2, frame_size)!=frame_size)
+   {
+      fprintf(stderr, "Error: cannot conceal a lost packet (plc %d)\n", plc);
+      return 1;
+   }
+   if ((celt_decoder_ctl(small, CELT_SET_PLC_TRACKING(1))==CELT_OK) != (plc==2))
+   {
+      fprintf(stderr, "Error: PLC tracking %s with plc %d\n", plc==2 ? "refused" : "accepted", plc);
+      return 1;
+   }
+
+   if (frame_size<MAX_FRAME_SIZE)
+   {
+      int len;
+      CELTEncoder *large = celt_encoder_create_custom(mode, C, &err);
+      test_signal(in, C, MAX_FRAME_SIZE, 0, 0, &seed);
+      len = celt_encode(large, in, MAX_FRAME_SIZE, data, 160);
+      if (old_celt_decode(small, data, len, out2, MAX_FRAME_SIZE)!=CELT_BUFFER_TOO_SMALL)
+      {
+         fprintf(stderr, "Error: frame larger than %d accepted\n", frame_size);
+         return 1;
+      }
+      celt_encoder_destroy(large);
+   }
+
+   celt_encoder_destroy(enc);
+   celt_decoder_destroy(dec);
+   celt_decoder_destroy(small);
+   return 0;
+}
+
+int main(void)
+{
+   int err;
+   CELTMode *mode;
+
+   mode = celt_mode_create(48000, 960, NULL);
+   if (celt_decoder_get_size_history(mode, 1, 100, 1)!=CELT_BAD_ARG
+         || celt_decoder_create_history(mode, 1, 1920, 1, &err)!=NULL || err!=CELT_BAD_ARG
+         || celt_decoder_get_size_history(mode, 1, 960, 3)!=CELT_BAD_ARG)
+   {
+      fprintf(stderr, "Error: bad frame size or plc accepted\n");
+      return 1;
+   }
+   /* Full-size decoders don't keep the tracking state */
+   {
+      CELTDecoder *dec = old_celt_decoder_create_custom(mode, 1, &err);
+      if (celt_decoder_ctl(dec, CELT_SET_PLC_TRACKING(1))!=CELT_BAD_ARG)
+      {
+         fprintf(stderr, "Error: PLC tracking accepted by a full-size decoder\n");
+         return 1;
+      }
+      celt_decoder_destroy(dec);
+   }
+   if (run(mode, 1, 120, 2) || run(mode, 2, 240, 1) || run(mode, 1, 480, 0)
+         || run(mode, 2, 120, 0) || run(mode, 2, 960, 1) || run(mode, 2, 480, 2))
+      return 1;
+   celt_mode_destroy(mode);
+   printf("All small decoders match\n");
+   return 0;
+}
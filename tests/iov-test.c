@@ -0,0 +1,133 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Checks that celt_encode_iov() produces the same packets as celt_encode(),
+   both in place after some headroom and split across several segments.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "celt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define FRAME_SIZE 480
+#define NB_FRAMES 50
+#define HEADROOM 12
+#define MAX_BYTES 200
+
+int main(void)
+{
+   int i, j, err;
+   CELTMode *mode;
+   CELTEncoder *ref, *flat, *split;
+   short in[FRAME_SIZE];
+   unsigned char ref_data[MAX_BYTES];
+   unsigned char packet[HEADROOM+MAX_BYTES];
+   unsigned char seg[3][HEADROOM+MAX_BYTES];
+   CELTIovec iov[3];
+   unsigned int seed = 1;
+
+   mode = celt_mode_create(48000, 960, NULL);
+   ref = celt_encoder_create_custom(mode, 1, &err);
+   flat = celt_encoder_create_custom(mode, 1, &err);
+   split = celt_encoder_create_custom(mode, 1, &err);
+   if (ref==NULL || flat==NULL || split==NULL)
+   {
+      fprintf(stderr, "Error: celt_encoder_create_custom returned %s\n", celt_strerror(err));
+      return 1;
+   }
+   /* VBR, so that the frames get shrunk */
+   celt_encoder_ctl(ref, CELT_SET_VBR(1));
+   celt_encoder_ctl(flat, CELT_SET_VBR(1));
+   celt_encoder_ctl(split, CELT_SET_VBR(1));
+
+   for (i=0;i<NB_FRAMES;i++)
+   {
+      int ref_len, len;
+      CELTIovec one;
+      for (j=0;j<FRAME_SIZE;j++)
+      {
+         int t = i*FRAME_SIZE+j;
+         seed = 1664525*seed + 1013904223;
+         in[j] = (short)(6000*sin(.02*t) + ((int)(seed>>20)-2048));
+      }
+      ref_len = celt_encode(ref, in, FRAME_SIZE, ref_data, MAX_BYTES);
+
+      /* A single buffer with room for a header */
+      memset(packet, 0xA5, sizeof(packet));
+      one.base = packet;
+      one.len = sizeof(packet);
+      len = celt_encode_iov(flat, in, FRAME_SIZE, &one, 1, HEADROOM, MAX_BYTES);
+      if (len != ref_len || memcmp(packet+HEADROOM, ref_data, len) != 0)
+      {
+         fprintf(stderr, "Error: frame %d differs when encoded in place\n", i);
+         return 1;
+      }
+      for (j=0;j<HEADROOM;j++)
+      {
+         if (packet[j] != 0xA5)
+         {
+            fprintf(stderr, "Error: headroom overwritten in frame %d\n", i);
+            return 1;
+         }
+      }
+
+      /* The header in its own segment and the data split in two */
+      iov[0].base = seg[0];
+      iov[0].len = HEADROOM-4;
+      iov[1].base = seg[1];
+      iov[1].len = 4+(i%7)*5;
+      iov[2].base = seg[2];
+      iov[2].len = MAX_BYTES;
+      len = celt_encode_iov(split, in, FRAME_SIZE, iov, 3, HEADROOM, MAX_BYTES);
+      if (len != ref_len)
+      {
+         fprintf(stderr, "Error: frame %d has the wrong size when split\n", i);
+         return 1;
+      }
+      for (j=0;j<len;j++)
+      {
+         int pos = j < iov[1].len-4 ? j : j-(iov[1].len-4);
+         unsigned char byte = j < iov[1].len-4 ? seg[1][4+pos] : seg[2][pos];
+         if (byte != ref_data[j])
+         {
+            fprintf(stderr, "Error: frame %d differs when split\n", i);
+            return 1;
+         }
+      }
+   }
+
+   celt_encoder_destroy(ref);
+   celt_encoder_destroy(flat);
+   celt_encoder_destroy(split);
+   celt_mode_destroy(mode);
+   printf("All frames match\n");
+   return 0;
+}
@@ -0,0 +1,335 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Loopback test for the jitter buffer: a synthetic signal is encoded,
+   the packets are sent through simulated network traces (constant delay,
+   random jitter with reordering, loss, delay spikes) and decoded through
+   the jitter buffer. The buffer statistics are checked against what each
+   trace should produce. The same is then done with in-band FEC, which must
+   beat plain concealment, and with tracked PLC analysis, which must not be
+   much worse than the regular one.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+   
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+   
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+   
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "celt.h"
+#include "celt_jitter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define FRAME_SIZE 480
+#define NB_FRAMES 1000
+#define BYTES_PER_FRAME 80
+
+typedef struct {
+   int arrival;
+   int frame;
+} Arrival;
+
+static unsigned char packets[NB_FRAMES][BYTES_PER_FRAME];
+static int packet_len[NB_FRAMES];
+
+static celt_uint32 rand_state = 1;
+
+static int rand_int(int range)
+{
+   rand_state = rand_state*1664525+1013904223;
+   return range > 0 ? (int)((rand_state>>8)%range) : 0;
+}
+
+static int compare_arrival(const void *_a, const void *_b)
+{
+   const Arrival *a = (const Arrival *)_a;
+   const Arrival *b = (const Arrival *)_b;
+   if (a->arrival != b->arrival)
+      return a->arrival - b->arrival;
+   return a->frame - b->frame;
+}
+
+static void encode_signal(CELTMode *mode, int fec)
+{
+   int i, j, err;
+   short pcm[FRAME_SIZE];
+   CELTEncoder *enc = celt_encoder_create_custom(mode, 1, &err);
+   if (enc == NULL)
+   {
+      fprintf(stderr, "Error: celt_encoder_create_custom returned %s\n", celt_strerror(err));
+      exit(1);
+   }
+   celt_encoder_ctl(enc, CELT_SET_FEC(fec));
+   rand_state = 1;
+   for (i=0;i<NB_FRAMES;i++)
+   {
+      for (j=0;j<FRAME_SIZE;j++)
+      {
+         int t = i*FRAME_SIZE+j;
+         pcm[j] = 8000*sin(.03*t) + 3000*sin(.0071*t) + rand_int(2000) - 1000;
+      }
+      packet_len[i] = celt_encode(enc, pcm, FRAME_SIZE, packets[i], BYTES_PER_FRAME);
+      if (packet_len[i] <= 0)
+      {
+         fprintf(stderr, "Error: celt_encode returned %s\n", celt_strerror(packet_len[i]));
+         exit(1);
+      }
+   }
+   celt_encoder_destroy(enc);
+}
+
+/* Runs one trace. delay[i] is the network delay of frame i in samples,
+   or -1 if the packet is lost. If ref is not NULL, the output is
+   compared to it. */
+static void run_trace(const char *name, CELTMode *mode, const int *delay, const short *ref,
+      int fec, int margin, int *late, int *underruns, int *inserted, int *dropped, int *final_delay)
+{
+   static Arrival arrivals[NB_FRAMES];
+   static short out[FRAME_SIZE];
+   int i, nb_arrivals=0, next=0, tick, err, ret;
+   int nb_ticks;
+   CELTDecoder *dec;
+   CELTJitter *jb;
+
+   dec = old_celt_decoder_create_custom(mode, 1, &err);
+   jb = celt_jitter_create(FRAME_SIZE, &err);
+   if (dec == NULL || jb == NULL)
+   {
+      fprintf(stderr, "Error: cannot create decoder/jitter buffer: %s\n", celt_strerror(err));
+      exit(1);
+   }
+   celt_decoder_ctl(dec, CELT_SET_FEC(fec));
+   celt_jitter_ctl(jb, CELT_JITTER_SET_MARGIN(margin));
+   for (i=0;i<NB_FRAMES;i++)
+   {
+      if (delay[i] < 0)
+         continue;
+      arrivals[nb_arrivals].arrival = i*FRAME_SIZE + delay[i];
+      arrivals[nb_arrivals].frame = i;
+      nb_arrivals++;
+   }
+   qsort(arrivals, nb_arrivals, sizeof(Arrival), compare_arrival);
+
+   nb_ticks = NB_FRAMES - 50;
+   for (tick=0;tick<nb_ticks;tick++)
+   {
+      while (next < nb_arrivals && arrivals[next].arrival <= tick*FRAME_SIZE)
+      {
+         int f = arrivals[next].frame;
+         ret = celt_jitter_put(jb, packets[f], packet_len[f], (celt_uint32)f*FRAME_SIZE);
+         if (ret != CELT_OK)
+         {
+            fprintf(stderr, "Error: %s: celt_jitter_put returned %s\n", name, celt_strerror(ret));
+            exit(1);
+         }
+         next++;
+      }
+      ret = celt_jitter_decode(jb, dec, out);
+      if (ret < 0)
+      {
+         fprintf(stderr, "Error: %s: celt_jitter_decode returned %s\n", name, celt_strerror(ret));
+         exit(1);
+      }
+      if (ref != NULL && memcmp(out, ref+tick*FRAME_SIZE, FRAME_SIZE*sizeof(short)))
+      {
+         fprintf(stderr, "Error: %s: output mismatch at tick %d\n", name, tick);
+         exit(1);
+      }
+   }
+   celt_jitter_ctl(jb, CELT_JITTER_GET_LATE(late));
+   celt_jitter_ctl(jb, CELT_JITTER_GET_UNDERRUNS(underruns));
+   celt_jitter_ctl(jb, CELT_JITTER_GET_INSERTED(inserted));
+   celt_jitter_ctl(jb, CELT_JITTER_GET_DROPPED(dropped));
+   celt_jitter_ctl(jb, CELT_JITTER_GET_DELAY(final_delay));
+   printf("%-10s late: %3d  underruns: %3d  inserted: %3d  dropped: %3d  delay: %5d\n",
+         name, *late, *underruns, *inserted, *dropped, *final_delay);
+
+   celt_jitter_destroy(jb);
+   celt_decoder_destroy(dec);
+}
+
+int main(void)
+{
+   static int delay[NB_FRAMES];
+   static short ref[NB_FRAMES*FRAME_SIZE];
+   int i, err;
+   int late, underruns, inserted, dropped, final_delay;
+   CELTMode *mode;
+   CELTDecoder *dec;
+
+   mode = celt_mode_create(48000, FRAME_SIZE, &err);
+   if (mode == NULL)
+   {
+      fprintf(stderr, "Error: failed to create a mode: %s\n", celt_strerror(err));
+      return 1;
+   }
+   encode_signal(mode, 0);
+
+   /* Constant delay of 2.5 frames: the first packet is played at tick 3
+      and every later one arrives just in time, so the output has to be
+      identical to decoding the packets in order */
+   dec = old_celt_decoder_create_custom(mode, 1, &err);
+   for (i=0;i<NB_FRAMES;i++)
+   {
+      if (i<3)
+         old_celt_decode(dec, NULL, 0, ref+i*FRAME_SIZE, FRAME_SIZE);
+      else
+         old_celt_decode(dec, packets[i-3], packet_len[i-3], ref+i*FRAME_SIZE, FRAME_SIZE);
+   }
+   celt_decoder_destroy(dec);
+   for (i=0;i<NB_FRAMES;i++)
+      delay[i] = 5*FRAME_SIZE/2;
+   run_trace("constant", mode, delay, ref, 0, 0, &late, &underruns, &inserted, &dropped, &final_delay);
+   if (late || underruns || inserted || dropped || final_delay >= FRAME_SIZE)
+   {
+      fprintf(stderr, "Error: constant delay should not need any adaptation\n");
+      return 1;
+   }
+
+   /* Up to four frames of random jitter, which reorders packets. Once the
+      buffer has grown to cover it, nothing should arrive late. */
+   for (i=0;i<NB_FRAMES;i++)
+      delay[i] = FRAME_SIZE + rand_int(4*FRAME_SIZE);
+   run_trace("jitter", mode, delay, NULL, 0, 0, &late, &underruns, &inserted, &dropped, &final_delay);
+   if (late > 10 || final_delay > 6*FRAME_SIZE)
+   {
+      fprintf(stderr, "Error: jitter not absorbed\n");
+      return 1;
+   }
+
+   /* Same with 10% loss: every lost packet is concealed */
+   for (i=0;i<NB_FRAMES;i++)
+      delay[i] = rand_int(10)==0 ? -1 : FRAME_SIZE + rand_int(4*FRAME_SIZE);
+   run_trace("loss", mode, delay, NULL, 0, 0, &late, &underruns, &inserted, &dropped, &final_delay);
+   if (underruns < 50 || late > 10 || final_delay > 6*FRAME_SIZE)
+   {
+      fprintf(stderr, "Error: losses not concealed\n");
+      return 1;
+   }
+
+   /* A single burst of 20 frames delayed by 10 extra frames: the buffer
+      grows for it, then shrinks back once the window has forgotten it */
+   for (i=0;i<NB_FRAMES;i++)
+      delay[i] = FRAME_SIZE + (i>=300 && i<320 ? 10*FRAME_SIZE : 0);
+   run_trace("spike", mode, delay, NULL, 0, 0, &late, &underruns, &inserted, &dropped, &final_delay);
+   if (inserted < 5 || dropped < 5 || final_delay >= FRAME_SIZE)
+   {
+      fprintf(stderr, "Error: delay did not follow the spike\n");
+      return 1;
+   }
+
+   /* FEC: lose every tenth packet and recover it from the next one */
+   encode_signal(mode, 30);
+   {
+      static short clean[NB_FRAMES*FRAME_SIZE];
+      static short plc[NB_FRAMES*FRAME_SIZE];
+      static short fec[NB_FRAMES*FRAME_SIZE];
+      static short trk[NB_FRAMES*FRAME_SIZE];
+      double err_plc=0, err_fec=0, err_trk=0, energy=0;
+      CELTDecoder *dec_plc, *dec_fec, *dec_trk;
+      dec = old_celt_decoder_create_custom(mode, 1, &err);
+      dec_plc = old_celt_decoder_create_custom(mode, 1, &err);
+      dec_fec = old_celt_decoder_create_custom(mode, 1, &err);
+      dec_trk = celt_decoder_create_history(mode, 1, FRAME_SIZE, 2, &err);
+      celt_decoder_ctl(dec, CELT_SET_FEC(1));
+      celt_decoder_ctl(dec_plc, CELT_SET_FEC(1));
+      celt_decoder_ctl(dec_fec, CELT_SET_FEC(1));
+      celt_decoder_ctl(dec_trk, CELT_SET_FEC(1));
+      celt_decoder_ctl(dec_trk, CELT_SET_PLC_TRACKING(1));
+      for (i=0;i<NB_FRAMES-1;i++)
+      {
+         int j;
+         old_celt_decode(dec, packets[i], packet_len[i], clean+i*FRAME_SIZE, FRAME_SIZE);
+         if (i%10==5)
+         {
+            old_celt_decode(dec_plc, NULL, 0, plc+i*FRAME_SIZE, FRAME_SIZE);
+            old_celt_decode(dec_trk, NULL, 0, trk+i*FRAME_SIZE, FRAME_SIZE);
+            err = celt_decode_fec(dec_fec, packets[i+1], packet_len[i+1], fec+i*FRAME_SIZE, FRAME_SIZE);
+            if (err < 0)
+            {
+               fprintf(stderr, "Error: celt_decode_fec returned %s\n", celt_strerror(err));
+               return 1;
+            }
+         } else {
+            old_celt_decode(dec_plc, packets[i], packet_len[i], plc+i*FRAME_SIZE, FRAME_SIZE);
+            old_celt_decode(dec_fec, packets[i], packet_len[i], fec+i*FRAME_SIZE, FRAME_SIZE);
+            old_celt_decode(dec_trk, packets[i], packet_len[i], trk+i*FRAME_SIZE, FRAME_SIZE);
+         }
+         for (j=i*FRAME_SIZE;j<(i+1)*FRAME_SIZE;j++)
+         {
+            energy += (double)clean[j]*clean[j];
+            err_plc += (double)(plc[j]-clean[j])*(plc[j]-clean[j]);
+            err_fec += (double)(fec[j]-clean[j])*(fec[j]-clean[j]);
+            err_trk += (double)(trk[j]-clean[j])*(trk[j]-clean[j]);
+         }
+      }
+      celt_decoder_destroy(dec);
+      celt_decoder_destroy(dec_plc);
+      celt_decoder_destroy(dec_fec);
+      celt_decoder_destroy(dec_trk);
+      printf("FEC SNR: %.1f dB, PLC SNR: %.1f dB, tracked PLC SNR: %.1f dB\n", 10*log10(energy/(err_fec+1)),
+            10*log10(energy/(err_plc+1)), 10*log10(energy/(err_trk+1)));
+      if (err_fec*2 > err_plc)
+      {
+         fprintf(stderr, "Error: FEC does not improve on concealment\n");
+         return 1;
+      }
+      if (err_trk > 2*err_plc)
+      {
+         fprintf(stderr, "Error: tracked PLC analysis is worse than the regular one\n");
+         return 1;
+      }
+
+      /* Through the jitter buffer, with a one frame margin so that the next
+         packet is always there: the first packet is played at tick 4 and
+         every lost frame must come from the FEC copy, exactly as above */
+      dec = old_celt_decoder_create_custom(mode, 1, &err);
+      celt_decoder_ctl(dec, CELT_SET_FEC(1));
+      for (i=0;i<NB_FRAMES;i++)
+      {
+         int f = i-4;
+         if (f<0)
+            old_celt_decode(dec, NULL, 0, ref+i*FRAME_SIZE, FRAME_SIZE);
+         else if (f%10==5)
+            celt_decode_fec(dec, packets[f+1], packet_len[f+1], ref+i*FRAME_SIZE, FRAME_SIZE);
+         else
+            old_celt_decode(dec, packets[f], packet_len[f], ref+i*FRAME_SIZE, FRAME_SIZE);
+      }
+      celt_decoder_destroy(dec);
+      for (i=0;i<NB_FRAMES;i++)
+         delay[i] = i%10==5 ? -1 : 5*FRAME_SIZE/2;
+      run_trace("fec", mode, delay, ref, 1, FRAME_SIZE, &late, &underruns, &inserted, &dropped, &final_delay);
+      if (late || inserted || dropped)
+      {
+         fprintf(stderr, "Error: FEC trace should not need any adaptation\n");
+         return 1;
+      }
+   }
+
+   celt_mode_destroy(mode);
+   return 0;
+}
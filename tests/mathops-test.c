@@ -99,6 +99,41 @@ void testexp2log2(void)
       }
    }
 }
+
+void testrsqrt(void)
+{
+   float x;
+   for (x=1e-6f;x<1e10f;x+=(x/64.f))
+   {
+      double error = fabs(celt_rsqrt(x)*sqrt(x)-1);
+      if (error>0.00001)
+      {
+         fprintf (stderr, "celt_rsqrt failed: fabs(celt_rsqrt(x)*sqrt(x)-1)>0.00001 (x = %g, error = %g)\n", x,error);
+         ret = 1;
+      }
+   }
+   if (celt_sqrt(0) != 0)
+   {
+      fprintf (stderr, "celt_sqrt failed: celt_sqrt(0) = %f\n", celt_sqrt(0));
+      ret = 1;
+   }
+}
+
+void testatan2(void)
+{
+   int i;
+   for (i=0;i<=16384;i++)
+   {
+      double a = (M_PI/2)*i/16384;
+      float x = cos(a), y = sin(a);
+      double error = fabs(celt_atan2p(3*y,3*x)-atan2(y,x));
+      if (error>0.00025)
+      {
+         fprintf (stderr, "celt_atan2p failed: fabs(celt_atan2p(y,x)-atan2(y,x))>0.00025 (y = %f, x = %f, error = %f)\n", y,x,error);
+         ret = 1;
+      }
+   }
+}
 #else
 void testlog2(void)
 {
@@ -167,6 +202,9 @@ int main(void)
    testexp2log2();
 #ifdef FIXED_POINT
    testilog2();
+#else
+   testrsqrt();
+   testatan2();
 #endif
    return ret;
 }
@@ -0,0 +1,170 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Checks that celt_decode_to() produces the same audio as the regular
+   decode calls for every output format and layout, and that the output
+   gain is applied.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "celt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "test-signal.h"
+
+#define FRAME_SIZE 480
+#define NB_FRAMES 50
+#define BYTES_PER_FRAME 120
+
+#define NB_DECODERS 6
+
+static int check(const char *name, int i, double x, double ref, double tol)
+{
+   if (fabs(x-ref) > tol)
+   {
+      fprintf(stderr, "Error: %s sample %d is %f instead of %f\n", name, i, x, ref);
+      return 1;
+   }
+   return 0;
+}
+
+int main(void)
+{
+   int i, j, err, len;
+   int errors=0;
+   CELTMode *mode;
+   CELTEncoder *enc;
+   CELTDecoder *dec[NB_DECODERS];
+   short in[2*FRAME_SIZE];
+   short ref[2*FRAME_SIZE];
+   short planar16[2][FRAME_SIZE];
+   short gain16[2][FRAME_SIZE];
+   celt_int32 inter32[2*FRAME_SIZE];
+   celt_int32 planar24[2][FRAME_SIZE];
+   float interf[2*FRAME_SIZE];
+   CELTOutput out[NB_DECODERS];
+   unsigned char data[BYTES_PER_FRAME];
+   unsigned int seed = 1;
+
+   mode = celt_mode_create(48000, 960, NULL);
+   enc = celt_encoder_create_custom(mode, 2, &err);
+   if (enc == NULL)
+   {
+      fprintf(stderr, "Error: celt_encoder_create_custom returned %s\n", celt_strerror(err));
+      return 1;
+   }
+   for (i=0;i<NB_DECODERS;i++)
+      dec[i] = old_celt_decoder_create_custom(mode, 2, &err);
+
+   /* Decoder 0 is the reference: old_celt_decode() */
+   out[1].format = CELT_FORMAT_INT16;
+   out[1].channel[0] = planar16[0];
+   out[1].channel[1] = planar16[1];
+   out[1].stride = 1;
+   out[1].gain = 0;
+   out[2].format = CELT_FORMAT_INT32;
+   out[2].channel[0] = inter32;
+   out[2].channel[1] = inter32+1;
+   out[2].stride = 2;
+   out[2].gain = 0;
+   out[3].format = CELT_FORMAT_INT24;
+   out[3].channel[0] = planar24[0];
+   out[3].channel[1] = planar24[1];
+   out[3].stride = 1;
+   out[3].gain = 0;
+   out[4].format = CELT_FORMAT_FLOAT;
+   out[4].channel[0] = interf;
+   out[4].channel[1] = interf+1;
+   out[4].stride = 2;
+   out[4].gain = 0;
+   /* -6.02 dB, i.e. half the amplitude */
+   out[5].format = CELT_FORMAT_INT16;
+   out[5].channel[0] = gain16[0];
+   out[5].channel[1] = gain16[1];
+   out[5].stride = 1;
+   out[5].gain = -1541;
+
+   for (i=0;i<NB_FRAMES;i++)
+   {
+      test_signal(in, 2, FRAME_SIZE, i*FRAME_SIZE, 0, &seed);
+      len = celt_encode(enc, in, FRAME_SIZE, data, BYTES_PER_FRAME);
+      if (len <= 0)
+      {
+         fprintf(stderr, "Error: celt_encode returned %s\n", celt_strerror(len));
+         return 1;
+      }
+      /* Also check that concealment goes through the same path */
+      if (i==20)
+         len = 0;
+      if (old_celt_decode(dec[0], len ? data : NULL, len, ref, FRAME_SIZE) != FRAME_SIZE)
+      {
+         fprintf(stderr, "Error: old_celt_decode failed\n");
+         return 1;
+      }
+#if defined(FIXED_POINT) && defined(DISABLE_FLOAT_API)
+      out[4].format = CELT_FORMAT_INT16;
+#endif
+      for (j=1;j<NB_DECODERS;j++)
+      {
+         err = celt_decode_to(dec[j], len ? data : NULL, len, &out[j], FRAME_SIZE);
+         if (err != FRAME_SIZE)
+         {
+            fprintf(stderr, "Error: celt_decode_to returned %s\n", celt_strerror(err));
+            return 1;
+         }
+      }
+      for (j=0;j<2*FRAME_SIZE && !errors;j++)
+      {
+         int c = j&1;
+         errors += check("planar int16", j, planar16[c][j>>1], ref[j], 0);
+         errors += check("int32", j, inter32[j]/65536., ref[j], 1);
+         errors += check("planar int24", j, planar24[c][j>>1]/256., ref[j], 1);
+#if !defined(FIXED_POINT) || !defined(DISABLE_FLOAT_API)
+         errors += check("float", j, interf[j]*32768., ref[j], 1);
+#endif
+         errors += check("gain", j, gain16[c][j>>1], ref[j]*.5, 2+abs(ref[j])*.01);
+      }
+      if (errors)
+         return 1;
+   }
+
+   out[1].format = 42;
+   if (celt_decode_to(dec[1], data, len, &out[1], FRAME_SIZE) != CELT_BAD_ARG)
+   {
+      fprintf(stderr, "Error: invalid format accepted\n");
+      return 1;
+   }
+
+   for (i=0;i<NB_DECODERS;i++)
+      celt_decoder_destroy(dec[i]);
+   celt_encoder_destroy(enc);
+   celt_mode_destroy(mode);
+   printf("All output formats match\n");
+   return 0;
+}
@@ -0,0 +1,149 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Checks that celt_encode_packet() packs the same frames that celt_encode()
+   would produce behind a shared TOC, and that celt_decode_packet() decodes
+   them the same as a decoder fed one frame at a time.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "celt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "test-signal.h"
+
+#define MAX_FRAME_SIZE 960
+#define MAX_FRAMES 8
+#define NB_PACKETS 20
+
+static int run(CELTMode *mode, int C, int frame_size, int K, int vbr)
+{
+   int i, k, err;
+   unsigned int seed = 1;
+   /* Each frame gets this many bytes besides its TOC */
+   int bytes = 96000/8*frame_size/48000;
+   int hdr = 2 + 2*(K-1);
+   CELTEncoder *enc, *ref_enc;
+   CELTDecoder *dec, *ref_dec;
+   short pcm[MAX_FRAMES*2*MAX_FRAME_SIZE];
+   short out[MAX_FRAMES*2*MAX_FRAME_SIZE];
+   short ref_out[2*MAX_FRAME_SIZE];
+   unsigned char packet[MAX_FRAMES*1276];
+   unsigned char ref[1276];
+
+   enc = celt_encoder_create_custom(mode, C, &err);
+   ref_enc = celt_encoder_create_custom(mode, C, &err);
+   dec = old_celt_decoder_create_custom(mode, C, &err);
+   ref_dec = old_celt_decoder_create_custom(mode, C, &err);
+   if (enc==NULL || ref_enc==NULL || dec==NULL || ref_dec==NULL)
+   {
+      fprintf(stderr, "Error: cannot create the encoders and decoders: %s\n", celt_strerror(err));
+      return 1;
+   }
+   if (vbr)
+   {
+      celt_encoder_ctl(enc, CELT_SET_VBR(1));
+      celt_encoder_ctl(enc, CELT_SET_BITRATE(64000));
+   }
+
+   for (i=0;i<NB_PACKETS;i++)
+   {
+      int len, ret;
+      const unsigned char *frame;
+
+      test_signal(pcm, C, K*frame_size, i*K*frame_size, 700, &seed);
+      len = celt_encode_packet(enc, pcm, frame_size, K, packet, hdr+K*bytes);
+      if (len<=0)
+      {
+         fprintf(stderr, "Error: celt_encode_packet returned %s\n", celt_strerror(len));
+         return 1;
+      }
+      ret = celt_decode_packet(dec, packet, len, out, frame_size, K);
+      if (ret!=K*frame_size)
+      {
+         fprintf(stderr, "Error: celt_decode_packet returned %d (%s)\n", ret, celt_strerror(ret));
+         return 1;
+      }
+      if (vbr)
+         continue;
+
+      /* With CBR all the frames have the same size, so there are no lengths */
+      if (len!=2+K*bytes || packet[1]!=K)
+      {
+         fprintf(stderr, "Error: unexpected CBR packet layout (%d bytes)\n", len);
+         return 1;
+      }
+      frame = packet+2;
+      for (k=0;k<K;k++)
+      {
+         int ref_len = celt_encode(ref_enc, pcm+k*frame_size*C, frame_size, ref, bytes+1);
+         if (ref_len!=bytes+1 || (ref[0]|3)!=packet[0] || memcmp(ref+1, frame, bytes))
+         {
+            fprintf(stderr, "Error: frame %d of packet %d differs (%d channels, frame size %d)\n",
+                  k, i, C, frame_size);
+            return 1;
+         }
+         if (old_celt_decode(ref_dec, ref, ref_len, ref_out, frame_size)!=frame_size
+               || memcmp(ref_out, out+k*frame_size*C, frame_size*C*sizeof(short)))
+         {
+            fprintf(stderr, "Error: frame %d of packet %d decodes differently\n", k, i);
+            return 1;
+         }
+         frame += bytes;
+      }
+   }
+
+   /* Not enough room in the output */
+   if (celt_decode_packet(dec, packet, celt_encode_packet(enc, pcm, frame_size, K, packet, hdr+K*bytes),
+         out, frame_size, K-1)!=(K>1 ? CELT_BUFFER_TOO_SMALL : CELT_BAD_ARG))
+   {
+      fprintf(stderr, "Error: celt_decode_packet did not check the output size\n");
+      return 1;
+   }
+
+   celt_encoder_destroy(enc);
+   celt_encoder_destroy(ref_enc);
+   celt_decoder_destroy(dec);
+   celt_decoder_destroy(ref_dec);
+   return 0;
+}
+
+int main(void)
+{
+   CELTMode *mode;
+
+   mode = celt_mode_create(48000, 960, NULL);
+   if (run(mode, 1, 120, 8, 0) || run(mode, 2, 240, 4, 0) || run(mode, 1, 960, 1, 0)
+         || run(mode, 1, 120, 6, 1) || run(mode, 2, 240, 3, 1))
+      return 1;
+   celt_mode_destroy(mode);
+   printf("All packets match\n");
+   return 0;
+}
@@ -0,0 +1,119 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Checks that celt_encode_simulcast() produces exactly the same packets as
+   encoding each layer on its own with celt_encode().
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "celt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "test-signal.h"
+
+
+#define MAX_FRAME_SIZE 960
+#define NB_FRAMES 40
+#define NB_LAYERS 3
+#define MAX_BYTES 400
+
+static const int bitrates[NB_LAYERS] = {24000, 48000, 96000};
+
+static int run(CELTMode *mode, int C, int frame_size, int vbr)
+{
+   int i, k, err;
+   CELTEncoder *layer[NB_LAYERS];
+   CELTEncoder *single[NB_LAYERS];
+   short in[2*MAX_FRAME_SIZE];
+   unsigned char data[NB_LAYERS][MAX_BYTES];
+   unsigned char *packets[NB_LAYERS];
+   unsigned char ref[MAX_BYTES];
+   int bytes[NB_LAYERS];
+   int len[NB_LAYERS];
+   unsigned int seed = 1;
+
+   for (k=0;k<NB_LAYERS;k++)
+   {
+      layer[k] = celt_encoder_create_custom(mode, C, &err);
+      single[k] = celt_encoder_create_custom(mode, C, &err);
+      if (layer[k]==NULL || single[k]==NULL)
+      {
+         fprintf(stderr, "Error: celt_encoder_create_custom returned %s\n", celt_strerror(err));
+         return 1;
+      }
+      celt_encoder_ctl(layer[k], CELT_SET_VBR(vbr));
+      celt_encoder_ctl(single[k], CELT_SET_VBR(vbr));
+      celt_encoder_ctl(layer[k], CELT_SET_BITRATE(bitrates[k]));
+      celt_encoder_ctl(single[k], CELT_SET_BITRATE(bitrates[k]));
+      bytes[k] = bitrates[k]/8*frame_size/48000;
+      packets[k] = data[k];
+   }
+
+   for (i=0;i<NB_FRAMES;i++)
+   {
+      /* Clicks, so that the layers see transients */
+      test_signal(in, C, frame_size, i*frame_size, 700, &seed);
+      err = celt_encode_simulcast(layer, NB_LAYERS, in, frame_size, packets, bytes, len);
+      if (err != CELT_OK)
+      {
+         fprintf(stderr, "Error: celt_encode_simulcast returned %s\n", celt_strerror(err));
+         return 1;
+      }
+      for (k=0;k<NB_LAYERS;k++)
+      {
+         int ref_len = celt_encode(single[k], in, frame_size, ref, bytes[k]);
+         if (ref_len != len[k] || memcmp(ref, data[k], ref_len) != 0)
+         {
+            fprintf(stderr, "Error: layer %d differs in frame %d (%d channels, frame size %d, vbr %d)\n", k, i, C, frame_size, vbr);
+            return 1;
+         }
+      }
+   }
+
+   for (k=0;k<NB_LAYERS;k++)
+   {
+      celt_encoder_destroy(layer[k]);
+      celt_encoder_destroy(single[k]);
+   }
+   return 0;
+}
+
+int main(void)
+{
+   CELTMode *mode;
+
+   mode = celt_mode_create(48000, 960, NULL);
+   if (run(mode, 1, 960, 0) || run(mode, 1, 240, 1) || run(mode, 2, 960, 1)
+         || run(mode, 2, 480, 0) || run(mode, 1, 120, 1))
+      return 1;
+   celt_mode_destroy(mode);
+   printf("All layers match\n");
+   return 0;
+}
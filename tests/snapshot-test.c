@@ -0,0 +1,174 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Checks that encoders and decoders restored from a snapshot carry on
+   exactly like the ones the snapshot was taken from, including after a
+   trial encoding and during packet loss.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "celt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "test-signal.h"
+
+#define MAX_FRAME_SIZE 960
+#define NB_FRAMES 40
+#define SNAPSHOT_FRAME 15
+#define MAX_SNAPSHOT 100000
+
+static int lost(int i)
+{
+   return i==SNAPSHOT_FRAME || i==SNAPSHOT_FRAME+1 || i%11==0;
+}
+
+static int run(CELTMode *mode, int C, int frame_size, int vbr, int tracking)
+{
+   int i, err, size;
+   unsigned int seed = 1;
+   int bytes = 64000/8*frame_size/48000;
+   CELTEncoder *enc, *enc2, *other;
+   CELTDecoder *dec, *dec2;
+   short in[2*MAX_FRAME_SIZE];
+   short out[2*MAX_FRAME_SIZE], out2[2*MAX_FRAME_SIZE];
+   unsigned char data[1276], data2[1276];
+   static unsigned char snapshot[MAX_SNAPSHOT];
+
+   enc = celt_encoder_create_custom(mode, C, &err);
+   enc2 = celt_encoder_create_custom(mode, C, &err);
+   other = celt_encoder_create_custom(mode, 3-C, &err);
+   if (tracking)
+   {
+      /* Only these decoders keep the tracking state */
+      dec = celt_decoder_create_history(mode, C, frame_size, 2, &err);
+      dec2 = celt_decoder_create_history(mode, C, frame_size, 2, &err);
+   } else {
+      dec = old_celt_decoder_create_custom(mode, C, &err);
+      dec2 = old_celt_decoder_create_custom(mode, C, &err);
+   }
+   if (enc==NULL || enc2==NULL || other==NULL || dec==NULL || dec2==NULL)
+   {
+      fprintf(stderr, "Error: cannot create the encoders and decoders: %s\n", celt_strerror(err));
+      return 1;
+   }
+   celt_encoder_ctl(enc, CELT_SET_VBR(vbr));
+   celt_encoder_ctl(enc, CELT_SET_BITRATE(64000));
+   celt_decoder_ctl(dec, CELT_SET_PLC_TRACKING(tracking));
+
+   /* Nothing but zeros yet */
+   size = celt_encoder_snapshot(enc, NULL, 0);
+   if (size<=0 || size>=celt_encoder_get_size_custom(mode, C)/4)
+   {
+      fprintf(stderr, "Error: the snapshot of a new encoder takes %d bytes\n", size);
+      return 1;
+   }
+
+   for (i=0;i<NB_FRAMES;i++)
+   {
+      int len, len2, ret, ret2;
+      test_signal(in, C, frame_size, i*frame_size, 700, &seed);
+
+      if (i==SNAPSHOT_FRAME)
+      {
+         /* Try a frame at another rate, then go back */
+         size = celt_encoder_snapshot(enc, snapshot, MAX_SNAPSHOT);
+         if (size<=0 || celt_encoder_snapshot(enc, snapshot, size-1)!=CELT_BUFFER_TOO_SMALL)
+         {
+            fprintf(stderr, "Error: celt_encoder_snapshot returned %d\n", size);
+            return 1;
+         }
+         celt_encode(enc, in, frame_size, data, bytes/2);
+         if (celt_encoder_restore(enc, snapshot, size)!=CELT_OK
+               || celt_encoder_restore(enc2, snapshot, size)!=CELT_OK)
+         {
+            fprintf(stderr, "Error: cannot restore the encoder\n");
+            return 1;
+         }
+         if (celt_encoder_restore(enc2, snapshot, size-4)!=CELT_CORRUPTED_DATA
+               || celt_encoder_restore(other, snapshot, size)!=CELT_BAD_ARG)
+         {
+            fprintf(stderr, "Error: a bad encoder snapshot was accepted\n");
+            return 1;
+         }
+
+         size = celt_decoder_snapshot(dec, snapshot, MAX_SNAPSHOT);
+         if (size<=0 || celt_decoder_restore(dec2, snapshot, size)!=CELT_OK)
+         {
+            fprintf(stderr, "Error: cannot restore the decoder\n");
+            return 1;
+         }
+         snapshot[0] ^= 1;
+         if (celt_decoder_restore(dec2, snapshot, size)!=CELT_CORRUPTED_DATA)
+         {
+            fprintf(stderr, "Error: a bad decoder snapshot was accepted\n");
+            return 1;
+         }
+      }
+
+      len = celt_encode(enc, in, frame_size, data, bytes);
+      ret = old_celt_decode(dec, lost(i) ? NULL : data, len, out, frame_size);
+      if (i<SNAPSHOT_FRAME)
+         continue;
+      len2 = celt_encode(enc2, in, frame_size, data2, bytes);
+      ret2 = old_celt_decode(dec2, lost(i) ? NULL : data, len, out2, frame_size);
+      if (len!=len2 || memcmp(data, data2, len))
+      {
+         fprintf(stderr, "Error: the restored encoder differs in frame %d (%d channels, frame size %d, vbr %d)\n",
+               i, C, frame_size, vbr);
+         return 1;
+      }
+      if (ret!=ret2 || memcmp(out, out2, frame_size*C*sizeof(short)))
+      {
+         fprintf(stderr, "Error: the restored decoder differs in frame %d (%d channels, frame size %d, tracking %d)\n",
+               i, C, frame_size, tracking);
+         return 1;
+      }
+   }
+
+   celt_encoder_destroy(enc);
+   celt_encoder_destroy(enc2);
+   celt_encoder_destroy(other);
+   celt_decoder_destroy(dec);
+   celt_decoder_destroy(dec2);
+   return 0;
+}
+
+int main(void)
+{
+   CELTMode *mode;
+
+   mode = celt_mode_create(48000, 960, NULL);
+   if (run(mode, 1, 960, 0, 0) || run(mode, 2, 480, 1, 1) || run(mode, 1, 240, 1, 1)
+         || run(mode, 2, 120, 0, 0))
+      return 1;
+   celt_mode_destroy(mode);
+   printf("All restored states match\n");
+   return 0;
+}
@@ -0,0 +1,52 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Synthetic input shared by the tests.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TEST_SIGNAL_H
+#define TEST_SIGNAL_H
+
+#include <math.h>
+
+/* Writes n samples per channel, starting at sample pos of the signal. The
+   first channel is a tone plus noise, with a click every click_period
+   samples (none if 0) so that there are transients. The second channel is a
+   modulated tone. seed is the state of the noise generator. */
+static void test_signal(short *pcm, int C, int n, int pos, int click_period, unsigned int *seed)
+{
+   int i;
+   for (i=0;i<n;i++)
+   {
+      int t = pos+i;
+      *seed = 1664525**seed + 1013904223;
+      pcm[i*C] = (short)(8000*sin(.02*t) + ((int)(*seed>>20)-2048)
+            + (click_period && t%click_period<10 ? 20000 : 0));
+      if (C==2)
+         pcm[i*C+1] = (short)(4000*sin(.3*t)*sin(.001*t));
+   }
+}
+
+#endif /* TEST_SIGNAL_H */
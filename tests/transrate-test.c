@@ -0,0 +1,155 @@
+/* Copyright (c) 2011 Xiph.Org Foundation */
+/*
+   Transrates a high-rate stream down with celt_transrate() and checks that
+   a regular decoder accepts the result and that the quality is close to
+   what the encoder gets at the lower rate.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "celt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "test-signal.h"
+
+#define MAX_FRAME_SIZE 960
+#define LENGTH 19200
+#define HIGH_RATE 128000
+#define LOW_RATE 48000
+/* Transrating twice quantises, so it gets to lose a bit */
+#define MAX_LOSS 4.
+
+static void generate(int C, short *pcm)
+{
+   unsigned int seed = 1;
+   test_signal(pcm, C, LENGTH, 0, 2000, &seed);
+}
+
+static double snr(const short *pcm, const short *out, int C, int pos, int frame_size, int skip, double *SN)
+{
+   int i;
+   for (i=0;i<frame_size*C;i++)
+   {
+      int j = (pos-skip)*C+i;
+      if (j>=0)
+      {
+         SN[0] += (double)pcm[j]*pcm[j];
+         SN[1] += (double)(pcm[j]-out[i])*(pcm[j]-out[i]);
+      }
+   }
+   return 10*log10((SN[0]+1)/(SN[1]+1));
+}
+
+static int run(CELTMode *mode, const short *pcm, int C, int frame_size)
+{
+   int pos, err, skip;
+   int high_bytes = HIGH_RATE/8*frame_size/48000;
+   int low_bytes = LOW_RATE/8*frame_size/48000;
+   double direct_SN[2] = {0, 0};
+   double trans_SN[2] = {0, 0};
+   double direct_snr=0, trans_snr=0;
+   CELTEncoder *high, *low, *out;
+   CELTDecoder *parse, *dec, *direct_dec;
+   unsigned char data[1275];
+   unsigned char trans[1275];
+   short dec_pcm[2*MAX_FRAME_SIZE];
+
+   high = celt_encoder_create_custom(mode, C, &err);
+   low = celt_encoder_create_custom(mode, C, &err);
+   out = celt_encoder_create_custom(mode, C, &err);
+   parse = old_celt_decoder_create_custom(mode, C, &err);
+   dec = old_celt_decoder_create_custom(mode, C, &err);
+   direct_dec = old_celt_decoder_create_custom(mode, C, &err);
+   if (high==NULL || low==NULL || out==NULL || parse==NULL || dec==NULL || direct_dec==NULL)
+   {
+      fprintf(stderr, "Error: cannot create the encoders and decoders: %s\n", celt_strerror(err));
+      return 1;
+   }
+   celt_decoder_ctl(dec, CELT_GET_LOOKAHEAD(&skip));
+
+   for (pos=0;pos+frame_size<=LENGTH;pos+=frame_size)
+   {
+      int len, trans_len;
+
+      len = celt_encode(high, pcm+pos*C, frame_size, data, high_bytes);
+      trans_len = celt_transrate(parse, out, data, len, frame_size, trans, low_bytes);
+      if (len<0 || trans_len!=low_bytes)
+      {
+         fprintf(stderr, "Error: transrating returned %d (%s) instead of %d bytes\n",
+               trans_len, celt_strerror(trans_len), low_bytes);
+         return 1;
+      }
+      if (old_celt_decode(dec, trans, trans_len, dec_pcm, frame_size)!=frame_size)
+      {
+         fprintf(stderr, "Error: cannot decode the transrated packet\n");
+         return 1;
+      }
+      trans_snr = snr(pcm, dec_pcm, C, pos, frame_size, skip, trans_SN);
+
+      len = celt_encode(low, pcm+pos*C, frame_size, data, low_bytes);
+      if (old_celt_decode(direct_dec, data, len, dec_pcm, frame_size)!=frame_size)
+      {
+         fprintf(stderr, "Error: cannot decode the direct packet\n");
+         return 1;
+      }
+      direct_snr = snr(pcm, dec_pcm, C, pos, frame_size, skip, direct_SN);
+   }
+   printf("%d channel(s), frame size %d: %.2f dB transrated, %.2f dB direct\n",
+         C, frame_size, trans_snr, direct_snr);
+
+   celt_encoder_destroy(high);
+   celt_encoder_destroy(low);
+   celt_encoder_destroy(out);
+   celt_decoder_destroy(parse);
+   celt_decoder_destroy(dec);
+   celt_decoder_destroy(direct_dec);
+   if (trans_snr < direct_snr-MAX_LOSS)
+   {
+      fprintf(stderr, "Error: transrating loses too much\n");
+      return 1;
+   }
+   return 0;
+}
+
+int main(void)
+{
+   CELTMode *mode;
+   short pcm[2*LENGTH];
+
+   mode = celt_mode_create(48000, 960, NULL);
+   generate(1, pcm);
+   if (run(mode, pcm, 1, 960) || run(mode, pcm, 1, 240) || run(mode, pcm, 1, 120))
+      return 1;
+   generate(2, pcm);
+   if (run(mode, pcm, 2, 960) || run(mode, pcm, 2, 480))
+      return 1;
+   celt_mode_destroy(mode);
+   return 0;
+}
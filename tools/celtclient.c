@@ -32,6 +32,7 @@
 
 /* Compile with something like:
  * gcc -oceltclient celtclient.c alsa_device.c -I../libcelt/ -lspeexdsp  -lasound -lcelt -lm
+ * (libspeexdsp is only needed for the echo canceller)
  */
  
 #ifdef HAVE_CONFIG_H
@@ -50,7 +51,7 @@
 
 #include "alsa_device.h"
 #include <celt.h>
-#include <speex/speex_jitter.h>
+#include <celt_jitter.h>
 
 #include <sched.h>
 
@@ -153,10 +154,9 @@ int main(int argc, char *argv[])
    pfds[nfds].events = POLLIN;
 
    /* Setup jitter buffer using decoder */
-   JitterBuffer *jitter;
-   jitter = jitter_buffer_init(FRAME_SIZE);
-   tmp = FRAME_SIZE;
-   jitter_buffer_ctl(jitter, JITTER_BUFFER_SET_MARGIN, &tmp);
+   CELTJitter *jitter;
+   jitter = celt_jitter_create(FRAME_SIZE, NULL);
+   celt_jitter_ctl(jitter, CELT_JITTER_SET_MARGIN(FRAME_SIZE));
 #ifdef HAS_SPEEX_AEC
    /* Echo canceller with 200 ms tail length */
    SpeexEchoState *echo_state = speex_echo_state_init(FRAME_SIZE, 10*FRAME_SIZE);
@@ -176,15 +176,12 @@ int main(int argc, char *argv[])
          n = recv(sd, msg, MAX_MSG, 0);
          int recv_timestamp = ((int*)msg)[0];
    
-         JitterBufferPacket packet;
-         packet.data = msg+4;
-         packet.len = n-4;
-         packet.timestamp = recv_timestamp;
-         packet.span = FRAME_SIZE;
-         packet.sequence = 0;
          /* Put content of the packet into the jitter buffer, except for the pseudo-header */
-         jitter_buffer_put(jitter, &packet);
-         recv_started = 1;
+         if (n >= 4)
+         {
+            celt_jitter_put(jitter, (unsigned char*)msg+4, n-4, recv_timestamp);
+            recv_started = 1;
+         }
 
       }
       /* Ready to play a frame (playback) */
@@ -193,15 +190,8 @@ int main(int argc, char *argv[])
          short pcm[FRAME_SIZE*CHANNELS];
          if (recv_started)
          {
-            JitterBufferPacket packet;
-            /* Get audio from the jitter buffer */
-            packet.data = msg;
-            packet.len  = MAX_MSG;
-            jitter_buffer_tick(jitter);
-            jitter_buffer_get(jitter, &packet, FRAME_SIZE, NULL);
-            if (packet.len==0)
-              packet.data=NULL;
-            old_celt_decode(dec_state, packet.data, packet.len, pcm, FRAME_SIZE);
+            /* Get audio from the jitter buffer (concealed if missing) */
+            celt_jitter_decode(jitter, dec_state, pcm);
          } else {
             for (i=0;i<FRAME_SIZE*CHANNELS;i++)
                pcm[i] = 0;
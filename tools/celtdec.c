@@ -137,6 +137,265 @@ static void print_comments(char *comments, int length)
    }
 }
 
+/* One entry per Ogg page of the CELT stream. packetno is the number of the
+   first packet that starts on the page (a packet continued from the previous
+   page is not counted), using the same numbering as packet_count in main().
+   packets is the number of packets that end on the page. start is the
+   granule position at which packet packetno starts (see seek_index_starts()).
+   It is not stored in the sidecar. */
+typedef struct {
+   ogg_int64_t offset;
+   ogg_int64_t granulepos;
+   ogg_int64_t start;
+   int packetno;
+   int packets;
+} SeekPoint;
+
+typedef struct {
+   SeekPoint *points;
+   int nb_points;
+   int alloc_points;
+   int first; /* First point with a known start, nb_points if none */
+   int last;  /* Last point with a known start */
+} SeekIndex;
+
+#define SEEK_INDEX_MAGIC "CELTIDX2"
+
+static void seek_index_clear(SeekIndex *idx)
+{
+   free(idx->points);
+   idx->points = NULL;
+   idx->nb_points = idx->alloc_points = 0;
+}
+
+static int seek_index_add(SeekIndex *idx, ogg_int64_t offset, ogg_int64_t granulepos, int packetno, int packets)
+{
+   if (idx->nb_points == idx->alloc_points)
+   {
+      SeekPoint *tmp;
+      int alloc = idx->alloc_points ? 2*idx->alloc_points : 256;
+      tmp = realloc(idx->points, alloc*sizeof(SeekPoint));
+      if (tmp == NULL)
+         return -1;
+      idx->points = tmp;
+      idx->alloc_points = alloc;
+   }
+   idx->points[idx->nb_points].offset = offset;
+   idx->points[idx->nb_points].granulepos = granulepos;
+   idx->points[idx->nb_points].packetno = packetno;
+   idx->points[idx->nb_points].packets = packets;
+   idx->nb_points++;
+   return 0;
+}
+
+/* Scans the whole file once, recording where each page of the CELT stream
+   starts. The file position is left undefined. */
+static int seek_index_build(FILE *fin, int serialno, SeekIndex *idx)
+{
+   ogg_sync_state oy;
+   ogg_page og;
+   ogg_int64_t offset=0;
+   int packets=0;
+   int ret=0;
+
+   if (fseek(fin, 0, SEEK_SET))
+      return -1;
+   ogg_sync_init(&oy);
+   while (1)
+   {
+      long len = ogg_sync_pageseek(&oy, &og);
+      if (len == 0)
+      {
+         char *data = ogg_sync_buffer(&oy, 4096);
+         int nb_read = fread(data, sizeof(char), 4096, fin);
+         if (nb_read == 0)
+            break;
+         ogg_sync_wrote(&oy, nb_read);
+      } else if (len < 0)
+      {
+         /* Skipped over garbage */
+         offset -= len;
+      } else {
+         if (ogg_page_serialno(&og) == serialno)
+         {
+            int first = ogg_page_continued(&og) ? packets+1 : packets;
+            if (seek_index_add(idx, offset, ogg_page_granulepos(&og), first, ogg_page_packets(&og)))
+            {
+               ret = -1;
+               break;
+            }
+            packets += ogg_page_packets(&og);
+         }
+         offset += len;
+      }
+   }
+   ogg_sync_clear(&oy);
+   return ret;
+}
+
+static void write_int32(FILE *file, celt_int32 i)
+{
+   unsigned char buf[4];
+   buf[0] = i&0xff;
+   buf[1] = (i>>8)&0xff;
+   buf[2] = (i>>16)&0xff;
+   buf[3] = (i>>24)&0xff;
+   fwrite(buf, 1, 4, file);
+}
+
+static int read_int32(FILE *file, celt_int32 *i)
+{
+   unsigned char buf[4];
+   if (fread(buf, 1, 4, file) != 4)
+      return -1;
+   *i = readint(buf, 0);
+   return 0;
+}
+
+static void write_int64(FILE *file, ogg_int64_t i)
+{
+   write_int32(file, (celt_int32)(i&0xffffffff));
+   write_int32(file, (celt_int32)(i>>32));
+}
+
+static int read_int64(FILE *file, ogg_int64_t *i)
+{
+   celt_int32 lo, hi;
+   if (read_int32(file, &lo) || read_int32(file, &hi))
+      return -1;
+   *i = ((ogg_int64_t)hi<<32) | (celt_uint32)lo;
+   return 0;
+}
+
+/* Sidecar layout (all little endian): magic, size of the indexed file,
+   serial number, number of points, then offset/granulepos/packetno/packets
+   for each point. The file size is only there to catch a stale index. */
+static int seek_index_write(const char *filename, ogg_int64_t file_size, int serialno, const SeekIndex *idx)
+{
+   FILE *file;
+   int i;
+   file = fopen(filename, "wb");
+   if (!file)
+      return -1;
+   fwrite(SEEK_INDEX_MAGIC, 1, 8, file);
+   write_int64(file, file_size);
+   write_int32(file, serialno);
+   write_int32(file, idx->nb_points);
+   for (i=0;i<idx->nb_points;i++)
+   {
+      write_int64(file, idx->points[i].offset);
+      write_int64(file, idx->points[i].granulepos);
+      write_int32(file, idx->points[i].packetno);
+      write_int32(file, idx->points[i].packets);
+   }
+   i = ferror(file);
+   fclose(file);
+   return i ? -1 : 0;
+}
+
+static int seek_index_read(const char *filename, ogg_int64_t file_size, int serialno, SeekIndex *idx)
+{
+   FILE *file;
+   char magic[8];
+   ogg_int64_t size;
+   celt_int32 serial, nb_points;
+   int i;
+   file = fopen(filename, "rb");
+   if (!file)
+      return -1;
+   if (fread(magic, 1, 8, file) != 8 || memcmp(magic, SEEK_INDEX_MAGIC, 8)
+         || read_int64(file, &size) || size != file_size
+         || read_int32(file, &serial) || serial != serialno
+         || read_int32(file, &nb_points) || nb_points < 0)
+   {
+      fclose(file);
+      return -1;
+   }
+   for (i=0;i<nb_points;i++)
+   {
+      ogg_int64_t offset, granulepos;
+      celt_int32 packetno, packets;
+      if (read_int64(file, &offset) || read_int64(file, &granulepos)
+            || read_int32(file, &packetno) || read_int32(file, &packets)
+            || seek_index_add(idx, offset, granulepos, packetno, packets))
+      {
+         seek_index_clear(idx);
+         fclose(file);
+         return -1;
+      }
+   }
+   fclose(file);
+   return 0;
+}
+
+/* Works out the start of each page after the headers, in granule units. A
+   granulepos is where the last packet ending on its page stops, and each
+   packet lasts duration. A page can then count back from the next
+   granulepos, which copes with streams that do not start at zero and with
+   gaps. The last page of the stream is the exception, because its last
+   packet can be cut short: the pages that would count back from it count on
+   from the granulepos before them instead. */
+static void seek_index_starts(SeekIndex *idx, int first_audio, ogg_int64_t duration)
+{
+   int i;
+   int ended=0, end=0;
+   ogg_int64_t granule=-1;
+   idx->first = idx->nb_points;
+   idx->last = -1;
+   for (i=0;i<idx->nb_points;i++)
+   {
+      SeekPoint *p = &idx->points[i];
+      if (granule>=0)
+      {
+         p->start = granule + (p->packetno-end)*duration;
+         idx->last = i;
+      }
+      ended += p->packets;
+      if (p->granulepos>=0 && ended>first_audio)
+      {
+         granule = p->granulepos;
+         end = ended;
+      }
+   }
+   granule = -1;
+   for (i=idx->nb_points-1;i>=0 && idx->points[i].packetno>=first_audio;i--)
+   {
+      SeekPoint *p = &idx->points[i];
+      if (p->granulepos>=0 && (i<idx->nb_points-1 || idx->last<0))
+      {
+         granule = p->granulepos;
+         end = ended;
+      }
+      if (granule>=0)
+      {
+         p->start = granule - (end-p->packetno)*duration;
+         if (idx->last<0)
+            idx->last = i;
+         idx->first = i;
+      }
+      ended -= p->packets;
+   }
+}
+
+/* Returns the last page whose first packet starts at or before granule, or
+   the first page with a known start if they all start later. Returns -1 if
+   no start is known. */
+static int seek_index_find(const SeekIndex *idx, ogg_int64_t granule)
+{
+   int lo=idx->first, hi=idx->last+1;
+   if (lo>=hi)
+      return -1;
+   while (lo<hi)
+   {
+      int mid = (lo+hi)>>1;
+      if (idx->points[mid].start <= granule)
+         lo = mid+1;
+      else
+         hi = mid;
+   }
+   return lo>idx->first ? lo-1 : idx->first;
+}
+
 FILE *out_file_open(char *outFile, int rate, int *channels)
 {
    FILE *fout=NULL;
@@ -266,6 +525,8 @@ void usage(void)
    printf (" --stereo              Force decoding in stereo\n");
    printf (" --rate n              Force decoding at sampling rate n Hz\n");
    printf (" --packet-loss n       Simulate n %% random packet loss\n");
+   printf (" --seek n              Start decoding at sample n (seekable input only)\n");
+   printf (" --index file          Load the seek index from file, creating it if needed\n");
    printf (" -V                    Verbose mode (show bit-rate)\n"); 
    printf (" -h, --help            This help\n");
    printf (" -v, --version         Version information\n");
@@ -369,6 +630,8 @@ int main(int argc, char **argv)
       {"mono", no_argument, NULL, 0},
       {"stereo", no_argument, NULL, 0},
       {"packet-loss", required_argument, NULL, 0},
+      {"seek", required_argument, NULL, 0},
+      {"index", required_argument, NULL, 0},
       {0, 0, 0, 0}
    };
    ogg_sync_state oy;
@@ -389,7 +652,10 @@ int main(int argc, char **argv)
    int wav_format=0;
    int lookahead=0;
    int celt_serialno = -1;
-   int firstpacket = 1;
+   ogg_int64_t skip=0;
+   ogg_int64_t seek_sample=-1;
+   char *indexFile=NULL;
+   SeekIndex seek_index = {NULL, 0, 0, 0, -1};
 
    enh_enabled = 1;
 
@@ -431,6 +697,14 @@ int main(int argc, char **argv)
          } else if (strcmp(long_options[option_index].name,"packet-loss")==0)
          {
             loss_percent = atof(optarg);
+         } else if (strcmp(long_options[option_index].name,"seek")==0)
+         {
+            seek_sample = strtoll(optarg, NULL, 10);
+            if (seek_sample<0)
+               seek_sample = 0;
+         } else if (strcmp(long_options[option_index].name,"index")==0)
+         {
+            indexFile = optarg;
          }
          break;
       case 'h':
@@ -545,6 +819,8 @@ int main(int argc, char **argv)
                if (!nframes)
                   nframes=1;
                fout = out_file_open(outFile, rate, &channels);
+               /* The first lookahead samples are the encoder delay */
+               skip = lookahead;
 
             } else if (packet_count==1)
             {
@@ -555,6 +831,69 @@ int main(int argc, char **argv)
                /* Ignore extra headers */
             } else {
                int lost=0;
+               if (seek_sample>=0 || indexFile!=NULL)
+               {
+                  int first_audio = 2+extra_headers;
+                  long resume = ftell(fin);
+                  ogg_int64_t file_size;
+                  if (!close_in || resume<0 || fseek(fin, 0, SEEK_END))
+                  {
+                     fprintf (stderr, "Cannot seek on input, decoding from the start\n");
+                     seek_sample = -1;
+                     indexFile = NULL;
+                  } else {
+                     file_size = ftell(fin);
+                     if (indexFile==NULL || seek_index_read(indexFile, file_size, celt_serialno, &seek_index))
+                     {
+                        if (seek_index_build(fin, celt_serialno, &seek_index))
+                        {
+                           fprintf (stderr, "Cannot build the seek index\n");
+                           exit(1);
+                        }
+                        if (indexFile!=NULL && seek_index_write(indexFile, file_size, celt_serialno, &seek_index))
+                           perror(indexFile);
+                     }
+                     indexFile = NULL;
+                  }
+                  if (seek_sample>=0)
+                  {
+                     /* Granule positions count samples of the output after
+                        the encoder delay. Decoding starts one lookahead plus
+                        one overlap before the wanted sample so that the
+                        overlap-add has settled by the time we reach it. */
+                     ogg_int64_t target = seek_sample;
+                     ogg_int64_t duration = (ogg_int64_t)granule_frame_size*nframes;
+                     SeekPoint *p;
+                     int dec_lookahead, k;
+                     celt_decoder_ctl(st, CELT_GET_LOOKAHEAD(&dec_lookahead));
+                     seek_index_starts(&seek_index, first_audio, duration);
+                     k = seek_index_find(&seek_index, target - (dec_lookahead+lookahead));
+                     seek_sample = -1;
+                     p = k>=0 ? &seek_index.points[k] : NULL;
+                     if (p && p->packetno>packet_count)
+                     {
+                        if (fseek(fin, p->offset, SEEK_SET))
+                        {
+                           perror(inFile);
+                           exit(1);
+                        }
+                        ogg_sync_reset(&oy);
+                        ogg_stream_reset_serialno(&os, celt_serialno);
+                        celt_decoder_ctl(st, CELT_RESET_STATE);
+                        packet_count = p->packetno;
+                        skip = target - p->start;
+                        break;
+                     }
+                     /* Nothing to skip over: just decode from here and
+                        throw away the output */
+                     if (p)
+                        skip = target - (p->start + (packet_count-p->packetno)*duration);
+                     else
+                        skip = target + lookahead - (ogg_int64_t)(packet_count-first_audio)*frame_size;
+                  }
+                  if (resume>=0)
+                     fseek(fin, resume, SEEK_SET);
+               }
                if (loss_percent>0 && 100*((float)rand())/RAND_MAX<loss_percent)
                   lost=1;
 
@@ -599,12 +938,12 @@ int main(int argc, char **argv)
                      int new_frame_size = frame_size;
                      /*printf ("packet %d %d\n", packet_no, skip_samples);*/
                      /*fprintf (stderr, "packet %d %d %d\n", packet_no, skip_samples, lookahead);*/
-                     if (firstpacket == 1)
+                     if (skip > 0)
                      {
-                        /*printf ("chopping first packet\n");*/
-                        new_frame_size -= lookahead;
-                        frame_offset = lookahead;
-                        firstpacket = 0;
+                        /*printf ("chopping packet\n");*/
+                        frame_offset = skip < frame_size ? (int)skip : frame_size;
+                        new_frame_size -= frame_offset;
+                        skip -= frame_offset;
                      }
                      if (new_frame_size>0)
                      {  
@@ -655,6 +994,7 @@ int main(int argc, char **argv)
    } else {
       fprintf (stderr, "This doesn't look like a CELT file\n");
    }
+   seek_index_clear(&seek_index);
    if (stream_init)
       ogg_stream_clear(&os);
    ogg_sync_clear(&oy);